@@ -172,14 +172,4 @@ void uri_decode(char *dest, const char *src, size_t len) {
     unsigned char *src_ptr = (unsigned char *) src;
     unsigned char *dst_ptr = (unsigned char *) dest;
     ngx_unescape_uri(&dst_ptr, &src_ptr, len, NGX_UNESCAPE_URI);
-}
-
-void print_bytes(const uint8_t *bytes, int len) {
-    int i;
-
-    for (i = 0; i < len; i++) {
-        printf("%s0x%02x", i != 0 ? ":" : "", bytes[i]);
-    }
-
-    printf("\n");
 }
\ No newline at end of file
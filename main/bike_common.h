@@ -23,6 +23,4 @@ esp_err_t common_init_nvs();
 
 void uri_decode(char *dest, const char *src, size_t len);
 
-void print_bytes(const uint8_t *bytes, int len);
-
 #endif
\ No newline at end of file
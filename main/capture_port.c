@@ -0,0 +1,659 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/message_buffer.h"
+#include "freertos/semphr.h"
+
+#include "capture_port.h"
+#include "my_file_server_common.h"
+#include "bike_common.h"
+#include "ulog_format.h"
+#include "debug_tap.h"
+#include "metrics.h"
+
+static const char *TAG = "capture_port";
+
+#define CAPTURE_RX_BUF_SIZE (2 * 1024)
+#define CAPTURE_EVENT_QUEUE_SIZE (20)
+/* Wait for events at most this long, so an idle logger still flushes */
+#define CAPTURE_IDLE_MS (100)
+/* Symbol times of idle line that end a burst, the driver's default */
+#define CAPTURE_RX_TIMEOUT_DEFAULT (10)
+/* Modbus RTU frames are 3.5 symbol times apart. A longer timeout hands
+ * two frames over as one burst and dates the second too early, so the
+ * decoder would see no gap. freemodbus uses 3 as well. */
+#define CAPTURE_RX_TIMEOUT_MODBUS (3)
+/* Bits of one character on the line, 8N1 */
+#define CAPTURE_SYMBOL_BITS (10)
+/* Posted to the driver's event queue by the TX task, written data is waiting to be published */
+#define CAPTURE_EVENT_TX ((uart_event_type_t) UART_EVENT_MAX)
+/* Posted by capture_port_stop, the receive task is to exit */
+#define CAPTURE_EVENT_STOP ((uart_event_type_t) (UART_EVENT_MAX + 1))
+
+/* Data to send is queued for the port's TX task so callers never wait on
+ * the line. Written data is handed back to the receive task to be
+ * logged, the ring and the logger have a single producer. */
+#define CAPTURE_TX_QUEUE_SIZE (4 * 1024)
+#define CAPTURE_TX_RING_SIZE  (2 * 1024)
+
+typedef struct {
+    int64_t ts_us;
+    uint8_t data[CAPTURE_TX_CHUNK_MAX];
+} capture_tx_rec_t;
+
+/* The debug tap prints from its own task, below everything that moves data */
+#define CAPTURE_TAP_TASK_PRIO   (1)
+#define CAPTURE_TAP_PERIOD_MS   (50)
+
+/* Trigger marks kept per record, further matches are counted only */
+#define CAPTURE_TRIGGER_MARKS (4)
+
+typedef struct {
+    trigger_matcher_t matcher;
+    trigger_history_t history;  // records held back while the window is closed
+    int64_t open_until_us;      // records up to this time are published
+    /* matches in the record being scanned */
+    int64_t scan_us;
+    int64_t last_us;            // last match, marked or not
+    int marks;
+    uint8_t mark_pattern[CAPTURE_TRIGGER_MARKS];
+    int64_t mark_us[CAPTURE_TRIGGER_MARKS];
+} capture_trigger_t;
+
+typedef struct {
+    int port;
+    capture_port_config_t config;
+    TaskHandle_t rx_hdl;
+    TaskHandle_t tx_hdl;            // started and stopped by the receive task
+    QueueHandle_t event_q;
+    /* the tasks are asked to exit rather than deleted, so neither dies in
+     * the middle of a logger or driver call */
+    volatile bool rx_stop;
+    volatile bool tx_stop;
+    SemaphoreHandle_t stopped;      // given by the receive task on its way out
+    uart_logger_t *logger;
+    capture_trigger_t *trigger;     // NULL without trigger patterns
+    debug_tap_t tap;
+    char label[4];                  // port number for the metrics
+    struct {
+        metrics_counter_t rx_bytes;
+        metrics_counter_t rx_overflows;
+        metrics_hist_t event_us;
+    } metrics;
+
+    uart_ring_t ring;
+    uint8_t ring_buff[CAPTURE_RING_SIZE];
+    MessageBufferHandle_t tx_mb;
+    /* a message buffer takes one writer at a time, writes come from the
+     * websocket, replay and stimulus tasks */
+    SemaphoreHandle_t tx_lock;
+    MessageBufferHandle_t tx_log_mb;
+
+    /* receive task */
+    union {
+        ulog_rec_hdr_t hdr;
+        uint8_t raw[sizeof(ulog_rec_hdr_t) + CAPTURE_REC_MAX];
+    } rec;
+    capture_tx_rec_t tx_log_rec;
+    frame_decoder_t decoder;
+    union {
+        ulog_rec_hdr_t hdr;
+        uint8_t raw[sizeof(ulog_rec_hdr_t) + FRAME_MAX];
+    } frame_rec;
+    /* transmit task */
+    capture_tx_rec_t tx_rec;
+
+    /* receive timing */
+    uint32_t byte_ns;           // time of one character at the configured baud rate
+    int64_t rx_timeout_us;      // idle time before the driver reports a burst end
+    int64_t rx_next_us;         // earliest time the next received byte can be stamped with
+    bool rx_idle;               // the next data starts a burst
+
+    volatile uint32_t rx_bytes;
+    volatile uint32_t rx_overflows;
+    volatile uint32_t rx_breaks;
+    volatile uint32_t triggers;
+    volatile uint32_t filtered_bytes;
+    volatile uint32_t tx_frames;
+    volatile uint32_t tx_bytes_written;
+    volatile uint32_t tx_bytes_dropped;
+} capture_port_t;
+
+static capture_port_t capture_ports[CAPTURE_PORT_MAX];
+static TaskHandle_t notify_hdl = NULL;
+static TaskHandle_t tap_hdl = NULL;
+
+static capture_port_t *port_get(int port) {
+    return capture_port_valid(port) ? &capture_ports[port - CAPTURE_PORT_FIRST] : NULL;
+}
+
+static void port_rec_hdr(capture_port_t *p, uint8_t *raw, uint8_t flags, uint32_t aux, int64_t ts_us, uint16_t len) {
+    ulog_rec_hdr_t hdr = {
+            .sync = ULOG_REC_SYNC,
+            .flags = flags | ULOG_FLAG_PORT(p->port),
+            .len = len,
+            .aux = aux,
+            .ts_us = ts_us,
+    };
+    memcpy(raw, &hdr, sizeof(hdr));
+}
+
+/* Write a whole record to the ring and the log, receive task only */
+static void port_write_rec(capture_port_t *p, uint8_t *raw) {
+    ulog_rec_hdr_t hdr;
+    memcpy(&hdr, raw, sizeof(hdr));
+    uart_ring_write(&p->ring, raw, sizeof(ulog_rec_hdr_t) + hdr.len);
+    if (notify_hdl != NULL) {
+        xTaskNotifyGive(notify_hdl);
+    }
+    uart_logger_append(p->logger, hdr.flags, hdr.aux, hdr.ts_us, raw + sizeof(ulog_rec_hdr_t), hdr.len);
+}
+
+/* History flush callback, the window has opened on these */
+static void port_write_held(void *ctx, uint8_t *rec, size_t len) {
+    capture_port_t *p = ctx;
+    p->filtered_bytes -= len;
+    port_write_rec(p, rec);
+}
+
+/* Publish a record whose payload is already behind its header in raw.
+ * In trigger only mode records outside a trigger window are held back
+ * in the history instead. */
+static void port_publish_raw(capture_port_t *p, uint8_t *raw, uint8_t flags, uint32_t aux, int64_t ts_us,
+                             uint16_t len) {
+    port_rec_hdr(p, raw, flags, aux, ts_us, len);
+    if (p->trigger != NULL && p->config.trigger_only && ts_us > p->trigger->open_until_us) {
+        trigger_history_push(&p->trigger->history, raw, sizeof(ulog_rec_hdr_t) + len);
+        p->filtered_bytes += sizeof(ulog_rec_hdr_t) + len;
+        return;
+    }
+    port_write_rec(p, raw);
+}
+
+static void port_publish(capture_port_t *p, uint8_t flags, uint32_t aux, int64_t ts_us, uint16_t len) {
+    port_publish_raw(p, p->rec.raw, flags, aux, ts_us, len);
+}
+
+/* Decoder callback, frames have their own record buffer as the decoder
+ * runs over the data record */
+static void port_publish_frame(void *ctx, const uint8_t *frame, uint16_t len, uint8_t status, int64_t ts_us) {
+    capture_port_t *p = ctx;
+    memcpy(p->frame_rec.raw + sizeof(ulog_rec_hdr_t), frame, len);
+    port_publish_raw(p, p->frame_rec.raw, ULOG_FLAG_FRAME, ULOG_FRAME_AUX(p->decoder.proto, status), ts_us, len);
+}
+
+static void port_trigger_match(void *ctx, int pattern, size_t end) {
+    capture_port_t *p = ctx;
+    capture_trigger_t *t = p->trigger;
+    p->triggers++;
+    t->last_us = t->scan_us + (int64_t) (end - 1) * p->byte_ns / 1000;
+    if (t->marks < CAPTURE_TRIGGER_MARKS) {
+        t->mark_pattern[t->marks] = pattern;
+        t->mark_us[t->marks] = t->last_us;
+        t->marks++;
+    }
+}
+
+/* Look for triggers in a data record about to be published. A match
+ * opens the window: the history from pre_ms before it is published and
+ * everything up to post_ms after it. */
+static void port_trigger_scan(capture_port_t *p, const uint8_t *data, int len, int64_t ts_us) {
+    capture_trigger_t *t = p->trigger;
+    t->marks = 0;
+    t->scan_us = ts_us;
+    trigger_scan(&t->matcher, data, len, port_trigger_match, p);
+    if (t->marks == 0) {
+        return;
+    }
+    /* only holds anything if the window was closed */
+    trigger_history_flush(&t->history, t->mark_us[0] - (int64_t) p->config.trigger_pre_ms * 1000,
+                          port_write_held, p);
+    t->open_until_us = max(t->open_until_us, t->last_us + (int64_t) p->config.trigger_post_ms * 1000);
+}
+
+/* Trigger markers of the record just published, never held back */
+static void port_trigger_marks(capture_port_t *p) {
+    capture_trigger_t *t = p->trigger;
+    uint8_t *raw = p->frame_rec.raw;
+    for (int i = 0; i < t->marks; i++) {
+        port_rec_hdr(p, raw, ULOG_FLAG_EVENT, ULOG_EVENT_TRIGGER, t->mark_us[i], 1);
+        raw[sizeof(ulog_rec_hdr_t)] = t->mark_pattern[i];
+        port_write_rec(p, raw);
+    }
+    t->marks = 0;
+}
+
+/* Publish what the TX task has written */
+static void port_publish_tx(capture_port_t *p) {
+    size_t len;
+    while ((len = xMessageBufferReceive(p->tx_log_mb, &p->tx_log_rec, sizeof(p->tx_log_rec), 0))
+           > sizeof(p->tx_log_rec.ts_us)) {
+        len -= sizeof(p->tx_log_rec.ts_us);
+        memcpy(p->rec.raw + sizeof(ulog_rec_hdr_t), p->tx_log_rec.data, len);
+        port_publish(p, ULOG_FLAG_TX, p->byte_ns, p->tx_log_rec.ts_us, len);
+    }
+}
+
+/* Publish everything the driver has buffered, records end at a detected
+ * pattern. The buffered bytes are taken to have arrived back to back,
+ * ending with the event at now, or a timeout earlier if the event
+ * reported an idle line, so each record is dated from its first byte. */
+static void port_drain(capture_port_t *p, int64_t now, bool idle) {
+    uint8_t *data = p->rec.raw + sizeof(ulog_rec_hdr_t);
+    size_t avail;
+    if (uart_get_buffered_data_len(p->port, &avail) != ESP_OK || avail == 0) {
+        if (idle) {
+            p->rx_idle = true;
+            frame_decoder_idle(&p->decoder, port_publish_frame, p);
+        }
+        return;
+    }
+
+    int64_t end_us = idle ? now - p->rx_timeout_us : now;
+    int64_t start_us = end_us - (int64_t) (avail - 1) * p->byte_ns / 1000;
+    /* cannot overlap what was already published */
+    start_us = max(start_us, p->rx_next_us);
+    int64_t off = 0;
+    while (uart_get_buffered_data_len(p->port, &avail) == ESP_OK && avail > 0) {
+        int len = min(avail, CAPTURE_REC_MAX);
+        if (p->config.pattern_num > 0) {
+            int pos = uart_pattern_get_pos(p->port);
+            if (pos >= 0 && pos + p->config.pattern_num <= len) {
+                uart_pattern_pop_pos(p->port);
+                len = pos + p->config.pattern_num;
+            }
+        }
+        len = uart_read_bytes(p->port, data, len, 0);
+        if (len <= 0) {
+            break;
+        }
+        p->rx_bytes += len;
+        metrics_counter_add(&p->metrics.rx_bytes, len);
+        int64_t ts_us = start_us + off * p->byte_ns / 1000;
+        debug_tap_feed(&p->tap, data, len, ts_us);
+        if (p->trigger != NULL) {
+            port_trigger_scan(p, data, len, ts_us);
+        }
+        port_publish(p, p->rx_idle ? ULOG_FLAG_BURST : 0, p->byte_ns, ts_us, len);
+        if (p->trigger != NULL) {
+            port_trigger_marks(p);
+        }
+        frame_decode(&p->decoder, data, len, ts_us, port_publish_frame, p);
+        p->rx_idle = false;
+        off += len;
+    }
+    p->rx_next_us = start_us + off * p->byte_ns / 1000;
+    p->rx_idle = idle;
+    if (idle) {
+        frame_decoder_idle(&p->decoder, port_publish_frame, p);
+    }
+}
+
+/* In-band marker for clients and the log */
+static void port_publish_event(capture_port_t *p, uint32_t event, int64_t ts_us) {
+    port_publish(p, ULOG_FLAG_EVENT, event, ts_us, 0);
+}
+
+/* Write queued data to the uart, the driver copies it into its TX ring
+ * so this only waits when the ring is full. Started by the receive task
+ * once the driver is installed. */
+static void capture_tx_task(void *args) {
+    capture_port_t *p = args;
+
+    while (!p->tx_stop) {
+        size_t len = xMessageBufferReceive(p->tx_mb, p->tx_rec.data, sizeof(p->tx_rec.data),
+                                           pdMS_TO_TICKS(CAPTURE_IDLE_MS));
+        if (len == 0) {
+            continue;
+        }
+        int written = uart_write_bytes(p->port, p->tx_rec.data, len);
+        if (written <= 0) {
+            p->tx_bytes_dropped += len;
+            continue;
+        }
+        p->tx_bytes_written += written;
+        p->tx_rec.ts_us = esp_timer_get_time();
+        if (xMessageBufferSend(p->tx_log_mb, &p->tx_rec, sizeof(p->tx_rec.ts_us) + written, 0) == 0) {
+            ESP_LOGW(TAG, "uart%d TX log full, %d bytes not logged", p->port, written);
+        }
+        /* wake the receive task, it may be waiting for a quiet line */
+        uart_event_t event = {.type = CAPTURE_EVENT_TX};
+        xQueueSend(p->event_q, &event, 0);
+    }
+
+    xTaskNotifyGive(p->rx_hdl);
+    vTaskDelete(NULL);
+}
+
+static void capture_rx_task(void *args) {
+    capture_port_t *p = args;
+    /* Configure parameters of an UART driver,
+     * communication pins and install the driver */
+    uart_config_t uart_config = {
+            .baud_rate = p->config.baud_rate,
+            .data_bits = UART_DATA_8_BITS,
+            .parity    = UART_PARITY_DISABLE,
+            .stop_bits = UART_STOP_BITS_1,
+            .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+            .source_clk = UART_SCLK_DEFAULT,
+    };
+    int intr_alloc_flags = 0;
+
+#if CONFIG_UART_ISR_IN_IRAM
+    intr_alloc_flags = ESP_INTR_FLAG_IRAM;
+#endif
+
+    ESP_ERROR_CHECK(uart_driver_install(p->port, CAPTURE_RX_BUF_SIZE, CAPTURE_TX_RING_SIZE,
+                                        CAPTURE_EVENT_QUEUE_SIZE, &p->event_q, intr_alloc_flags));
+    ESP_ERROR_CHECK(uart_param_config(p->port, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(p->port, p->config.tx_io_num, p->config.rx_io_num, UART_PIN_NO_CHANGE,
+                                 UART_PIN_NO_CHANGE));
+    if (p->config.rx_full_thresh > 0 && uart_set_rx_full_threshold(p->port, p->config.rx_full_thresh) != ESP_OK) {
+        ESP_LOGW(TAG, "uart%d rx full threshold %d not supported", p->port, p->config.rx_full_thresh);
+    }
+    int rx_timeout_default = p->config.decoder == FRAME_PROTO_MODBUS_RTU ? CAPTURE_RX_TIMEOUT_MODBUS
+                                                                          : CAPTURE_RX_TIMEOUT_DEFAULT;
+    int rx_timeout = p->config.rx_timeout > 0 ? p->config.rx_timeout : rx_timeout_default;
+    if (uart_set_rx_timeout(p->port, rx_timeout) != ESP_OK) {
+        ESP_LOGW(TAG, "uart%d rx timeout %d not supported", p->port, rx_timeout);
+        rx_timeout = rx_timeout_default;
+        uart_set_rx_timeout(p->port, rx_timeout);
+    }
+    p->byte_ns = (uint32_t) (CAPTURE_SYMBOL_BITS * 1000000000ULL / p->config.baud_rate);
+    p->rx_timeout_us = (int64_t) rx_timeout * p->byte_ns / 1000;
+    p->rx_next_us = 0;
+    p->rx_idle = true;
+    frame_decoder_init(&p->decoder, p->config.decoder, p->byte_ns);
+    if (p->config.pattern_num > 0) {
+        uart_enable_pattern_det_baud_intr(p->port, (char) p->config.pattern_chr, p->config.pattern_num, 9, 0, 0);
+        uart_pattern_queue_reset(p->port, CAPTURE_EVENT_QUEUE_SIZE);
+    }
+    ESP_LOGI(TAG, "start uart%d, speed:%d tx:%d, rx:%d", p->port, p->config.baud_rate, p->config.tx_io_num,
+             p->config.rx_io_num);
+
+    if (xTaskCreate(capture_tx_task, "capture_tx", 4096, p, 4, &p->tx_hdl) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create uart%d TX task, nothing will be sent", p->port);
+        p->tx_hdl = NULL;
+    }
+
+    uart_event_t event;
+    while (!p->rx_stop) {
+        if (xQueueReceive(p->event_q, &event, pdMS_TO_TICKS(CAPTURE_IDLE_MS)) != pdTRUE) {
+            /* line idle, let the logger flush what it has */
+            port_publish_tx(p);
+            uart_logger_poll(p->logger, esp_timer_get_time());
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+
+        /* tx records go through the record buffer too, before it is read into */
+        port_publish_tx(p);
+
+        switch (event.type) {
+            case UART_DATA:
+                port_drain(p, now, event.timeout_flag);
+                break;
+            case UART_PATTERN_DET:
+                port_drain(p, now, false);
+                break;
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                /* what the driver holds is still good, only the bytes that
+                 * arrived meanwhile are gone */
+                port_drain(p, now, false);
+                p->rx_overflows++;
+                metrics_counter_add(&p->metrics.rx_overflows, 1);
+                ESP_LOGW(TAG, "uart%d rx overflow (%d)", p->port, event.type);
+                port_publish_event(p, ULOG_EVENT_OVERFLOW, now);
+                break;
+            case UART_BREAK:
+                port_drain(p, now, false);
+                p->rx_breaks++;
+                port_publish_event(p, ULOG_EVENT_BREAK, now);
+                break;
+            default:
+                break;
+        }
+        metrics_hist_observe(&p->metrics.event_us, (uint32_t) (esp_timer_get_time() - now));
+    }
+
+    if (p->tx_hdl != NULL) {
+        p->tx_stop = true;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        p->tx_hdl = NULL;
+    }
+    /* log what the TX task wrote last */
+    port_publish_tx(p);
+    xSemaphoreGive(p->stopped);
+    vTaskDelete(NULL);
+}
+
+static void tap_print(void *ctx, const char *line) {
+    ESP_LOGI(TAG, "%s", line);
+}
+
+static void capture_tap_task(void *args) {
+    while (1) {
+        if (debug_tap_get_level() == DEBUG_TAP_OFF) {
+            vTaskDelay(pdMS_TO_TICKS(10 * CAPTURE_TAP_PERIOD_MS));
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+            debug_tap_drain(&capture_ports[i].tap, now, tap_print, NULL);
+        }
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_TAP_PERIOD_MS));
+    }
+}
+
+/* Series of one name are registered for all ports in a row */
+static void port_metrics_init(void) {
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        capture_port_t *p = &capture_ports[i];
+        snprintf(p->label, sizeof(p->label), "%d", CAPTURE_PORT_FIRST + i);
+        metrics_counter_init(&p->metrics.rx_bytes, "capture_rx_bytes_total", "Bytes read from the uart driver",
+                             "port", p->label);
+    }
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        capture_port_t *p = &capture_ports[i];
+        metrics_counter_init(&p->metrics.rx_overflows, "capture_rx_overflows_total",
+                             "Driver FIFO or buffer overflows", "port", p->label);
+    }
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        capture_port_t *p = &capture_ports[i];
+        metrics_hist_init(&p->metrics.event_us, "capture_event_duration_us",
+                          "Time the receive task spends on one driver event", "port", p->label);
+    }
+}
+
+esp_err_t capture_port_init(void) {
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        capture_port_t *p = &capture_ports[i];
+        if (p->tx_mb != NULL) {
+            continue;
+        }
+        p->port = CAPTURE_PORT_FIRST + i;
+        uart_ring_init(&p->ring, p->ring_buff, CAPTURE_RING_SIZE);
+        debug_tap_init(&p->tap, p->port);
+        p->tx_mb = xMessageBufferCreate(CAPTURE_TX_QUEUE_SIZE);
+        p->tx_log_mb = xMessageBufferCreate(CAPTURE_TX_QUEUE_SIZE);
+        p->tx_lock = xSemaphoreCreateMutex();
+        p->stopped = xSemaphoreCreateBinary();
+        if (p->tx_mb == NULL || p->tx_lock == NULL || p->tx_log_mb == NULL || p->stopped == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (tap_hdl == NULL) {
+        port_metrics_init();
+        if (xTaskCreate(capture_tap_task, "capture_tap", 3072, NULL, CAPTURE_TAP_TASK_PRIO, &tap_hdl) != pdPASS) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+bool capture_port_valid(int port) {
+    return port >= CAPTURE_PORT_FIRST && port < CAPTURE_PORT_FIRST + CAPTURE_PORT_MAX;
+}
+
+void capture_port_stop(int port) {
+    capture_port_t *p = port_get(port);
+    if (p == NULL) {
+        return;
+    }
+
+    if (p->rx_hdl != NULL) {
+        p->rx_stop = true;
+        if (p->event_q != NULL) {
+            uart_event_t event = {.type = CAPTURE_EVENT_STOP};
+            xQueueSend(p->event_q, &event, 0);
+        }
+        xSemaphoreTake(p->stopped, portMAX_DELAY);
+        p->rx_hdl = NULL;
+        p->rx_stop = false;
+        p->tx_stop = false;
+        uart_driver_delete(p->port);
+        p->event_q = NULL;
+    }
+    xSemaphoreTake(p->tx_lock, portMAX_DELAY);
+    xMessageBufferReset(p->tx_mb);
+    xSemaphoreGive(p->tx_lock);
+    xMessageBufferReset(p->tx_log_mb);
+
+    if (p->logger != NULL) {
+        uart_logger_delete(p->logger);
+        p->logger = NULL;
+    }
+    free(p->trigger);
+    p->trigger = NULL;
+}
+
+esp_err_t capture_port_start(int port, const capture_port_config_t *config) {
+    capture_port_t *p = port_get(port);
+    if (p == NULL || config->baud_rate <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->decoder == FRAME_PROTO_MODBUS_RTU && config->rx_timeout > CAPTURE_RX_TIMEOUT_MODBUS) {
+        ESP_LOGE(TAG, "uart%d rx timeout %d hides Modbus RTU frame gaps, at most %d", port, config->rx_timeout,
+                 CAPTURE_RX_TIMEOUT_MODBUS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    capture_port_stop(port);
+
+    p->config = *config;
+    p->config.logger.baud_rate = config->baud_rate;
+    p->config.logger.base_path = FILE_SERVER_BASE_PATH;
+    p->config.logger.port = port;
+    if (p->config.trigger[0] != '\0') {
+        p->trigger = calloc(1, sizeof(capture_trigger_t));
+        if (p->trigger == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        if (trigger_compile(&p->trigger->matcher, p->config.trigger) < 0) {
+            ESP_LOGE(TAG, "Invalid uart%d trigger %s", port, p->config.trigger);
+            capture_port_stop(port);
+            return ESP_ERR_INVALID_ARG;
+        }
+        trigger_history_init(&p->trigger->history);
+    }
+    if (uart_logger_create(&p->config.logger, &p->logger) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create uart%d logger", port);
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(capture_rx_task, "capture_rx", 8192, p, 5, &p->rx_hdl) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create uart%d task", port);
+        capture_port_stop(port);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool capture_port_running(int port) {
+    capture_port_t *p = port_get(port);
+    return p != NULL && p->rx_hdl != NULL && !p->rx_stop;
+}
+
+void capture_port_set_notify(TaskHandle_t task) {
+    notify_hdl = task;
+}
+
+uart_ring_t *capture_port_ring(int port) {
+    capture_port_t *p = port_get(port);
+    return p != NULL ? &p->ring : NULL;
+}
+
+size_t capture_port_write(int port, const uint8_t *data, size_t len) {
+    capture_port_t *p = port_get(port);
+    size_t queued = 0;
+    if (p == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(p->tx_lock, portMAX_DELAY);
+    if (!capture_port_running(port)) {
+        p->tx_bytes_dropped += len;
+        xSemaphoreGive(p->tx_lock);
+        return 0;
+    }
+    p->tx_frames++;
+    while (queued < len) {
+        size_t n = min(len - queued, CAPTURE_TX_CHUNK_MAX);
+        if (xMessageBufferSend(p->tx_mb, data + queued, n, 0) == 0) {
+            ESP_LOGW(TAG, "uart%d TX queue full, %zu bytes dropped", port, len - queued);
+            p->tx_bytes_dropped += len - queued;
+            break;
+        }
+        queued += n;
+    }
+    xSemaphoreGive(p->tx_lock);
+    return queued;
+}
+
+bool capture_port_try_write(int port, const uint8_t *data, size_t len) {
+    capture_port_t *p = port_get(port);
+    if (p == NULL || len > CAPTURE_TX_CHUNK_MAX) {
+        return false;
+    }
+    if (len == 0) {
+        return true;
+    }
+    xSemaphoreTake(p->tx_lock, portMAX_DELAY);
+    bool queued = capture_port_running(port) && xMessageBufferSend(p->tx_mb, data, len, 0) != 0;
+    if (queued) {
+        p->tx_frames++;
+    }
+    xSemaphoreGive(p->tx_lock);
+    return queued;
+}
+
+void capture_port_get_stats(int port, capture_port_stats_t *stats) {
+    capture_port_t *p = port_get(port);
+    memset(stats, 0, sizeof(capture_port_stats_t));
+    if (p == NULL) {
+        return;
+    }
+    stats->running = p->rx_hdl != NULL;
+    stats->baud_rate = p->config.baud_rate;
+    stats->rx_bytes = p->rx_bytes;
+    stats->rx_overflows = p->rx_overflows;
+    stats->rx_breaks = p->rx_breaks;
+    stats->decoder = p->config.decoder;
+    stats->frames = p->decoder.frames;
+    stats->frame_errors = p->decoder.errors;
+    stats->triggers = p->triggers;
+    stats->filtered_bytes = p->filtered_bytes;
+    stats->tx_queue_depth = p->tx_mb ? CAPTURE_TX_QUEUE_SIZE - xMessageBufferSpaceAvailable(p->tx_mb) : 0;
+    stats->tx_frames = p->tx_frames;
+    stats->tx_bytes_written = p->tx_bytes_written;
+    stats->tx_bytes_dropped = p->tx_bytes_dropped;
+    if (p->logger != NULL) {
+        stats->has_logger = true;
+        uart_logger_get_stats(p->logger, &stats->logger);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef CAPTURE_PORT_H
+#define CAPTURE_PORT_H
+
+/*
+ * One uart capture pipeline per port.
+ *
+ * Every port has its own driver, receive and transmit tasks, capture ring
+ * and log writer, so a saturated port only ever drops its own data. Ports
+ * are named by their uart number, UART0 is left to the console.
+ *
+ * The capture ring holds ulog records, a ulog_rec_hdr_t with the port in
+ * its flags followed by the data, always written whole. Subscribers read
+ * a header, then its payload, and can merge several ports by time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "uart_ring.h"
+#include "uart_logger.h"
+#include "frame_decode.h"
+#include "trigger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_PORT_FIRST  (1)
+#define CAPTURE_PORT_MAX    (2)
+/* Largest payload of a captured record */
+#define CAPTURE_REC_MAX     (1024)
+#define CAPTURE_RING_SIZE   (16 * 1024)
+/* Writes are queued in pieces of up to this size, each whole or not at all */
+#define CAPTURE_TX_CHUNK_MAX (512)
+
+typedef struct {
+    int baud_rate;
+    int tx_io_num;
+    int rx_io_num;
+    /* Reception is event driven: received bytes are handed over when the
+     * RX FIFO holds rx_full_thresh bytes or the line has been idle for
+     * rx_timeout symbol times, 0 keeps the defaults. The timeout also
+     * sets how far back the end of a burst is dated. The Modbus RTU
+     * decoder needs a timeout of at most 3, its default. */
+    int rx_full_thresh;
+    int rx_timeout;
+    /* pattern_num repeats of pattern_chr end a record, 0 disables */
+    int pattern_chr;
+    int pattern_num;
+    /* received data is also reassembled into frame records */
+    frame_proto_t decoder;
+    /* byte patterns marked in the stream as they are received, see
+     * trigger.h, empty for none. With trigger_only set only the records
+     * from pre_ms before to post_ms after a trigger are published. */
+    char trigger[TRIGGER_SPEC_MAX];
+    int trigger_pre_ms;
+    int trigger_post_ms;
+    bool trigger_only;
+    uart_logger_config_t logger;    // baud_rate, base_path and port are filled in
+} capture_port_config_t;
+
+typedef struct {
+    bool running;
+    int baud_rate;
+    uint32_t rx_bytes;
+    uint32_t rx_overflows;
+    uint32_t rx_breaks;
+    frame_proto_t decoder;
+    uint32_t frames;
+    uint32_t frame_errors;
+    uint32_t triggers;
+    uint32_t filtered_bytes;        // held back by trigger_only and not published
+    uint32_t tx_queue_depth;        // bytes waiting for the uart
+    uint32_t tx_frames;
+    uint32_t tx_bytes_written;
+    uint32_t tx_bytes_dropped;
+    bool has_logger;
+    uart_logger_stats_t logger;
+} capture_port_stats_t;
+
+esp_err_t capture_port_init(void);
+
+bool capture_port_valid(int port);
+
+/* (Re)start capturing on a port */
+esp_err_t capture_port_start(int port, const capture_port_config_t *config);
+
+void capture_port_stop(int port);
+
+bool capture_port_running(int port);
+
+/* Task notified whenever a port has published records */
+void capture_port_set_notify(TaskHandle_t task);
+
+/* The record ring of a port, NULL for an invalid port */
+uart_ring_t *capture_port_ring(int port);
+
+/* Queue data to send on a port, waiting for other writers only. Returns
+ * the bytes queued, the rest did not fit and is counted as dropped. Safe
+ * to call from several tasks, the bytes of one call go out together. */
+size_t capture_port_write(int port, const uint8_t *data, size_t len);
+
+/* Queue up to CAPTURE_TX_CHUNK_MAX bytes whole or not at all. A full
+ * queue is not counted as dropped, for writers that wait and retry. */
+bool capture_port_try_write(int port, const uint8_t *data, size_t len);
+
+void capture_port_get_stats(int port, capture_port_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CAPTURE_PORT_H
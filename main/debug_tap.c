@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "debug_tap.h"
+
+#define SUMMARY_US (1000 * 1000)
+
+/* One sample in the ring, followed by n bytes */
+typedef struct __attribute__((packed)) {
+    int64_t ts_us;
+    uint16_t len;               // record length
+    uint8_t n;                  // bytes sampled
+} tap_sample_hdr_t;
+
+static volatile debug_tap_level_t tap_level = DEBUG_TAP_OFF;
+static volatile uint32_t tap_rate = DEBUG_TAP_RATE_DEFAULT;
+
+static const char *level_names[] = {"off", "summary", "hex"};
+
+void debug_tap_init(debug_tap_t *tap, int port) {
+    memset(tap, 0, sizeof(debug_tap_t));
+    tap->port = port;
+    uart_ring_init(&tap->ring, tap->ring_buff, DEBUG_TAP_RING_SIZE);
+    uart_ring_reader_attach(&tap->ring, &tap->reader);
+}
+
+void debug_tap_set_level(debug_tap_level_t level) {
+    tap_level = level <= DEBUG_TAP_HEX ? level : DEBUG_TAP_OFF;
+}
+
+debug_tap_level_t debug_tap_get_level(void) {
+    return tap_level;
+}
+
+void debug_tap_set_rate(uint32_t bytes_per_s) {
+    tap_rate = bytes_per_s > 0 ? bytes_per_s : DEBUG_TAP_RATE_DEFAULT;
+}
+
+uint32_t debug_tap_get_rate(void) {
+    return tap_rate;
+}
+
+debug_tap_level_t debug_tap_level_from_name(const char *name) {
+    for (int i = DEBUG_TAP_OFF; i <= DEBUG_TAP_HEX; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            return (debug_tap_level_t) i;
+        }
+    }
+    return DEBUG_TAP_OFF;
+}
+
+const char *debug_tap_level_name(debug_tap_level_t level) {
+    return level <= DEBUG_TAP_HEX ? level_names[level] : level_names[DEBUG_TAP_OFF];
+}
+
+void debug_tap_feed(debug_tap_t *tap, const uint8_t *data, size_t len, int64_t ts_us) {
+    debug_tap_level_t level = tap_level;
+    if (level == DEBUG_TAP_OFF) {
+        return;
+    }
+    tap->bytes += len;
+    tap->records++;
+    if (level != DEBUG_TAP_HEX) {
+        return;
+    }
+
+    /* token bucket, at most one second worth of samples saved up */
+    uint32_t rate = tap_rate;
+    int64_t elapsed_us = ts_us - tap->refill_us;
+    uint64_t refill = elapsed_us > 0 ? (uint64_t) elapsed_us * rate / 1000000 : 0;
+    if (refill > 0) {
+        /* only move on by the time of the whole tokens earned, so frequent small records still refill */
+        uint64_t tokens = tap->tokens + refill;
+        if (tokens >= rate) {
+            tap->tokens = rate;
+            tap->refill_us = ts_us;
+        } else {
+            tap->tokens = (uint32_t) tokens;
+            tap->refill_us += (int64_t) (refill * 1000000 / rate);
+        }
+    }
+
+    /* whole samples only, a trickle of one byte lines tells nothing */
+    size_t n = len < DEBUG_TAP_SAMPLE_MAX ? len : DEBUG_TAP_SAMPLE_MAX;
+    if (n > tap->tokens) {
+        tap->skipped++;
+        return;
+    }
+    tap->tokens -= n;
+    tap->sampled += n;
+
+    uint8_t sample[sizeof(tap_sample_hdr_t) + DEBUG_TAP_SAMPLE_MAX];
+    tap_sample_hdr_t hdr = {
+            .ts_us = ts_us,
+            .len = len > UINT16_MAX ? UINT16_MAX : (uint16_t) len,
+            .n = (uint8_t) n,
+    };
+    memcpy(sample, &hdr, sizeof(hdr));
+    memcpy(sample + sizeof(hdr), data, n);
+    uart_ring_write(&tap->ring, sample, sizeof(hdr) + n);
+}
+
+static void drain_samples(debug_tap_t *tap, debug_tap_out_t out, void *ctx) {
+    static const char hex_digits[] = "0123456789abcdef";
+    char line[DEBUG_TAP_LINE_MAX];
+    uint8_t data[DEBUG_TAP_SAMPLE_MAX];
+
+    while (uart_ring_readable(&tap->ring, &tap->reader) >= sizeof(tap_sample_hdr_t)) {
+        tap_sample_hdr_t hdr;
+        uart_ring_read(&tap->ring, &tap->reader, (uint8_t *) &hdr, sizeof(hdr));
+        if (tap->reader.overrun_count > 0 || hdr.n > DEBUG_TAP_SAMPLE_MAX
+            || uart_ring_read(&tap->ring, &tap->reader, data, hdr.n) != hdr.n || tap->reader.overrun_count > 0) {
+            /* lapped by the producer, start over at the newest sample */
+            snprintf(line, sizeof(line), "uart%d tap: samples lost", tap->port);
+            out(ctx, line);
+            uart_ring_reader_attach(&tap->ring, &tap->reader);
+            return;
+        }
+
+        int p = snprintf(line, sizeof(line), "uart%d %lld.%03lld ms %u B:", tap->port,
+                         (long long) (hdr.ts_us / 1000), (long long) (hdr.ts_us % 1000), hdr.len);
+        for (int i = 0; i < hdr.n; i++) {
+            line[p++] = ' ';
+            line[p++] = hex_digits[data[i] >> 4];
+            line[p++] = hex_digits[data[i] & 0x0f];
+        }
+        if (hdr.n < hdr.len) {
+            memcpy(line + p, " ..", 3);
+            p += 3;
+        }
+        line[p] = '\0';
+        out(ctx, line);
+    }
+}
+
+void debug_tap_drain(debug_tap_t *tap, int64_t now_us, debug_tap_out_t out, void *ctx) {
+    if (tap_level == DEBUG_TAP_HEX) {
+        drain_samples(tap, out, ctx);
+    }
+
+    if (now_us - tap->summary_us < SUMMARY_US) {
+        return;
+    }
+    uint32_t bytes = tap->bytes, records = tap->records, sampled = tap->sampled, skipped = tap->skipped;
+    if (tap_level != DEBUG_TAP_OFF && tap->summary_us != 0 && bytes != tap->last_bytes) {
+        char line[DEBUG_TAP_LINE_MAX];
+        int64_t span_ms = (now_us - tap->summary_us) / 1000;
+        snprintf(line, sizeof(line), "uart%d %lu B/s %lu rec/s, sampled %lu B, %lu rec not sampled",
+                 tap->port, (unsigned long) ((uint64_t) (bytes - tap->last_bytes) * 1000 / span_ms),
+                 (unsigned long) ((uint64_t) (records - tap->last_records) * 1000 / span_ms),
+                 (unsigned long) (sampled - tap->last_sampled), (unsigned long) (skipped - tap->last_skipped));
+        out(ctx, line);
+    }
+    tap->summary_us = now_us;
+    tap->last_bytes = bytes;
+    tap->last_records = records;
+    tap->last_sampled = sampled;
+    tap->last_skipped = skipped;
+}
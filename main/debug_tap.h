@@ -0,0 +1,91 @@
+#ifndef DEBUG_TAP_H
+#define DEBUG_TAP_H
+
+/*
+ * Console debug tap for captured data.
+ *
+ * The receive task only feeds the tap: counters, and at the hex level a
+ * rate limited sample of each record copied into the tap's own small
+ * ring. It never waits for the console. A low priority consumer drains
+ * the ring into text lines and prints the counters once a second, what
+ * it cannot keep up with is overwritten and counted as lost.
+ *
+ * Levels and the sample rate are shared by all taps and may be changed
+ * at any time.
+ *
+ * Plain C only, so the producer cost can be measured on the host.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "uart_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    DEBUG_TAP_OFF = 0,
+    DEBUG_TAP_SUMMARY,          // rates once a second
+    DEBUG_TAP_HEX,              // summary plus sampled hex of the records
+} debug_tap_level_t;
+
+#define DEBUG_TAP_RING_SIZE     (1024)
+#define DEBUG_TAP_SAMPLE_MAX    (32)    // bytes shown of one record
+#define DEBUG_TAP_RATE_DEFAULT  (256)   // sampled bytes per second per tap
+/* Longest line handed to the output callback, terminator included */
+#define DEBUG_TAP_LINE_MAX      (48 + 3 * DEBUG_TAP_SAMPLE_MAX)
+
+typedef struct {
+    int port;
+    uart_ring_t ring;
+    uint8_t ring_buff[DEBUG_TAP_RING_SIZE];
+
+    /* producer */
+    int64_t refill_us;
+    uint32_t tokens;            // sample bytes that may be taken now
+    volatile uint32_t bytes;    // free running
+    volatile uint32_t records;
+    volatile uint32_t sampled;
+    volatile uint32_t skipped;  // records not sampled for lack of tokens
+
+    /* consumer */
+    uart_ring_reader_t reader;
+    int64_t summary_us;
+    uint32_t last_bytes;
+    uint32_t last_records;
+    uint32_t last_sampled;
+    uint32_t last_skipped;
+} debug_tap_t;
+
+typedef void (*debug_tap_out_t)(void *ctx, const char *line);
+
+void debug_tap_init(debug_tap_t *tap, int port);
+
+void debug_tap_set_level(debug_tap_level_t level);
+
+debug_tap_level_t debug_tap_get_level(void);
+
+/* Sampled bytes per second and tap, 0 for the default */
+void debug_tap_set_rate(uint32_t bytes_per_s);
+
+uint32_t debug_tap_get_rate(void);
+
+debug_tap_level_t debug_tap_level_from_name(const char *name);
+
+const char *debug_tap_level_name(debug_tap_level_t level);
+
+/* Producer side, from the task that captured data, never blocks */
+void debug_tap_feed(debug_tap_t *tap, const uint8_t *data, size_t len, int64_t ts_us);
+
+/* Consumer side, out gets the pending sample lines and, once a second,
+ * the summary */
+void debug_tap_drain(debug_tap_t *tap, int64_t now_us, debug_tap_out_t out, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DEBUG_TAP_H
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_vfs.h"
+
+#include "file_index.h"
+#include "ulog_format.h"
+#include "my_file_server_common.h"
+
+static const char *TAG = "file_index";
+
+#define FILE_INDEX_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
+
+static file_index_entry_t entries[FILE_INDEX_MAX];
+static int entry_count = 0;
+static SemaphoreHandle_t index_lock = NULL;
+
+/* order used by entry_cmp, only changed with the lock held */
+static file_index_sort_t sort_key;
+static bool sort_descending;
+
+static bool name_has_ext(const char *name, const char *ext) {
+    size_t len = strlen(name);
+    size_t ext_len = strlen(ext);
+    return len >= ext_len && strcmp(name + len - ext_len, ext) == 0;
+}
+
+static bool file_index_hidden(const char *name) {
+    return strncmp(name, LOG_SEGMENTS_INDEX_FILE, sizeof(LOG_SEGMENTS_INDEX_FILE) - 1) == 0
+           || name_has_ext(name, ULOG_INDEX_EXT)
+           || name_has_ext(name, UPLOAD_TEMP_EXT);
+}
+
+static int entry_find(const char *name) {
+    for (int i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    const file_index_entry_t *ea = a;
+    const file_index_entry_t *eb = b;
+    int64_t diff;
+    switch (sort_key) {
+        case FILE_INDEX_SORT_SIZE:
+            diff = (int64_t) ea->size - eb->size;
+            break;
+        case FILE_INDEX_SORT_MTIME:
+            diff = ea->mtime - eb->mtime;
+            break;
+        case FILE_INDEX_SORT_START:
+            diff = ea->start_us - eb->start_us;
+            break;
+        default:
+            diff = 0;
+            break;
+    }
+    int ret = diff < 0 ? -1 : diff > 0;
+    if (ret == 0) {
+        ret = strcmp(ea->name, eb->name);
+    }
+    return sort_descending ? -ret : ret;
+}
+
+esp_err_t file_index_init(const char *base_path) {
+    char path[FILE_INDEX_PATH_MAX];
+    struct dirent *dir_entry;
+    struct stat entry_stat;
+
+    if (index_lock == NULL) {
+        index_lock = xSemaphoreCreateMutex();
+        if (index_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    DIR *dir = opendir(base_path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Failed to open dir : %s", base_path);
+        return ESP_FAIL;
+    }
+
+    /* the only pass that stats every file */
+    xSemaphoreTake(index_lock, portMAX_DELAY);
+    entry_count = 0;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        if (file_index_hidden(dir_entry->d_name) || strlen(dir_entry->d_name) >= CONFIG_SPIFFS_OBJ_NAME_LEN) {
+            continue;
+        }
+        if (entry_count == FILE_INDEX_MAX) {
+            ESP_LOGW(TAG, "Index full, not listing %s", dir_entry->d_name);
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", base_path, dir_entry->d_name);
+        if (stat(path, &entry_stat) == -1) {
+            continue;
+        }
+        file_index_entry_t *entry = &entries[entry_count++];
+        memset(entry, 0, sizeof(file_index_entry_t));
+        strlcpy(entry->name, dir_entry->d_name, sizeof(entry->name));
+        entry->size = entry_stat.st_size;
+        entry->mtime = entry_stat.st_mtime;
+    }
+    closedir(dir);
+    xSemaphoreGive(index_lock);
+
+    /* capture times come from the segment index */
+    log_segment_t *segs = malloc(LOG_SEGMENTS_MAX * sizeof(log_segment_t));
+    if (segs != NULL) {
+        int count = log_segments_list(segs, LOG_SEGMENTS_MAX);
+        xSemaphoreTake(index_lock, portMAX_DELAY);
+        for (int i = 0; i < count; i++) {
+            int j = entry_find(segs[i].name);
+            if (j >= 0) {
+                entries[j].start_us = segs[i].start_us;
+                entries[j].end_us = segs[i].end_us;
+            }
+        }
+        xSemaphoreGive(index_lock);
+        free(segs);
+    }
+
+    ESP_LOGI(TAG, "%d files", entry_count);
+    return ESP_OK;
+}
+
+void file_index_update(const file_index_entry_t *entry) {
+    if (index_lock == NULL || file_index_hidden(entry->name)) {
+        return;
+    }
+    xSemaphoreTake(index_lock, portMAX_DELAY);
+    int i = entry_find(entry->name);
+    if (i < 0 && entry_count < FILE_INDEX_MAX) {
+        i = entry_count++;
+    }
+    if (i >= 0) {
+        entries[i] = *entry;
+    } else {
+        ESP_LOGW(TAG, "Index full, not listing %s", entry->name);
+    }
+    xSemaphoreGive(index_lock);
+}
+
+void file_index_remove(const char *name) {
+    if (index_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(index_lock, portMAX_DELAY);
+    int i = entry_find(name);
+    if (i >= 0) {
+        entries[i] = entries[--entry_count];
+    }
+    xSemaphoreGive(index_lock);
+}
+
+int file_index_list(file_index_entry_t *out, int offset, int max, file_index_sort_t sort, bool descending,
+                    int *total) {
+    int n = 0;
+    if (index_lock == NULL) {
+        *total = 0;
+        return 0;
+    }
+    xSemaphoreTake(index_lock, portMAX_DELAY);
+    /* the index has no order of its own, sort it in place */
+    sort_key = sort;
+    sort_descending = descending;
+    qsort(entries, entry_count, sizeof(file_index_entry_t), entry_cmp);
+    if (offset < entry_count) {
+        n = entry_count - offset < max ? entry_count - offset : max;
+        memcpy(out, &entries[offset], n * sizeof(file_index_entry_t));
+    }
+    *total = entry_count;
+    xSemaphoreGive(index_lock);
+    return n;
+}
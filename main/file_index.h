@@ -0,0 +1,60 @@
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+/*
+ * In-RAM metadata of the files on storage.
+ *
+ * Built with one directory scan at start up, then kept current by the
+ * upload and delete handlers and, through log_segments, by the log
+ * writer. Listings never touch the file system. Internal files (segment
+ * index, time indexes, unfinished uploads) are left out. Safe to use
+ * from several tasks.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "log_segments.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FILE_INDEX_MAX (LOG_SEGMENTS_MAX + 64)
+
+typedef struct {
+    char name[CONFIG_SPIFFS_OBJ_NAME_LEN];  // file name relative to the base path
+    uint32_t size;
+    int64_t mtime;                          // unix time in seconds
+    int64_t start_us;                       // capture logs, wall clock of the first record, else 0
+    int64_t end_us;                         // capture logs, wall clock of the last write, else 0
+} file_index_entry_t;
+
+typedef enum {
+    FILE_INDEX_SORT_NAME,
+    FILE_INDEX_SORT_SIZE,
+    FILE_INDEX_SORT_MTIME,
+    FILE_INDEX_SORT_START,
+} file_index_sort_t;
+
+/* Scan the directory, call after log_segments_init */
+esp_err_t file_index_init(const char *base_path);
+
+/* Add or replace the entry of entry->name */
+void file_index_update(const file_index_entry_t *entry);
+
+void file_index_remove(const char *name);
+
+/* Copy up to max entries in the requested order, skipping the first
+ * offset ones. Returns the number copied, total receives the number of
+ * entries in the index. */
+int file_index_list(file_index_entry_t *out, int offset, int max, file_index_sort_t sort, bool descending,
+                    int *total);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FILE_INDEX_H
@@ -0,0 +1,343 @@
+#include <string.h>
+
+#include "frame_decode.h"
+
+#define SLIP_END        (0xC0)
+#define SLIP_ESC        (0xDB)
+#define SLIP_ESC_END    (0xDC)
+#define SLIP_ESC_ESC    (0xDD)
+
+#define NMEA_MAX        (82)    // longest sentence including "$" and "\r\n"
+
+/* COBS state bits */
+#define COBS_ZERO       (0x01)  // a zero goes in front of the next block
+
+/* Modbus frames end after 3.5 characters of silence, a fixed 1.75 ms
+ * above 19200 baud */
+#define MODBUS_T35_FIXED_US     (1750)
+#define MODBUS_T35_BYTE_NS_MIN  (520833)
+
+typedef void (*frame_feed_t)(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                             frame_cb_t cb, void *ctx);
+typedef void (*frame_idle_t)(frame_decoder_t *dec, frame_cb_t cb, void *ctx);
+
+typedef struct {
+    const char *name;
+    frame_feed_t feed;
+    frame_idle_t idle;          // NULL if the protocol ignores silence
+} frame_proto_desc_t;
+
+static inline int64_t byte_us(const frame_decoder_t *dec, int64_t ts_us, size_t i) {
+    return ts_us + (int64_t) i * dec->byte_ns / 1000;
+}
+
+static inline void frame_start(frame_decoder_t *dec, int64_t ts_us) {
+    dec->active = true;
+    dec->first_us = ts_us;
+}
+
+static inline void frame_error(frame_decoder_t *dec, uint8_t status) {
+    if (dec->status == FRAME_OK) {
+        dec->status = status;
+    }
+}
+
+static inline void frame_put(frame_decoder_t *dec, uint8_t c) {
+    if (dec->len < FRAME_MAX) {
+        dec->buf[dec->len++] = c;
+    } else {
+        frame_error(dec, FRAME_ERR_OVERSIZE);
+    }
+}
+
+static void frame_emit(frame_decoder_t *dec, frame_cb_t cb, void *ctx) {
+    dec->frames++;
+    if (dec->status != FRAME_OK) {
+        dec->errors++;
+    }
+    cb(ctx, dec->buf, dec->len, dec->status, dec->first_us);
+    dec->active = false;
+    dec->state = 0;
+    dec->status = FRAME_OK;
+    dec->len = 0;
+    dec->need = 0;
+}
+
+/* ---- Modbus RTU ---- */
+
+static const uint16_t crc16_modbus_table[256] = {
+        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241, 0xC601, 0x06C0, 0x0780, 0xC741,
+        0x0500, 0xC5C1, 0xC481, 0x0440, 0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+        0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841, 0xD801, 0x18C0, 0x1980, 0xD941,
+        0x1B00, 0xDBC1, 0xDA81, 0x1A40, 0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+        0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641, 0xD201, 0x12C0, 0x1380, 0xD341,
+        0x1100, 0xD1C1, 0xD081, 0x1040, 0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+        0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441, 0x3C00, 0xFCC1, 0xFD81, 0x3D40,
+        0xFF01, 0x3FC0, 0x3E80, 0xFE41, 0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+        0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41, 0xEE01, 0x2EC0, 0x2F80, 0xEF41,
+        0x2D00, 0xEDC1, 0xEC81, 0x2C40, 0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+        0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041, 0xA001, 0x60C0, 0x6180, 0xA141,
+        0x6300, 0xA3C1, 0xA281, 0x6240, 0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+        0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41, 0xAA01, 0x6AC0, 0x6B80, 0xAB41,
+        0x6900, 0xA9C1, 0xA881, 0x6840, 0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+        0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40, 0xB401, 0x74C0, 0x7580, 0xB541,
+        0x7700, 0xB7C1, 0xB681, 0x7640, 0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+        0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241, 0x9601, 0x56C0, 0x5780, 0x9741,
+        0x5500, 0x95C1, 0x9481, 0x5440, 0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+        0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841, 0x8801, 0x48C0, 0x4980, 0x8941,
+        0x4B00, 0x8BC1, 0x8A81, 0x4A40, 0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+        0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641, 0x8201, 0x42C0, 0x4380, 0x8341,
+        0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+static uint16_t crc16_modbus(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 8) ^ crc16_modbus_table[(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+static void modbus_idle(frame_decoder_t *dec, frame_cb_t cb, void *ctx) {
+    if (!dec->active) {
+        return;
+    }
+    /* address, function and the CRC at least; the CRC over a whole
+     * frame, its own CRC included, is zero */
+    if (dec->len < 4) {
+        frame_error(dec, FRAME_ERR_FORMAT);
+    } else if (crc16_modbus(dec->buf, dec->len) != 0) {
+        frame_error(dec, FRAME_ERR_CHECKSUM);
+    }
+    frame_emit(dec, cb, ctx);
+}
+
+static void modbus_feed(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                        frame_cb_t cb, void *ctx) {
+    int64_t t35_us = dec->byte_ns >= MODBUS_T35_BYTE_NS_MIN ? (int64_t) dec->byte_ns * 35 / 10000
+                                                             : MODBUS_T35_FIXED_US;
+    /* bytes of one record are back to back, silence can only come before the first */
+    if (dec->active && ts_us - (dec->last_us + dec->byte_ns / 1000) > t35_us) {
+        modbus_idle(dec, cb, ctx);
+    }
+    if (len == 0) {
+        return;
+    }
+    if (!dec->active) {
+        frame_start(dec, ts_us);
+    }
+    for (size_t i = 0; i < len; i++) {
+        frame_put(dec, data[i]);
+    }
+    dec->last_us = byte_us(dec, ts_us, len - 1);
+}
+
+/* ---- SLIP ---- */
+
+static void slip_feed(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                      frame_cb_t cb, void *ctx) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        if (c == SLIP_END) {
+            /* back to back ENDs delimit nothing */
+            if (dec->active) {
+                frame_emit(dec, cb, ctx);
+            }
+            continue;
+        }
+        if (!dec->active) {
+            frame_start(dec, byte_us(dec, ts_us, i));
+        }
+        if (dec->state) {
+            dec->state = 0;
+            if (c == SLIP_ESC_END) {
+                c = SLIP_END;
+            } else if (c == SLIP_ESC_ESC) {
+                c = SLIP_ESC;
+            } else {
+                frame_error(dec, FRAME_ERR_FORMAT);
+            }
+        } else if (c == SLIP_ESC) {
+            dec->state = 1;
+            continue;
+        }
+        frame_put(dec, c);
+    }
+}
+
+/* ---- COBS ---- */
+
+static void cobs_feed(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                      frame_cb_t cb, void *ctx) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        if (c == 0) {
+            if (dec->active) {
+                if (dec->need > 0) {
+                    /* delimiter inside a block */
+                    frame_error(dec, FRAME_ERR_FORMAT);
+                }
+                frame_emit(dec, cb, ctx);
+            }
+            continue;
+        }
+        if (!dec->active) {
+            frame_start(dec, byte_us(dec, ts_us, i));
+        }
+        if (dec->need > 0) {
+            frame_put(dec, c);
+            dec->need--;
+            continue;
+        }
+        /* code byte, the zero ending the previous block is only real if another block follows */
+        if (dec->state & COBS_ZERO) {
+            frame_put(dec, 0);
+        }
+        dec->need = c - 1;
+        dec->state = c == 0xFF ? 0 : COBS_ZERO;
+    }
+}
+
+/* ---- NMEA 0183 ---- */
+
+static int hex_value(uint8_t c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static void nmea_check(frame_decoder_t *dec) {
+    uint16_t end = dec->len;
+    while (end > 0 && (dec->buf[end - 1] == '\r' || dec->buf[end - 1] == '\n')) {
+        end--;
+    }
+    if (dec->len > NMEA_MAX) {
+        frame_error(dec, FRAME_ERR_FORMAT);
+        return;
+    }
+    /* "*hh" before the line end is optional */
+    if (end < 4 || dec->buf[end - 3] != '*') {
+        return;
+    }
+    int hi = hex_value(dec->buf[end - 2]);
+    int lo = hex_value(dec->buf[end - 1]);
+    if (hi < 0 || lo < 0) {
+        frame_error(dec, FRAME_ERR_FORMAT);
+        return;
+    }
+    uint8_t sum = 0;
+    for (uint16_t i = 1; i < end - 3; i++) {
+        sum ^= dec->buf[i];
+    }
+    if (sum != ((hi << 4) | lo)) {
+        frame_error(dec, FRAME_ERR_CHECKSUM);
+    }
+}
+
+static void nmea_feed(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                      frame_cb_t cb, void *ctx) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        if (c == '$' || c == '!') {
+            if (dec->active) {
+                /* previous sentence never ended */
+                frame_error(dec, FRAME_ERR_FORMAT);
+                frame_emit(dec, cb, ctx);
+            }
+            frame_start(dec, byte_us(dec, ts_us, i));
+        } else if (!dec->active) {
+            /* noise between sentences */
+            continue;
+        }
+        frame_put(dec, c);
+        if (c == '\n') {
+            nmea_check(dec);
+            frame_emit(dec, cb, ctx);
+        }
+    }
+}
+
+/* ---- Length prefixed ---- */
+
+static void length_feed(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us,
+                        frame_cb_t cb, void *ctx) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        switch (dec->state) {
+            case 0:
+                frame_start(dec, byte_us(dec, ts_us, i));
+                dec->need = (uint16_t) (c << 8);
+                dec->state = 1;
+                break;
+            case 1:
+                dec->need |= c;
+                dec->state = 2;
+                if (dec->need == 0) {
+                    frame_emit(dec, cb, ctx);
+                }
+                break;
+            default:
+                frame_put(dec, c);
+                if (--dec->need == 0) {
+                    frame_emit(dec, cb, ctx);
+                }
+                break;
+        }
+    }
+}
+
+/* Without a delimiter a lost byte would shift every later frame, an
+ * idle line is the only point to resynchronize at */
+static void length_idle(frame_decoder_t *dec, frame_cb_t cb, void *ctx) {
+    if (dec->active) {
+        frame_error(dec, FRAME_ERR_TRUNCATED);
+        frame_emit(dec, cb, ctx);
+    }
+}
+
+static const frame_proto_desc_t frame_protos[FRAME_PROTO_COUNT] = {
+        [FRAME_PROTO_NONE]       = {"none", NULL, NULL},
+        [FRAME_PROTO_MODBUS_RTU] = {"modbus", modbus_feed, modbus_idle},
+        [FRAME_PROTO_SLIP]       = {"slip", slip_feed, NULL},
+        [FRAME_PROTO_COBS]       = {"cobs", cobs_feed, NULL},
+        [FRAME_PROTO_NMEA]       = {"nmea", nmea_feed, NULL},
+        [FRAME_PROTO_LENGTH]     = {"length", length_feed, length_idle},
+};
+
+void frame_decoder_init(frame_decoder_t *dec, frame_proto_t proto, uint32_t byte_ns) {
+    memset(dec, 0, offsetof(frame_decoder_t, buf));
+    dec->proto = proto < FRAME_PROTO_COUNT ? proto : FRAME_PROTO_NONE;
+    dec->byte_ns = byte_ns;
+}
+
+frame_proto_t frame_proto_from_name(const char *name) {
+    for (int i = 0; i < FRAME_PROTO_COUNT; i++) {
+        if (strcmp(name, frame_protos[i].name) == 0) {
+            return (frame_proto_t) i;
+        }
+    }
+    return FRAME_PROTO_NONE;
+}
+
+const char *frame_proto_name(frame_proto_t proto) {
+    return proto < FRAME_PROTO_COUNT ? frame_protos[proto].name : frame_protos[FRAME_PROTO_NONE].name;
+}
+
+void frame_decode(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us, frame_cb_t cb, void *ctx) {
+    const frame_proto_desc_t *desc = &frame_protos[dec->proto];
+    if (desc->feed != NULL) {
+        desc->feed(dec, data, len, ts_us, cb, ctx);
+    }
+}
+
+void frame_decoder_idle(frame_decoder_t *dec, frame_cb_t cb, void *ctx) {
+    const frame_proto_desc_t *desc = &frame_protos[dec->proto];
+    if (desc->idle != NULL) {
+        desc->idle(dec, cb, ctx);
+    }
+}
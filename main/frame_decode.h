@@ -0,0 +1,86 @@
+#ifndef FRAME_DECODE_H
+#define FRAME_DECODE_H
+
+/*
+ * Protocol frame decoders for captured uart data.
+ *
+ * A decoder is a byte at a time state machine picked from a table by
+ * frame_proto_t. It reassembles logical frames across capture records,
+ * checks their CRC or checksum where the protocol has one, and hands
+ * every frame, good or not, to a callback together with the time of its
+ * first byte. Decoders keep all state in frame_decoder_t, no heap.
+ *
+ * Modbus RTU frames end on 3.5 character times of silence, so the
+ * decoder needs byte times; everything else is delimited in band.
+ *
+ * Plain C only, shared by the firmware and the host tools.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FRAME_PROTO_NONE = 0,
+    FRAME_PROTO_MODBUS_RTU,     // silence delimited, CRC-16/MODBUS at the end
+    FRAME_PROTO_SLIP,           // RFC 1055
+    FRAME_PROTO_COBS,           // 0x00 delimited
+    FRAME_PROTO_NMEA,           // "$...*hh\r\n", checksum optional
+    FRAME_PROTO_LENGTH,         // 2 byte big endian length, then the payload
+    FRAME_PROTO_COUNT,
+} frame_proto_t;
+
+/* Largest frame kept, longer frames are cut and flagged */
+#define FRAME_MAX           (512)
+
+/* Frame status */
+#define FRAME_OK            (0)
+#define FRAME_ERR_CHECKSUM  (1)     // CRC or checksum mismatch
+#define FRAME_ERR_FORMAT    (2)     // bad escape, COBS code or syntax
+#define FRAME_ERR_OVERSIZE  (3)     // longer than FRAME_MAX, cut
+#define FRAME_ERR_TRUNCATED (4)     // line went idle in the middle of a frame
+
+/* frame is the decoded payload (the whole ADU for Modbus, the sentence
+ * for NMEA), ts_us the time of its first byte on the line */
+typedef void (*frame_cb_t)(void *ctx, const uint8_t *frame, uint16_t len, uint8_t status, int64_t ts_us);
+
+typedef struct {
+    frame_proto_t proto;
+    uint32_t byte_ns;           // time of one character on the line
+    bool active;                // collecting a frame
+    uint8_t state;              // protocol specific
+    uint8_t status;             // first error of the frame being collected
+    uint16_t len;
+    uint16_t need;              // bytes left in the current COBS block or length frame
+    int64_t first_us;           // first byte of the frame
+    int64_t last_us;            // last byte seen
+    uint32_t frames;
+    uint32_t errors;
+    uint8_t buf[FRAME_MAX];
+} frame_decoder_t;
+
+void frame_decoder_init(frame_decoder_t *dec, frame_proto_t proto, uint32_t byte_ns);
+
+/* Decoder by name ("modbus", "slip", "cobs", "nmea", "length"),
+ * FRAME_PROTO_NONE if unknown */
+frame_proto_t frame_proto_from_name(const char *name);
+
+const char *frame_proto_name(frame_proto_t proto);
+
+/* Feed len received bytes, the first arriving at ts_us and the rest
+ * byte_ns apart. cb is called for every frame completed. */
+void frame_decode(frame_decoder_t *dec, const uint8_t *data, size_t len, int64_t ts_us, frame_cb_t cb, void *ctx);
+
+/* The line went idle: ends a Modbus frame, a length frame still waiting
+ * for bytes is given up as truncated */
+void frame_decoder_idle(frame_decoder_t *dec, frame_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FRAME_DECODE_H
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_vfs.h"
+#include "esp_http_server.h"
+
+#include "log_query.h"
+#include "log_segments.h"
+#include "ulog_format.h"
+#include "resp_writer.h"
+#include "xfer_pool.h"
+
+static const char *TAG = "log_query";
+
+#define QUERY_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
+/* Worst case text record, also holds any binary record */
+#define QUERY_OUT_SIZE ULOG_TEXT_MAX(ULOG_REC_MAX)
+
+typedef struct {
+    bool text;
+    int64_t from_us;
+    int64_t to_us;
+    bool past_window;           // current segment has reached to_us
+    bool hdr_sent;
+    uint32_t records;
+    uint32_t bytes_read;
+    resp_writer_t w;
+    uint8_t *in;                // transfer buffer, XFER_BUF_SIZE bytes
+    ulog_decoder_t dec;
+    char out[QUERY_OUT_SIZE];
+} query_ctx_t;
+
+static char base_path[ESP_VFS_PATH_MAX + 1];
+
+/* Binary responses start with one header, records carry wall clock times */
+static void query_send_header(query_ctx_t *q, uint32_t baud_rate) {
+    if (q->text || q->hdr_sent) {
+        return;
+    }
+    ulog_file_hdr_t hdr;
+    ulog_file_hdr_init(&hdr, 0, 0, baud_rate);
+    resp_writer_write(&q->w, &hdr, sizeof(hdr));
+    q->hdr_sent = true;
+}
+
+static void query_record_cb(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    query_ctx_t *q = ctx;
+    int64_t wall_us = ulog_rec_wall_us(file, hdr);
+    if (wall_us < q->from_us || q->past_window) {
+        return;
+    }
+    if (wall_us > q->to_us) {
+        q->past_window = true;
+        return;
+    }
+
+    if (q->text) {
+        char *out = resp_writer_reserve(&q->w, ULOG_TEXT_MAX(hdr->len));
+        resp_writer_commit(&q->w, ulog_format_text(file, hdr, data, out));
+    } else {
+        ulog_rec_hdr_t rec = *hdr;
+        rec.ts_us = wall_us;
+        resp_writer_write(&q->w, &rec, sizeof(rec));
+        resp_writer_write(&q->w, data, hdr->len);
+    }
+    q->records++;
+}
+
+/* Offset of the last indexed block starting before the window. Returns
+ * false if the whole segment is after the window. Without an index the
+ * segment is scanned from the start. */
+static bool query_seek_offset(query_ctx_t *q, const char *name, const ulog_file_hdr_t *file, uint32_t *offset) {
+    char index_name[CONFIG_SPIFFS_OBJ_NAME_LEN];
+    char path[QUERY_PATH_MAX];
+
+    *offset = file->hdr_len;
+    if (!ulog_index_name(index_name, sizeof(index_name), name)) {
+        return true;
+    }
+    snprintf(path, sizeof(path), "%s/%s", base_path, index_name);
+    FILE *fd = fopen(path, "r");
+    if (fd == NULL) {
+        return true;
+    }
+
+    ulog_index_entry_t *entries = (ulog_index_entry_t *) q->in;
+    size_t count;
+    bool first = true;
+    bool overlaps = true;
+    while ((count = fread(entries, sizeof(ulog_index_entry_t), XFER_BUF_SIZE / sizeof(ulog_index_entry_t), fd)) > 0) {
+        size_t i;
+        for (i = 0; i < count; i++) {
+            int64_t wall_us = file->wall_us + (entries[i].ts_us - file->mono_us);
+            if (first && wall_us > q->to_us) {
+                overlaps = false;
+            }
+            first = false;
+            if (wall_us > q->from_us) {
+                break;
+            }
+            *offset = entries[i].offset;
+        }
+        if (i < count) {
+            break;
+        }
+    }
+    fclose(fd);
+    return overlaps;
+}
+
+static void query_segment(query_ctx_t *q, const log_segment_t *seg) {
+    char path[QUERY_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", base_path, seg->name);
+
+    FILE *fd = fopen(path, "r");
+    if (fd == NULL) {
+        ESP_LOGW(TAG, "Failed to open %s", path);
+        return;
+    }
+    ulog_file_hdr_t hdr;
+    uint32_t offset;
+    if (fread(&hdr, sizeof(hdr), 1, fd) != 1 || !ulog_file_hdr_valid(&hdr)
+        || !query_seek_offset(q, seg->name, &hdr, &offset)) {
+        fclose(fd);
+        return;
+    }
+    query_send_header(q, hdr.baud_rate);
+
+    /* the decoder needs the file header before it can start at a block */
+    ulog_decoder_init(&q->dec);
+    rewind(fd);
+    size_t left = hdr.hdr_len;
+    size_t n;
+    while (left > 0 && (n = fread(q->in, 1, MIN(left, XFER_BUF_SIZE), fd)) > 0) {
+        ulog_decode(&q->dec, q->in, n, query_record_cb, q);
+        left -= n;
+    }
+
+    q->past_window = false;
+    if (fseek(fd, offset, SEEK_SET) == 0) {
+        while (!q->past_window && q->w.err == ESP_OK && (n = fread(q->in, 1, XFER_BUF_SIZE, fd)) > 0) {
+            q->bytes_read += n;
+            if (!ulog_decode(&q->dec, q->in, n, query_record_cb, q)) {
+                break;
+            }
+        }
+    }
+    fclose(fd);
+}
+
+/* Seconds beyond which a time does not fit int64_t microseconds */
+#define QUERY_TIME_MAX_S (9.2e12)
+
+/* Query parameter in seconds since the epoch, fractions allowed. Leaves
+ * time_us alone without the key, false if its value is not a time. */
+static bool query_time_param(const char *query, const char *key, int64_t *time_us) {
+    char param[24];
+    char *end;
+    esp_err_t err = httpd_query_key_value(query, key, param, sizeof(param));
+    if (err == ESP_ERR_NOT_FOUND) {
+        return true;
+    }
+    if (err != ESP_OK) {
+        return false;
+    }
+    double s = strtod(param, &end);
+    if (end == param || *end != '\0' || !isfinite(s) || fabs(s) > QUERY_TIME_MAX_S) {
+        return false;
+    }
+    *time_us = (int64_t) (s * 1000000);
+    return true;
+}
+
+static esp_err_t log_query_transfer(httpd_req_t *req, char *buf) {
+    char query[96] = "";
+    char format[8];
+    int64_t from_us = 0;
+    int64_t to_us = INT64_MAX;
+
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+    if (!query_time_param(query, "from", &from_us) || !query_time_param(query, "to", &to_us)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid from or to");
+        return ESP_FAIL;
+    }
+    if (from_us > to_us) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "from is after to");
+        return ESP_FAIL;
+    }
+
+    query_ctx_t *q = malloc(sizeof(query_ctx_t));
+    log_segment_t *segs = malloc(LOG_SEGMENTS_MAX * sizeof(log_segment_t));
+    if (!q || !segs) {
+        free(q);
+        free(segs);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    memset(q, 0, offsetof(query_ctx_t, dec));
+    q->from_us = from_us;
+    q->to_us = to_us;
+    q->in = (uint8_t *) buf;
+    q->text = httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK && strcmp(format, "text") == 0;
+    resp_writer_init(&q->w, req, q->out, sizeof(q->out));
+
+    if (q->text) {
+        httpd_resp_set_type(req, "text/plain");
+    } else {
+        httpd_resp_set_type(req, "application/octet-stream");
+        httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"query" ULOG_FILE_EXT "\"");
+    }
+
+    /* segments are oldest first, records inside one are in time order */
+    int count = log_segments_list(segs, LOG_SEGMENTS_MAX);
+    for (int i = 0; i < count && q->w.err == ESP_OK; i++) {
+        if (segs[i].end_us >= from_us) {
+            query_segment(q, &segs[i]);
+        }
+    }
+    query_send_header(q, 0);
+
+    esp_err_t err = resp_writer_finish(&q->w);
+    ESP_LOGI(TAG, "%" PRIu32 " records from %" PRIu32 " bytes read", q->records, q->bytes_read);
+    free(segs);
+    free(q);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Query sending failed!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t log_query_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, log_query_transfer);
+}
+
+esp_err_t register_log_query_handler(const char *path, httpd_handle_t server) {
+    strlcpy(base_path, path, sizeof(base_path));
+
+    httpd_uri_t log_query = {
+            .uri       = "/logs/query",
+            .method    = HTTP_GET,
+            .handler   = log_query_handler,
+            .user_ctx  = NULL
+    };
+    return httpd_register_uri_handler(server, &log_query);
+}
@@ -0,0 +1,29 @@
+#ifndef LOG_QUERY_H
+#define LOG_QUERY_H
+
+/*
+ * Capture log queries by time.
+ *
+ * GET /logs/query?from=<unix s>&to=<unix s>[&format=text] streams only the
+ * records inside the window, across all segments. Each segment is entered
+ * at the last time index entry before the window, so only a few KB are
+ * read and sent no matter how large the segments are.
+ *
+ * Binary responses are a single ulog stream whose record timestamps are
+ * wall clock times (file header wall_us = mono_us = 0).
+ */
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t register_log_query_handler(const char *base_path, httpd_handle_t server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LOG_QUERY_H
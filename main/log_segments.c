@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_vfs.h"
+
+#include "log_segments.h"
+#include "file_index.h"
+#include "ulog_format.h"
+
+static const char *TAG = "log_segments";
+
+#define SEGMENTS_MAGIC "USEG"
+#define SEGMENTS_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t entry_len;
+    uint16_t count;
+} segments_file_hdr_t;
+
+static char base_path[ESP_VFS_PATH_MAX + 1];
+static log_segment_t segments[LOG_SEGMENTS_MAX];
+/* added and not closed yet, RAM only, a reboot closes everything */
+static bool segment_open[LOG_SEGMENTS_MAX];
+static int segment_count = 0;
+/* RAM differs from the index file */
+static bool segments_dirty = false;
+static SemaphoreHandle_t segments_lock = NULL;
+
+static void segment_path(char *dest, size_t size, const char *name) {
+    snprintf(dest, size, "%s/%s", base_path, name);
+}
+
+/* Caller holds the lock */
+static void segments_save(void) {
+    char path[SEGMENTS_PATH_MAX];
+    char tmp_path[SEGMENTS_PATH_MAX];
+    segment_path(path, sizeof(path), LOG_SEGMENTS_INDEX_FILE);
+    segment_path(tmp_path, sizeof(tmp_path), LOG_SEGMENTS_INDEX_FILE "~");
+
+    FILE *fd = fopen(tmp_path, "w");
+    if (fd == NULL) {
+        ESP_LOGE(TAG, "Failed to create index : %s", tmp_path);
+        return;
+    }
+    segments_file_hdr_t hdr = {
+            .magic = SEGMENTS_MAGIC,
+            .entry_len = sizeof(log_segment_t),
+            .count = segment_count,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1
+              && fwrite(segments, sizeof(log_segment_t), segment_count, fd) == (size_t) segment_count;
+    fclose(fd);
+    if (!ok) {
+        /* the old index is still complete */
+        ESP_LOGE(TAG, "Failed to write index : %s", tmp_path);
+        unlink(tmp_path);
+        return;
+    }
+
+    /* SPIFFS does not rename over an existing file. Between the unlink
+     * and the rename the new index is only in the temporary file, which
+     * segments_load falls back to. */
+    if (rename(tmp_path, path) != 0) {
+        unlink(path);
+        ok = rename(tmp_path, path) == 0;
+    }
+    segments_dirty = !ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to replace index : %s", path);
+    }
+}
+
+static bool segments_load(const char *name) {
+    char path[SEGMENTS_PATH_MAX];
+    segment_path(path, sizeof(path), name);
+
+    FILE *fd = fopen(path, "r");
+    if (fd == NULL) {
+        return false;
+    }
+    segments_file_hdr_t hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fd) == 1
+              && memcmp(hdr.magic, SEGMENTS_MAGIC, sizeof(hdr.magic)) == 0
+              && hdr.entry_len == sizeof(log_segment_t)
+              && hdr.count <= LOG_SEGMENTS_MAX
+              && fread(segments, sizeof(log_segment_t), hdr.count, fd) == hdr.count;
+    fclose(fd);
+
+    segment_count = ok ? hdr.count : 0;
+    memset(segment_open, 0, sizeof(segment_open));
+    return ok;
+}
+
+/* The index is not rewritten on every write or delete, take sizes from
+ * the files and drop the segments that are gone */
+static void segments_refresh(void) {
+    char path[SEGMENTS_PATH_MAX];
+    struct stat entry_stat;
+    int kept = 0;
+
+    for (int i = 0; i < segment_count; i++) {
+        log_segment_t *seg = &segments[i];
+        segment_path(path, sizeof(path), seg->name);
+        if (stat(path, &entry_stat) == -1) {
+            segments_dirty = true;
+            continue;
+        }
+        if (seg->size != (uint32_t) entry_stat.st_size) {
+            seg->size = entry_stat.st_size;
+            segments_dirty = true;
+        }
+        /* zero without CONFIG_SPIFFS_USE_MTIME */
+        int64_t mtime_us = (int64_t) entry_stat.st_mtime * 1000000;
+        if (mtime_us > seg->end_us) {
+            seg->end_us = mtime_us;
+            segments_dirty = true;
+        }
+        segments[kept++] = *seg;
+    }
+    segment_count = kept;
+    if (segments_dirty) {
+        segments_save();
+    }
+}
+
+static int segment_cmp(const void *a, const void *b) {
+    const log_segment_t *sa = a;
+    const log_segment_t *sb = b;
+    return sa->start_us < sb->start_us ? -1 : sa->start_us > sb->start_us;
+}
+
+static void segment_unlink_index(const char *name) {
+    char index_name[CONFIG_SPIFFS_OBJ_NAME_LEN];
+    char path[SEGMENTS_PATH_MAX];
+    if (ulog_index_name(index_name, sizeof(index_name), name)) {
+        segment_path(path, sizeof(path), index_name);
+        unlink(path);
+    }
+}
+
+/* Slow path, only when the index file is missing or broken. Beyond
+ * LOG_SEGMENTS_MAX files the oldest are deleted, retention could not
+ * reach them otherwise. */
+static void segments_rebuild(void) {
+    char path[SEGMENTS_PATH_MAX];
+    struct dirent *entry;
+    struct stat entry_stat;
+    log_segment_t found;
+
+    segment_count = 0;
+    memset(segment_open, 0, sizeof(segment_open));
+    DIR *dir = opendir(base_path);
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        if (name_len < sizeof(ULOG_FILE_EXT) || name_len >= CONFIG_SPIFFS_OBJ_NAME_LEN
+            || strcmp(entry->d_name + name_len - sizeof(ULOG_FILE_EXT) + 1, ULOG_FILE_EXT) != 0) {
+            continue;
+        }
+        segment_path(path, sizeof(path), entry->d_name);
+        if (stat(path, &entry_stat) == -1) {
+            continue;
+        }
+
+        log_segment_t *seg = &found;
+        memset(seg, 0, sizeof(log_segment_t));
+        strlcpy(seg->name, entry->d_name, sizeof(seg->name));
+        seg->size = entry_stat.st_size;
+        seg->end_us = (int64_t) entry_stat.st_mtime * 1000000;
+        seg->start_us = seg->end_us;
+
+        FILE *fd = fopen(path, "r");
+        if (fd != NULL) {
+            ulog_file_hdr_t hdr;
+            if (fread(&hdr, sizeof(hdr), 1, fd) == 1 && ulog_file_hdr_valid(&hdr)) {
+                seg->start_us = hdr.wall_us;
+            }
+            fclose(fd);
+        }
+
+        if (segment_count < LOG_SEGMENTS_MAX) {
+            segments[segment_count++] = found;
+            continue;
+        }
+        int oldest = 0;
+        for (int i = 1; i < segment_count; i++) {
+            if (segments[i].start_us < segments[oldest].start_us) {
+                oldest = i;
+            }
+        }
+        if (found.start_us > segments[oldest].start_us) {
+            log_segment_t older = segments[oldest];
+            segments[oldest] = found;
+            found = older;
+        }
+        ESP_LOGW(TAG, "Index full, deleting %s", found.name);
+        segment_path(path, sizeof(path), found.name);
+        unlink(path);
+        segment_unlink_index(found.name);
+    }
+    closedir(dir);
+
+    qsort(segments, segment_count, sizeof(log_segment_t), segment_cmp);
+    ESP_LOGI(TAG, "Rebuilt index with %d segments", segment_count);
+    segments_save();
+}
+
+/* Mirror a segment into the file listing */
+static void segment_publish(const log_segment_t *seg) {
+    file_index_entry_t entry = {
+            .size = seg->size,
+            .mtime = seg->end_us / 1000000,
+            .start_us = seg->start_us,
+            .end_us = seg->end_us,
+    };
+    strlcpy(entry.name, seg->name, sizeof(entry.name));
+    file_index_update(&entry);
+}
+
+static int segment_find(const char *name) {
+    for (int i = 0; i < segment_count; i++) {
+        if (strcmp(segments[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Caller holds the lock */
+static void segment_remove_at(int i) {
+    memmove(&segments[i], &segments[i + 1], (segment_count - i - 1) * sizeof(log_segment_t));
+    memmove(&segment_open[i], &segment_open[i + 1], (segment_count - i - 1) * sizeof(bool));
+    segment_count--;
+}
+
+/* Caller holds the lock. Delete the oldest segment file that is not
+ * open for writing, false if there is none. */
+static bool segment_delete_oldest(const char *why) {
+    char path[SEGMENTS_PATH_MAX];
+    for (int i = 0; i < segment_count; i++) {
+        if (segment_open[i]) {
+            /* being written, possibly by another port */
+            continue;
+        }
+        segment_path(path, sizeof(path), segments[i].name);
+        ESP_LOGI(TAG, "%s, deleting %s (%" PRIu32 " bytes)", why, segments[i].name, segments[i].size);
+        unlink(path);
+        segment_unlink_index(segments[i].name);
+        file_index_remove(segments[i].name);
+        segment_remove_at(i);
+        segments_dirty = true;
+        return true;
+    }
+    return false;
+}
+
+esp_err_t log_segments_init(const char *path) {
+    if (segments_lock == NULL) {
+        segments_lock = xSemaphoreCreateMutex();
+        if (segments_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    strlcpy(base_path, path, sizeof(base_path));
+    if (segments_load(LOG_SEGMENTS_INDEX_FILE) || segments_load(LOG_SEGMENTS_INDEX_FILE "~")) {
+        segments_refresh();
+    } else {
+        segments_rebuild();
+    }
+    ESP_LOGI(TAG, "%d log segments", segment_count);
+    xSemaphoreGive(segments_lock);
+    return ESP_OK;
+}
+
+esp_err_t log_segments_add(const char *name, int64_t start_us) {
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    /* a forgotten file would be out of reach of retention, so the
+     * oldest closed segment makes room */
+    if (segment_count == LOG_SEGMENTS_MAX && !segment_delete_oldest("Index full")) {
+        /* only when every entry is open, which no caller does */
+        ESP_LOGW(TAG, "Index full, forgetting %s", segments[0].name);
+        segment_remove_at(0);
+        ret = ESP_ERR_NO_MEM;
+    }
+    segment_open[segment_count] = true;
+    log_segment_t *seg = &segments[segment_count++];
+    memset(seg, 0, sizeof(log_segment_t));
+    strlcpy(seg->name, name, sizeof(seg->name));
+    seg->start_us = start_us;
+    seg->end_us = start_us;
+    segments_save();
+    segment_publish(seg);
+    xSemaphoreGive(segments_lock);
+    return ret;
+}
+
+void log_segments_update(const char *name, uint32_t size, int64_t end_us) {
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    int i = segment_find(name);
+    if (i >= 0) {
+        segments[i].size = size;
+        segments[i].end_us = end_us;
+        segments_dirty = true;
+        segment_publish(&segments[i]);
+    }
+    xSemaphoreGive(segments_lock);
+}
+
+void log_segments_close(const char *name) {
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    int i = segment_find(name);
+    if (i >= 0) {
+        segment_open[i] = false;
+    }
+    if (segments_dirty) {
+        segments_save();
+    }
+    xSemaphoreGive(segments_lock);
+}
+
+void log_segments_remove(const char *name) {
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    int i = segment_find(name);
+    if (i >= 0) {
+        segment_remove_at(i);
+        segments_dirty = true;
+    }
+    xSemaphoreGive(segments_lock);
+    segment_unlink_index(name);
+    file_index_remove(name);
+}
+
+bool log_segments_delete_oldest(void) {
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    bool deleted = segment_delete_oldest("Retention");
+    xSemaphoreGive(segments_lock);
+    return deleted;
+}
+
+int log_segments_list(log_segment_t *out, int max) {
+    xSemaphoreTake(segments_lock, portMAX_DELAY);
+    int n = segment_count < max ? segment_count : max;
+    memcpy(out, segments, n * sizeof(log_segment_t));
+    xSemaphoreGive(segments_lock);
+    return n;
+}
@@ -0,0 +1,63 @@
+#ifndef LOG_SEGMENTS_H
+#define LOG_SEGMENTS_H
+
+/*
+ * Index of the capture log segments on storage.
+ *
+ * Kept in RAM and mirrored to a small index file, so segments can be
+ * enumerated oldest first without listing the directory. The file is
+ * only rewritten when a segment is opened or closed; sizes and removed
+ * segments are brought up to date from the files at mount. Safe to use
+ * from several tasks.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_SEGMENTS_MAX (128)
+#define LOG_SEGMENTS_INDEX_FILE "ulog.idx"
+
+typedef struct {
+    char name[CONFIG_SPIFFS_OBJ_NAME_LEN];  // file name relative to the base path
+    uint32_t size;
+    int64_t start_us;                       // wall clock of the first record
+    int64_t end_us;                         // wall clock of the last write
+} log_segment_t;
+
+/* Load the index, rebuilding it from the directory if it is missing */
+esp_err_t log_segments_init(const char *base_path);
+
+/* Index a new segment, open for writing. A full index deletes its
+ * oldest closed segment to make room, the way retention does. */
+esp_err_t log_segments_add(const char *name, int64_t start_us);
+
+/* Update size and end time in RAM only */
+void log_segments_update(const char *name, uint32_t size, int64_t end_us);
+
+/* The writer is done with a segment, retention may delete it. Persists
+ * the index. */
+void log_segments_close(const char *name);
+
+/* Forget a segment and delete its time index, the log file is expected
+ * to be gone already. The index file catches up on the next open or
+ * close, until then a mount drops the missing file. */
+void log_segments_remove(const char *name);
+
+/* Delete the oldest segment file that is not open for writing. Returns
+ * false if there is nothing left to delete. */
+bool log_segments_delete_oldest(void);
+
+/* Copy up to max segments, oldest first. Returns the number copied. */
+int log_segments_list(log_segment_t *out, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LOG_SEGMENTS_H
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+/* The linux target runs tasks as host threads, those take the host path */
+#if defined(ESP_PLATFORM) && !CONFIG_IDF_TARGET_LINUX
+#define METRICS_CORE_SLOTS (1)
+#include "esp_cpu.h"
+#endif
+
+#define METRICS_LINE_MAX (192)
+
+/* Upper bounds of the histogram buckets in us, 50 us to 1 s */
+const uint32_t metrics_hist_bounds[METRICS_HIST_BUCKETS] = {
+        50, 100, 250, 500,
+        1000, 2500, 5000, 10000, 25000, 50000,
+        100000, 250000, 500000, 1000000,
+};
+
+static _Atomic(metrics_series_t *) series_head = NULL;
+
+#ifdef METRICS_CORE_SLOTS
+static inline int metrics_slot(void) {
+    return esp_cpu_get_core_id();
+}
+#else
+/* Host threads take turns at the slots, sharing one is only slower */
+static _Thread_local int host_slot = -1;
+static atomic_int host_next_slot;
+
+static inline int metrics_slot(void) {
+    if (host_slot < 0) {
+        host_slot = atomic_fetch_add(&host_next_slot, 1) % METRICS_SLOTS;
+    }
+    return host_slot;
+}
+#endif
+
+static void series_register(metrics_series_t *s, metrics_type_t type, const char *name, const char *help,
+                            const char *label, const char *label_value) {
+    s->type = type;
+    s->name = name;
+    s->help = help;
+    s->label = label;
+    s->label_value = label_value;
+    s->next = atomic_load(&series_head);
+    while (!atomic_compare_exchange_weak(&series_head, &s->next, s)) {
+    }
+}
+
+void metrics_counter_init(metrics_counter_t *c, const char *name, const char *help, const char *label,
+                          const char *label_value) {
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        atomic_init(&c->slots[i], 0);
+    }
+    atomic_init(&c->total, 0);
+    series_register(&c->series, METRICS_COUNTER, name, help, label, label_value);
+}
+
+void metrics_hist_init(metrics_hist_t *h, const char *name, const char *help, const char *label,
+                       const char *label_value) {
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+            atomic_init(&h->slots[i][b], 0);
+        }
+        atomic_init(&h->sum_slots[i], 0);
+    }
+    for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+        atomic_init(&h->totals[b], 0);
+    }
+    atomic_init(&h->sum, 0);
+    series_register(&h->series, METRICS_HISTOGRAM, name, help, label, label_value);
+}
+
+void metrics_counter_add(metrics_counter_t *c, uint32_t n) {
+    atomic_fetch_add_explicit(&c->slots[metrics_slot()], n, memory_order_relaxed);
+}
+
+void metrics_hist_observe(metrics_hist_t *h, uint32_t us) {
+    int b = 0;
+    while (b < METRICS_HIST_BUCKETS && us > metrics_hist_bounds[b]) {
+        b++;
+    }
+    int slot = metrics_slot();
+    atomic_fetch_add_explicit(&h->slots[slot][b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_slots[slot], us, memory_order_relaxed);
+}
+
+static uint32_t slot_take(_Atomic uint32_t *slot) {
+    return atomic_exchange_explicit(slot, 0, memory_order_relaxed);
+}
+
+static void counter_fold(metrics_counter_t *c) {
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        atomic_fetch_add(&c->total, slot_take(&c->slots[i]));
+    }
+}
+
+static void hist_fold(metrics_hist_t *h) {
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+            atomic_fetch_add(&h->totals[b], slot_take(&h->slots[i][b]));
+        }
+        atomic_fetch_add(&h->sum, slot_take(&h->sum_slots[i]));
+    }
+}
+
+void metrics_fold(void) {
+    for (metrics_series_t *s = atomic_load(&series_head); s != NULL; s = s->next) {
+        if (s->type == METRICS_COUNTER) {
+            counter_fold((metrics_counter_t *) s);
+        } else {
+            hist_fold((metrics_hist_t *) s);
+        }
+    }
+}
+
+uint64_t metrics_counter_value(metrics_counter_t *c) {
+    counter_fold(c);
+    return atomic_load(&c->total);
+}
+
+void metrics_hist_snapshot(metrics_hist_t *h, metrics_hist_snapshot_t *s) {
+    hist_fold(h);
+    uint64_t count = 0;
+    for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+        count += atomic_load(&h->totals[b]);
+        s->buckets[b] = count;
+    }
+    s->sum = atomic_load(&h->sum);
+}
+
+/* "{label="value"" without the closing brace, or "" */
+static void prom_labels(const metrics_series_t *s, char *buf, size_t size) {
+    buf[0] = '\0';
+    if (s->label != NULL) {
+        snprintf(buf, size, "{%s=\"%s\"", s->label, s->label_value);
+    }
+}
+
+void metrics_write_prometheus(metrics_out_t out, void *ctx) {
+    char line[METRICS_LINE_MAX];
+    char labels[64];
+    const char *family = NULL;
+
+    for (metrics_series_t *s = atomic_load(&series_head); s != NULL; s = s->next) {
+        if (family == NULL || strcmp(family, s->name) != 0) {
+            family = s->name;
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", s->name, s->help, s->name,
+                     s->type == METRICS_COUNTER ? "counter" : "histogram");
+            out(ctx, line);
+        }
+        prom_labels(s, labels, sizeof(labels));
+        const char *close = labels[0] != '\0' ? "}" : "";
+
+        if (s->type == METRICS_COUNTER) {
+            snprintf(line, sizeof(line), "%s%s%s %llu\n", s->name, labels, close,
+                     (unsigned long long) metrics_counter_value((metrics_counter_t *) s));
+            out(ctx, line);
+            continue;
+        }
+
+        metrics_hist_snapshot_t snap;
+        metrics_hist_snapshot((metrics_hist_t *) s, &snap);
+        const char *sep = labels[0] != '\0' ? "," : "{";
+        for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            snprintf(line, sizeof(line), "%s_bucket%s%sle=\"%lu\"} %llu\n", s->name, labels, sep,
+                     (unsigned long) metrics_hist_bounds[b], (unsigned long long) snap.buckets[b]);
+            out(ctx, line);
+        }
+        snprintf(line, sizeof(line), "%s_bucket%s%sle=\"+Inf\"} %llu\n%s_sum%s%s %llu\n%s_count%s%s %llu\n",
+                 s->name, labels, sep, (unsigned long long) snap.buckets[METRICS_HIST_BUCKETS],
+                 s->name, labels, close, (unsigned long long) snap.sum,
+                 s->name, labels, close, (unsigned long long) snap.buckets[METRICS_HIST_BUCKETS]);
+        out(ctx, line);
+    }
+}
+
+void metrics_write_json(metrics_out_t out, void *ctx) {
+    char line[METRICS_LINE_MAX];
+    bool first = true;
+
+    out(ctx, "[");
+    for (metrics_series_t *s = atomic_load(&series_head); s != NULL; s = s->next) {
+        int n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\"", first ? "" : ",", s->name);
+        if (s->label != NULL) {
+            snprintf(line + n, sizeof(line) - n, ",\"%s\":\"%s\"", s->label, s->label_value);
+        }
+        out(ctx, line);
+        first = false;
+
+        if (s->type == METRICS_COUNTER) {
+            snprintf(line, sizeof(line), ",\"value\":%llu}",
+                     (unsigned long long) metrics_counter_value((metrics_counter_t *) s));
+            out(ctx, line);
+            continue;
+        }
+
+        metrics_hist_snapshot_t snap;
+        metrics_hist_snapshot((metrics_hist_t *) s, &snap);
+        out(ctx, ",\"type\":\"histogram\",\"le\":[");
+        for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            snprintf(line, sizeof(line), "%s%lu", b == 0 ? "" : ",", (unsigned long) metrics_hist_bounds[b]);
+            out(ctx, line);
+        }
+        out(ctx, "],\"buckets\":[");
+        for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            snprintf(line, sizeof(line), "%s%llu", b == 0 ? "" : ",", (unsigned long long) snap.buckets[b]);
+            out(ctx, line);
+        }
+        snprintf(line, sizeof(line), "],\"sum\":%llu,\"count\":%llu}", (unsigned long long) snap.sum,
+                 (unsigned long long) snap.buckets[METRICS_HIST_BUCKETS]);
+        out(ctx, line);
+    }
+    out(ctx, "]");
+}
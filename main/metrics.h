@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+ * Runtime counters and latency histograms.
+ *
+ * Writers only do relaxed atomic adds on 32 bit slots, one slot per
+ * core, so instrumenting a hot path takes no lock and tasks on the two
+ * cores do not share a slot. Readers fold the slots into 64 bit totals
+ * by swapping them with zero: nothing is lost or counted twice, and a
+ * slot only has to be folded before it wraps (metrics_fold() at least
+ * once a minute is plenty).
+ *
+ * Every series registers itself in a global list at init and the whole
+ * list renders as Prometheus text or JSON. Series of the same name with
+ * different label values must be initialised one after the other.
+ *
+ * Plain C11 only, so it can be stress tested on the host.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_SLOTS           (2)     // one per core
+#define METRICS_HIST_BUCKETS    (14)    // plus one for larger values
+
+typedef enum {
+    METRICS_COUNTER = 0,
+    METRICS_HISTOGRAM,
+} metrics_type_t;
+
+typedef struct metrics_series {
+    metrics_type_t type;
+    const char *name;
+    const char *help;
+    const char *label;          // NULL without a label
+    const char *label_value;
+    struct metrics_series *next;
+} metrics_series_t;
+
+typedef struct {
+    metrics_series_t series;
+    _Atomic uint32_t slots[METRICS_SLOTS];
+    _Atomic uint64_t total;     // folded
+} metrics_counter_t;
+
+/* Values in us, bucket i counts values up to metrics_hist_bounds[i] */
+typedef struct {
+    metrics_series_t series;
+    _Atomic uint32_t slots[METRICS_SLOTS][METRICS_HIST_BUCKETS + 1];
+    _Atomic uint32_t sum_slots[METRICS_SLOTS];
+    _Atomic uint64_t totals[METRICS_HIST_BUCKETS + 1];
+    _Atomic uint64_t sum;
+} metrics_hist_t;
+
+typedef struct {
+    uint64_t buckets[METRICS_HIST_BUCKETS + 1];     // cumulative, the last one is the count
+    uint64_t sum;
+} metrics_hist_snapshot_t;
+
+extern const uint32_t metrics_hist_bounds[METRICS_HIST_BUCKETS];
+
+/* Set up and register a series, once per series. The strings are not
+ * copied. */
+void metrics_counter_init(metrics_counter_t *c, const char *name, const char *help, const char *label,
+                          const char *label_value);
+
+void metrics_hist_init(metrics_hist_t *h, const char *name, const char *help, const char *label,
+                       const char *label_value);
+
+void metrics_counter_add(metrics_counter_t *c, uint32_t n);
+
+void metrics_hist_observe(metrics_hist_t *h, uint32_t us);
+
+/* Fold every registered series */
+void metrics_fold(void);
+
+uint64_t metrics_counter_value(metrics_counter_t *c);
+
+void metrics_hist_snapshot(metrics_hist_t *h, metrics_hist_snapshot_t *s);
+
+typedef void (*metrics_out_t)(void *ctx, const char *str);
+
+/* All series in the Prometheus text format */
+void metrics_write_prometheus(metrics_out_t out, void *ctx);
+
+/* All series as a JSON array, histograms with their cumulative buckets */
+void metrics_write_json(metrics_out_t out, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //METRICS_H
@@ -8,12 +8,16 @@
 extern "C" {
 #endif
 
+#ifndef FILE_SERVER_BASE_PATH
 #define FILE_SERVER_BASE_PATH "/data"
+#endif
+
+/* Free space uploads leave for the capture logs, the size of
+ * an individual file is limited by the space left above it */
+#define UPLOAD_MIN_FREE (64*1024) // 64 KB
 
-/* Max size of an individual file. Make sure this
-* value is same as that set in upload_script.html */
-#define MAX_FILE_SIZE   (512*1024) // 512 KB
-#define MAX_FILE_SIZE_STR "512KB"
+/* Uploads are received into a temp file with this extension */
+#define UPLOAD_TEMP_EXT ".part"
 
 esp_err_t mount_storage(const char *base_path, bool format_when_failed);
 
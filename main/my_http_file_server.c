@@ -13,34 +13,45 @@
 */
 
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "esp_http_server.h"
 #include "my_file_server_common.h"
+#include "ulog_format.h"
+#include "log_segments.h"
+#include "file_index.h"
+#include "resp_writer.h"
+#include "static_assets.h"
+#include "xfer_pool.h"
+#include "metrics.h"
 
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 
-/* Scratch buffer size */
-#define SCRATCH_BUFSIZE  8192
+#define IS_FILE_EXT(filename, ext) \
+    (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
 
 static const char *TAG = "file_server";
 
 struct file_server_data {
     /* Base path of file storage */
     char base_path[ESP_VFS_PATH_MAX + 1];
-
-    /* Scratch buffer for temporary storage during file transfer */
-    char scratch[SCRATCH_BUFSIZE];
 };
 
 static struct file_server_data *server_data = NULL;
@@ -55,46 +66,32 @@ static esp_err_t index_html_get_handler(httpd_req_t *req) {
 }
 
 static esp_err_t favicon_get_handler(httpd_req_t *req) {
-    extern const unsigned char favicon_ico_start[] asm("_binary_favicon_ico_start");
-    extern const unsigned char favicon_ico_end[]   asm("_binary_favicon_ico_end");
-    const size_t favicon_ico_size = (favicon_ico_end - favicon_ico_start);
-    httpd_resp_set_type(req, "image/x-icon");
-    httpd_resp_send(req, (const char *) favicon_ico_start, favicon_ico_size);
-    return ESP_OK;
+    return static_asset_send(req, STATIC_ASSET_FAVICON);
 }
 
 /* Send HTTP response with a run-time generated html consisting of
- * a list of all files and folders under the requested path.
- * In case of SPIFFS this returns empty list when path is any
- * string other than '/', since SPIFFS doesn't support directories */
-static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath) {
-    char entrypath[FILE_PATH_MAX];
-    char entrysize[16];
-    const char *entrytype;
-
-    struct dirent *entry;
-    struct stat entry_stat;
-
-    DIR *dir = opendir(dirpath);
-    const size_t dirpath_len = strlen(dirpath);
-
-    /* Retrieve the base path of file storage to construct the full path */
-    strlcpy(entrypath, dirpath, sizeof(entrypath));
-
-    if (!dir) {
-        ESP_LOGE(TAG, "Failed to stat dir : %s", dirpath);
-        /* Respond with 404 Not Found */
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Directory does not exist");
+ * a list of all files on storage. Served from the file index, so no
+ * file is opened or stat-ed. SPIFFS has no directories, every path
+ * lists the same files. */
+static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, char *buf) {
+    file_index_entry_t *files = malloc(FILE_INDEX_MAX * sizeof(file_index_entry_t));
+    if (!files) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
+    int total;
+    int count = file_index_list(files, 0, FILE_INDEX_MAX, FILE_INDEX_SORT_NAME, false, &total);
+
+    ESP_LOGI(TAG, "list Dir %s, %d files", dirpath, count);
 
-    ESP_LOGI(TAG, "list Dir %s", dirpath);
+    resp_writer_t w;
+    resp_writer_init(&w, req, buf, XFER_BUF_SIZE);
 
-    /* Send HTML file header */
-    httpd_resp_sendstr_chunk(req, "<!DOCTYPE html><html>"
-                                  "<head><meta charset=\"UTF-8\">"
-                                  "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1, shrink-to-fit=no\">"
-                                  "<title>SmartBoxFileManage</title></head><body>");
+    /* HTML file header */
+    resp_writer_str(&w, "<!DOCTYPE html><html>"
+                   "<head><meta charset=\"UTF-8\">"
+                   "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1, shrink-to-fit=no\">"
+                   "<title>SmartBoxFileManage</title></head><body>");
 
     /* Get handle to embedded file upload script */
     extern const unsigned char upload_script_start[] asm("_binary_upload_script_html_start");
@@ -102,97 +99,350 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath) {
     const size_t upload_script_size = (upload_script_end - upload_script_start);
 
     /* Add file upload form and script which on execution sends a POST request to /upload */
-    httpd_resp_send_chunk(req, (const char *) upload_script_start, upload_script_size);
-
-    /* Send file-list table definition and column labels */
-    httpd_resp_sendstr_chunk(req,
-                             "<table class=\"fixed\" border=\"1\" style=\"border-spacing: 0;\">"
-                             "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
-                             "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
-                             "<tbody>");
-
-    /* Iterate over all files / folders and fetch their names and sizes */
-    while ((entry = readdir(dir)) != NULL) {
-        entrytype = (entry->d_type == DT_DIR ? "directory" : "file");
-
-        strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
-        if (stat(entrypath, &entry_stat) == -1) {
-            ESP_LOGE(TAG, "Failed to stat %s : %s", entrytype, entry->d_name);
-            continue;
+    resp_writer_write(&w, (const char *) upload_script_start, upload_script_size);
+
+    /* File-list table definition and column labels */
+    resp_writer_str(&w, "<table class=\"fixed\" border=\"1\" style=\"border-spacing: 0;\">"
+                   "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
+                   "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
+                   "<tbody>");
+
+    /* Table entries with file name and size */
+    for (int i = 0; i < count; i++) {
+        const char *name = files[i].name;
+        resp_writer_str(&w, "<tr><td><a href=\"");
+        resp_writer_html(&w, req->uri);
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "\">");
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "</a>");
+        if (IS_FILE_EXT(name, ULOG_FILE_EXT)) {
+            resp_writer_str(&w, " <a href=\"");
+            resp_writer_html(&w, req->uri);
+            resp_writer_html(&w, name);
+            resp_writer_str(&w, "?format=text\">[text]</a>");
         }
-        sprintf(entrysize, "%ld", entry_stat.st_size);
-        ESP_LOGI(TAG, "Found %s : %s (%s bytes)", entrytype, entry->d_name, entrysize);
-
-        /* Send chunk of HTML file containing table entries with file name and size */
-        httpd_resp_sendstr_chunk(req, "<tr><td><a href=\"");
-        httpd_resp_sendstr_chunk(req, req->uri);
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        if (entry->d_type == DT_DIR) {
-            httpd_resp_sendstr_chunk(req, "/");
-        }
-        httpd_resp_sendstr_chunk(req, "\">");
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        httpd_resp_sendstr_chunk(req, "</a></td><td>");
-        httpd_resp_sendstr_chunk(req, entrytype);
-        httpd_resp_sendstr_chunk(req, "</td><td>");
-        httpd_resp_sendstr_chunk(req, entrysize);
-        httpd_resp_sendstr_chunk(req, "</td><td>");
-        httpd_resp_sendstr_chunk(req, "<form method=\"post\" action=\"/delete");
-        httpd_resp_sendstr_chunk(req, req->uri);
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        httpd_resp_sendstr_chunk(req, "\"><button type=\"submit\">Delete</button></form>");
-        httpd_resp_sendstr_chunk(req, "</td></tr>\n");
-    }
-    closedir(dir);
-
-    /* Finish the file list table */
-    httpd_resp_sendstr_chunk(req, "</tbody></table>");
-
-    /* Send remaining chunk of HTML file to complete it */
-    httpd_resp_sendstr_chunk(req, "</body></html>");
-
-    /* Send empty chunk to signal HTTP response completion */
-    httpd_resp_sendstr_chunk(req, NULL);
+        resp_writer_str(&w, "</td><td>file</td><td>");
+        resp_writer_int(&w, files[i].size);
+        resp_writer_str(&w, "</td><td>");
+        resp_writer_str(&w, "<form method=\"post\" action=\"/delete");
+        resp_writer_html(&w, req->uri);
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "\"><button type=\"submit\">Delete</button></form></td></tr>\n");
+    }
+    free(files);
+
+    /* Finish the file list table and the HTML file */
+    resp_writer_str(&w, "</tbody></table></body></html>");
+
+    if (resp_writer_finish(&w) != ESP_OK) {
+        ESP_LOGE(TAG, "File list sending failed!");
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
-#define IS_FILE_EXT(filename, ext) \
-    (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
+#define FILE_LIST_LIMIT_DEFAULT 50
+
+/* GET /api/files?offset=&limit=&sort=name|size|mtime|start&order=asc|desc
+ * File metadata as JSON, times in ms since the epoch */
+static esp_err_t file_list_api_transfer(httpd_req_t *req, char *buf) {
+    char query[96] = "";
+    char param[8];
+    int offset = 0;
+    int limit = FILE_LIST_LIMIT_DEFAULT;
+    file_index_sort_t sort = FILE_INDEX_SORT_NAME;
+    bool descending = false;
+
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+    if (httpd_query_key_value(query, "offset", param, sizeof(param)) == ESP_OK) {
+        offset = MAX(atoi(param), 0);
+    }
+    if (httpd_query_key_value(query, "limit", param, sizeof(param)) == ESP_OK) {
+        limit = MIN(MAX(atoi(param), 1), FILE_INDEX_MAX);
+    }
+    if (httpd_query_key_value(query, "sort", param, sizeof(param)) == ESP_OK) {
+        if (strcmp(param, "size") == 0) {
+            sort = FILE_INDEX_SORT_SIZE;
+        } else if (strcmp(param, "mtime") == 0) {
+            sort = FILE_INDEX_SORT_MTIME;
+        } else if (strcmp(param, "start") == 0) {
+            sort = FILE_INDEX_SORT_START;
+        }
+    }
+    if (httpd_query_key_value(query, "order", param, sizeof(param)) == ESP_OK) {
+        descending = strcmp(param, "desc") == 0;
+    }
+
+    file_index_entry_t *files = malloc(limit * sizeof(file_index_entry_t));
+    if (!files) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    int total;
+    int count = file_index_list(files, offset, limit, sort, descending, &total);
+
+    resp_writer_t w;
+    resp_writer_init(&w, req, buf, XFER_BUF_SIZE);
+    httpd_resp_set_type(req, "application/json");
+    resp_writer_printf(&w, "{\"total\":%d,\"offset\":%d,\"files\":[", total, offset);
+    for (int i = 0; i < count; i++) {
+        resp_writer_str(&w, i > 0 ? ",{\"name\":" : "{\"name\":");
+        resp_writer_json_str(&w, files[i].name);
+        resp_writer_str(&w, ",\"size\":");
+        resp_writer_int(&w, files[i].size);
+        resp_writer_str(&w, ",\"mtime\":");
+        resp_writer_int(&w, files[i].mtime * 1000);
+        if (files[i].start_us != 0) {
+            resp_writer_str(&w, ",\"start\":");
+            resp_writer_int(&w, files[i].start_us / 1000);
+            resp_writer_str(&w, ",\"end\":");
+            resp_writer_int(&w, files[i].end_us / 1000);
+            resp_writer_str(&w, "}");
+        } else {
+            resp_writer_str(&w, ",\"start\":null,\"end\":null}");
+        }
+    }
+    resp_writer_str(&w, "]}");
+    free(files);
+
+    return resp_writer_finish(&w) == ESP_OK ? ESP_OK : ESP_FAIL;
+}
 
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename) {
+/* HTTP response content type according to file extension */
+static const char *content_type_from_file(const char *filename) {
     if (IS_FILE_EXT(filename, ".pdf")) {
-        return httpd_resp_set_type(req, "application/pdf");
+        return "application/pdf";
     } else if (IS_FILE_EXT(filename, ".html")) {
-        return httpd_resp_set_type(req, "text/html");
+        return "text/html";
     } else if (IS_FILE_EXT(filename, ".xml")) {
-        return httpd_resp_set_type(req, "text/xml");
+        return "text/xml";
     } else if (IS_FILE_EXT(filename, ".jpg") || IS_FILE_EXT(filename, ".jpeg")) {
-        return httpd_resp_set_type(req, "image/jpeg");
+        return "image/jpeg";
     } else if (IS_FILE_EXT(filename, ".png")) {
-        return httpd_resp_set_type(req, "image/png");
+        return "image/png";
     } else if (IS_FILE_EXT(filename, ".bmp")) {
-        return httpd_resp_set_type(req, "image/bmp");
+        return "image/bmp";
     } else if (IS_FILE_EXT(filename, ".gif")) {
-        return httpd_resp_set_type(req, "image/gif");
+        return "image/gif";
     } else if (IS_FILE_EXT(filename, ".webp")) {
-        return httpd_resp_set_type(req, "image/webp");
+        return "image/webp";
     } else if (IS_FILE_EXT(filename, ".ico")) {
-        return httpd_resp_set_type(req, "image/x-icon");
+        return "image/x-icon";
     } else if (IS_FILE_EXT(filename, ".txt")) {
-        return httpd_resp_set_type(req, "text/plain");
+        return "text/plain";
     } else if (IS_FILE_EXT(filename, ".js")) {
-        return httpd_resp_set_type(req, "application/x-javascript");
+        return "application/x-javascript";
     } else if (IS_FILE_EXT(filename, ".json")) {
-        return httpd_resp_set_type(req, "application/json");
+        return "application/json";
     } else if (IS_FILE_EXT(filename, ".css")) {
-        return httpd_resp_set_type(req, "text/css");
+        return "text/css";
     } else if (IS_FILE_EXT(filename, ".manifest")) {
-        return httpd_resp_set_type(req, "text/cache-manifest");
+        return "text/cache-manifest";
+    } else if (IS_FILE_EXT(filename, ULOG_FILE_EXT)) {
+        return "application/octet-stream";
     }
     /* This is a limited set only */
     /* For any other type always set as plain text */
-    return httpd_resp_set_type(req, "text/plain");
+    return "text/plain";
+}
+
+/* Send all of buf on the raw socket */
+static esp_err_t send_all(httpd_req_t *req, const char *buf, size_t len) {
+    while (len > 0) {
+        int n = httpd_send(req, buf, len);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        buf += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static const char *const http_months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static void http_date_format(char *dest, size_t size, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(dest, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* Parse an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT". Done by hand as
+ * there is no timegm and TZ is set to local time. */
+static bool http_date_parse(const char *str, time_t *t) {
+    char mon_str[4];
+    int day, year, hour, min, sec, mon;
+    if (sscanf(str, "%*3s, %d %3s %d %d:%d:%d GMT", &day, mon_str, &year, &hour, &min, &sec) != 6) {
+        return false;
+    }
+    for (mon = 0; mon < 12 && strcmp(mon_str, http_months[mon]) != 0; mon++) {
+    }
+    if (mon == 12) {
+        return false;
+    }
+
+    /* days since the epoch of a proleptic Gregorian date */
+    int y = year - (mon < 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon < 2 ? 10 : -2)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t) era * 146097 + doe - 719468;
+
+    *t = (time_t) (days * 86400 + hour * 3600 + min * 60 + sec);
+    return true;
+}
+
+/* Parse a single "bytes=" range against a file of size bytes. Returns 1
+ * with an inclusive [start, end], 0 to ignore the header (multiple or
+ * malformed ranges) and -1 if the range cannot be satisfied. */
+static int http_range_parse(const char *value, size_t size, size_t *start, size_t *end) {
+    char *p;
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+        return 0;
+    }
+    value += 6;
+
+    if (*value == '-') {
+        /* suffix range, the last n bytes */
+        unsigned long n = strtoul(value + 1, &p, 10);
+        if (p == value + 1 || *p != '\0') {
+            return 0;
+        }
+        if (n == 0 || size == 0) {
+            return -1;
+        }
+        *start = n >= size ? 0 : size - n;
+        *end = size - 1;
+        return 1;
+    }
+
+    unsigned long first = strtoul(value, &p, 10);
+    if (p == value || *p != '-') {
+        return 0;
+    }
+    value = p + 1;
+    unsigned long last = size - 1;
+    if (*value != '\0') {
+        last = strtoul(value, &p, 10);
+        if (*p != '\0' || last < first) {
+            return 0;
+        }
+    }
+    if (first >= size) {
+        return -1;
+    }
+    *start = first;
+    *end = last >= size ? size - 1 : last;
+    return 1;
+}
+
+#define HTTP_ETAG_MAX (48)
+
+/* Tag of a stored file, variant tells representations derived from it
+ * apart. A growing log changes size before mtime, so both go in. */
+static void http_etag(char *dest, size_t size, const struct stat *file_stat, const char *variant) {
+    snprintf(dest, size, "\"%zx-%llx%s\"", (size_t) file_stat->st_size, (unsigned long long) file_stat->st_mtime,
+             variant);
+}
+
+/* If-None-Match, or without it If-Modified-Since, says the client's copy
+ * is current */
+static bool http_not_modified(httpd_req_t *req, const char *etag, time_t mtime) {
+    char hdr_value[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", hdr_value, sizeof(hdr_value)) == ESP_OK) {
+        return strcmp(hdr_value, "*") == 0 || strstr(hdr_value, etag) != NULL;
+    }
+    if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", hdr_value, sizeof(hdr_value)) == ESP_OK) {
+        time_t since;
+        return http_date_parse(hdr_value, &since) && mtime <= since;
+    }
+    return false;
+}
+
+static esp_err_t http_send_not_modified(httpd_req_t *req, const char *etag, const char *last_modified) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* Send a file with Content-Length, honoring Range and conditional
+ * requests. The body goes out raw, after a hand written header, since
+ * the chunked send API cannot carry a Content-Length. */
+static esp_err_t send_file_ranged(httpd_req_t *req, FILE *fd, const char *filename, const struct stat *file_stat,
+                                  char *chunk) {
+    char etag[HTTP_ETAG_MAX];
+    char last_modified[32];
+    char hdr_value[64];
+    size_t size = file_stat->st_size;
+
+    http_etag(etag, sizeof(etag), file_stat, "");
+    http_date_format(last_modified, sizeof(last_modified), file_stat->st_mtime);
+    if (http_not_modified(req, etag, file_stat->st_mtime)) {
+        return http_send_not_modified(req, etag, last_modified);
+    }
+
+    size_t start = 0;
+    size_t end = size - 1;
+    int range = 0;
+    if (httpd_req_get_hdr_value_str(req, "Range", hdr_value, sizeof(hdr_value)) == ESP_OK) {
+        range = http_range_parse(hdr_value, size, &start, &end);
+        /* If-Range, only resume when the file is still the same */
+        char if_range[64];
+        if (range != 0 && httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) == ESP_OK
+            && strcmp(if_range, etag) != 0 && strcmp(if_range, last_modified) != 0) {
+            range = 0;
+            start = 0;
+            end = size - 1;
+        }
+    }
+    if (range < 0) {
+        char content_range[32];
+        snprintf(content_range, sizeof(content_range), "bytes */%zu", size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        return httpd_resp_send(req, NULL, 0);
+    }
+    size_t length = size == 0 ? 0 : end - start + 1;
+
+    int head_len = snprintf(chunk, XFER_BUF_SIZE,
+                            "HTTP/1.1 %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Accept-Ranges: bytes\r\n"
+                            "ETag: %s\r\n"
+                            "Last-Modified: %s\r\n",
+                            range > 0 ? "206 Partial Content" : "200 OK", content_type_from_file(filename),
+                            length, etag, last_modified);
+    if (range > 0) {
+        head_len += snprintf(chunk + head_len, XFER_BUF_SIZE - head_len,
+                             "Content-Range: bytes %zu-%zu/%zu\r\n", start, end, size);
+    }
+#ifdef CONFIG_EXAMPLE_HTTPD_CONN_CLOSE_HEADER
+    head_len += snprintf(chunk + head_len, XFER_BUF_SIZE - head_len, "Connection: close\r\n");
+#endif
+    head_len += snprintf(chunk + head_len, XFER_BUF_SIZE - head_len, "\r\n");
+    if (send_all(req, chunk, head_len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (length > 0 && fseek(fd, start, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    while (length > 0) {
+        size_t chunksize = fread(chunk, 1, MIN(length, XFER_BUF_SIZE), fd);
+        /* Content-Length is promised, failing here closes the connection */
+        if (chunksize == 0 || send_all(req, chunk, chunksize) != ESP_OK) {
+            ESP_LOGE(TAG, "File sending failed!");
+            return ESP_FAIL;
+        }
+        length -= chunksize;
+    }
+    return ESP_OK;
 }
 
 /* Copies the full path into destination buffer and returns
@@ -223,8 +473,113 @@ static const char *get_path_from_uri(char *dest, const char *base_path, const ch
     return dest + base_pathlen;
 }
 
-/* Handler to download a file kept on the server */
-static esp_err_t download_get_handler(httpd_req_t *req) {
+#define ULOG_TEXT_BUFSIZE ULOG_TEXT_MAX(ULOG_REC_MAX)
+
+static void ulog_text_record_cb(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    resp_writer_t *w = ctx;
+    char *out = resp_writer_reserve(w, ULOG_TEXT_MAX(hdr->len));
+    resp_writer_commit(w, ulog_format_text(file, hdr, data, out));
+}
+
+/* Send a binary capture log rendered as the hex/timestamp text view */
+static esp_err_t send_ulog_as_text(httpd_req_t *req, FILE *fd, char *chunk) {
+    ulog_decoder_t *dec = malloc(sizeof(ulog_decoder_t));
+    char *out = malloc(ULOG_TEXT_BUFSIZE);
+    if (!dec || !out) {
+        free(dec);
+        free(out);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    ulog_decoder_init(dec);
+    httpd_resp_set_type(req, "text/plain");
+
+    resp_writer_t w;
+    resp_writer_init(&w, req, out, ULOG_TEXT_BUFSIZE);
+    size_t chunksize;
+    while (w.err == ESP_OK && (chunksize = fread(chunk, 1, XFER_BUF_SIZE, fd)) > 0) {
+        if (!ulog_decode(dec, (uint8_t *) chunk, chunksize, ulog_text_record_cb, &w)) {
+            ESP_LOGE(TAG, "Not a capture log");
+            break;
+        }
+    }
+
+    esp_err_t err = resp_writer_finish(&w);
+    free(dec);
+    free(out);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "File sending failed!");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+struct ulog_inflate_ctx {
+    httpd_req_t *req;
+    esp_err_t err;
+};
+
+static void ulog_inflate_cb(void *ctx, const uint8_t *data, size_t len) {
+    struct ulog_inflate_ctx *inflate = ctx;
+    if (inflate->err == ESP_OK) {
+        inflate->err = httpd_resp_send_chunk(inflate->req, (const char *) data, len);
+    }
+}
+
+/* Send a compressed capture log as the plain record stream, fd is
+ * positioned right after the file header. Conditional requests work on
+ * a tag of the stored file; the inflated length is not known up front,
+ * so ranges are not offered, ?raw=1 fetches the stored bytes for that. */
+static esp_err_t send_ulog_inflated(httpd_req_t *req, FILE *fd, const struct stat *file_stat,
+                                    const ulog_file_hdr_t *file, char *chunk) {
+    char etag[HTTP_ETAG_MAX];
+    char last_modified[32];
+    http_etag(etag, sizeof(etag), file_stat, "-inflated");
+    http_date_format(last_modified, sizeof(last_modified), file_stat->st_mtime);
+    if (http_not_modified(req, etag, file_stat->st_mtime)) {
+        return http_send_not_modified(req, etag, last_modified);
+    }
+
+    ulz_reader_t *reader = malloc(sizeof(ulz_reader_t));
+    if (!reader) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    ulz_reader_init(reader);
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "none");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+
+    /* same header without the compression flag and newer trailing fields */
+    ulog_file_hdr_t hdr = *file;
+    hdr.flags &= ~ULOG_FILE_F_LZ;
+    hdr.hdr_len = sizeof(hdr);
+    struct ulog_inflate_ctx inflate = {
+            .req = req,
+            .err = httpd_resp_send_chunk(req, (const char *) &hdr, sizeof(hdr)),
+    };
+
+    size_t chunksize;
+    while (inflate.err == ESP_OK && (chunksize = fread(chunk, 1, XFER_BUF_SIZE, fd)) > 0) {
+        ulz_reader_feed(reader, (uint8_t *) chunk, chunksize, ulog_inflate_cb, &inflate);
+    }
+    if (reader->errors > 0) {
+        ESP_LOGW(TAG, "%" PRIu32 " corrupt blocks skipped", reader->errors);
+    }
+
+    free(reader);
+    if (inflate.err != ESP_OK) {
+        ESP_LOGE(TAG, "File sending failed!");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* Download a file kept on the server */
+static esp_err_t download_send(httpd_req_t *req, char *buf) {
     char filepath[FILE_PATH_MAX];
     FILE *fd = NULL;
     struct stat file_stat;
@@ -240,7 +595,7 @@ static esp_err_t download_get_handler(httpd_req_t *req) {
 
     /* If name has trailing '/', respond with directory contents */
     if (filename[strlen(filename) - 1] == '/') {
-        return http_resp_dir_html(req, filepath);
+        return http_resp_dir_html(req, filepath, buf);
     }
 
     if (stat(filepath, &file_stat) == -1) {
@@ -265,119 +620,152 @@ static esp_err_t download_get_handler(httpd_req_t *req) {
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
-    set_content_type_from_file(req, filename);
+    /* Capture logs can be rendered as text with ?format=text, compressed
+     * ones are inflated unless ?raw=1 asks for the stored bytes */
+    char query[32] = "";
+    char param[8];
+    if (IS_FILE_EXT(filename, ULOG_FILE_EXT)) {
+        httpd_req_get_url_query_str(req, query, sizeof(query));
+        if (httpd_query_key_value(query, "format", param, sizeof(param)) == ESP_OK && strcmp(param, "text") == 0) {
+            ESP_LOGI(TAG, "Sending file as text : %s (%ld bytes)...", filename, file_stat.st_size);
+            esp_err_t ret = send_ulog_as_text(req, fd, buf);
+            fclose(fd);
+            return ret;
+        }
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    char *chunk = ((struct file_server_data *) req->user_ctx)->scratch;
-    size_t chunksize;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        chunksize = fread(chunk, 1, SCRATCH_BUFSIZE, fd);
-
-        if (chunksize > 0) {
-            /* Send the buffer contents as HTTP response chunk */
-            if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-                fclose(fd);
-                ESP_LOGE(TAG, "File sending failed!");
-                /* Abort sending file */
-                httpd_resp_sendstr_chunk(req, NULL);
-                /* Respond with 500 Internal Server Error */
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-                return ESP_FAIL;
-            }
+        ulog_file_hdr_t hdr;
+        bool raw = httpd_query_key_value(query, "raw", param, sizeof(param)) == ESP_OK && atoi(param) != 0;
+        if (!raw && fread(&hdr, sizeof(hdr), 1, fd) == 1 && ulog_file_hdr_valid(&hdr)
+            && (hdr.flags & ULOG_FILE_F_LZ) && fseek(fd, hdr.hdr_len, SEEK_SET) == 0) {
+            ESP_LOGI(TAG, "Sending file inflated : %s (%ld bytes)...", filename, file_stat.st_size);
+            esp_err_t ret = send_ulog_inflated(req, fd, &file_stat, &hdr, buf);
+            fclose(fd);
+            return ret;
         }
+        rewind(fd);
+    }
 
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
+    esp_err_t ret = send_file_ranged(req, fd, filename, &file_stat, buf);
 
     /* Close file after sending complete */
     fclose(fd);
-    ESP_LOGI(TAG, "File sending complete");
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "File sending complete");
+    }
+    return ret;
+}
 
-    /* Respond with an empty chunk to signal HTTP response completion */
-#ifdef CONFIG_EXAMPLE_HTTPD_CONN_CLOSE_HEADER
-    httpd_resp_set_hdr(req, "Connection", "close");
-#endif
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+/* Uploads are received into <name>.part and renamed once complete, so a
+ * half written file never shows up under its real name. Besides the
+ * single POST from the upload form, a file can be sent as PUT requests
+ * carrying Upload-Offset and the total Upload-Length. HEAD reports the
+ * offset to resume at after a dropped connection, Upload-Offset 0 starts
+ * over. The last PUT may carry the file's Upload-CRC32 to verify. */
+#define UPLOAD_STATES   (XFER_POOL_SIZE + 1)
+#define UPLOAD_SIZE_UNKNOWN UINT32_MAX
+
+/* Running CRC32 of the temp files, so resuming does not reread them */
+typedef struct {
+    char name[CONFIG_SPIFFS_OBJ_NAME_LEN];
+    uint32_t size;          // bytes the crc covers
+    uint32_t crc;
+    bool busy;              // a request is writing the file
+    uint32_t last_used;
+} upload_state_t;
+
+static upload_state_t upload_states[UPLOAD_STATES];
+static uint32_t upload_tick = 0;
+static SemaphoreHandle_t upload_lock = NULL;
+
+/* Bytes an upload may still take, keeping UPLOAD_MIN_FREE for the capture logs */
+static size_t upload_space_left(void) {
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info(NULL, &total, &used) != ESP_OK || used + UPLOAD_MIN_FREE >= total) {
+        return 0;
+    }
+    return total - used - UPLOAD_MIN_FREE;
 }
 
-/* Handler to upload a file onto the server */
-static esp_err_t upload_post_handler(httpd_req_t *req) {
-    char filepath[FILE_PATH_MAX];
-    FILE *fd = NULL;
-    struct stat file_stat;
+/* Claim the state of an upload, NULL if another request is writing it */
+static upload_state_t *upload_state_acquire(const char *name) {
+    upload_state_t *state = NULL;
+    upload_state_t *oldest = NULL;
 
-    /* Skip leading "/upload" from URI to get filename */
-    /* Note sizeof() counts NULL termination hence the -1 */
-    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *) req->user_ctx)->base_path,
-                                             req->uri + sizeof("/upload") - 1, sizeof(filepath));
-    if (!filename) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
-        return ESP_FAIL;
+    xSemaphoreTake(upload_lock, portMAX_DELAY);
+    for (int i = 0; i < UPLOAD_STATES; i++) {
+        if (strcmp(upload_states[i].name, name) == 0) {
+            state = &upload_states[i];
+            break;
+        }
+        if (!upload_states[i].busy && (!oldest || upload_states[i].last_used < oldest->last_used)) {
+            oldest = &upload_states[i];
+        }
     }
-
-    /* Filename cannot have a trailing '/' */
-    if (filename[strlen(filename) - 1] == '/') {
-        ESP_LOGE(TAG, "Invalid filename : %s", filename);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filename");
-        return ESP_FAIL;
+    if (state == NULL && oldest != NULL) {
+        state = oldest;
+        strlcpy(state->name, name, sizeof(state->name));
+        state->size = UPLOAD_SIZE_UNKNOWN;
+        state->crc = 0;
+    } else if (state != NULL && state->busy) {
+        state = NULL;
     }
-
-    if (stat(filepath, &file_stat) == 0) {
-        ESP_LOGE(TAG, "File already exists : %s", filepath);
-        /* Respond with 400 Bad Request */
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File already exists");
-        return ESP_FAIL;
+    if (state != NULL) {
+        state->busy = true;
+        state->last_used = ++upload_tick;
     }
+    xSemaphoreGive(upload_lock);
+    return state;
+}
 
-    /* File cannot be larger than a limit */
-    if (req->content_len > MAX_FILE_SIZE) {
-        ESP_LOGE(TAG, "File too large : %d bytes", req->content_len);
-        /* Respond with 400 Bad Request */
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
-                            "File size must be less than "
-                            MAX_FILE_SIZE_STR "!");
-        /* Return failure to close underlying connection else the
-         * incoming file content will keep the socket busy */
-        return ESP_FAIL;
+static void upload_state_release(upload_state_t *state, bool forget) {
+    xSemaphoreTake(upload_lock, portMAX_DELAY);
+    state->busy = false;
+    if (forget) {
+        state->name[0] = '\0';
     }
+    xSemaphoreGive(upload_lock);
+}
 
-    fd = fopen(filepath, "w");
-    if (!fd) {
-        ESP_LOGE(TAG, "Failed to create file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
-        return ESP_FAIL;
+/* Bring the running CRC in line with the temp file, e.g. after a reboot */
+static void upload_state_sync(upload_state_t *state, const char *temppath, char *buf) {
+    struct stat file_stat;
+    uint32_t size = stat(temppath, &file_stat) == 0 ? file_stat.st_size : 0;
+    if (state->size == size) {
+        return;
     }
 
-    ESP_LOGI(TAG, "Receiving file : %s...", filename);
+    state->size = 0;
+    state->crc = 0;
+    FILE *fd = fopen(temppath, "r");
+    if (fd) {
+        size_t n;
+        while ((n = fread(buf, 1, XFER_BUF_SIZE, fd)) > 0) {
+            state->crc = esp_rom_crc32_le(state->crc, (uint8_t *) buf, n);
+            state->size += n;
+        }
+        fclose(fd);
+    }
+}
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    char *buf = ((struct file_server_data *) req->user_ctx)->scratch;
+/* Receive the request body into fd, updating the running CRC and size */
+static esp_err_t upload_receive(httpd_req_t *req, FILE *fd, char *buf, uint32_t *crc, uint32_t *size) {
     int received;
 
     /* Content length of the request gives
-     * the size of the file being uploaded */
+     * the size of the part being uploaded */
     int remaining = req->content_len;
 
     while (remaining > 0) {
 
         ESP_LOGI(TAG, "Remaining size : %d", remaining);
         /* Receive the file part by part into a buffer */
-        if ((received = httpd_req_recv(req, buf, MIN(remaining, SCRATCH_BUFSIZE))) <= 0) {
+        if ((received = httpd_req_recv(req, buf, MIN(remaining, XFER_BUF_SIZE))) <= 0) {
             if (received == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry if timeout occurred */
                 continue;
             }
 
-            /* In case of unrecoverable error,
-             * close and delete the unfinished file*/
-            fclose(fd);
-            unlink(filepath);
-
             ESP_LOGE(TAG, "File reception failed!");
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
@@ -388,23 +776,117 @@ static esp_err_t upload_post_handler(httpd_req_t *req) {
         if (received && (received != fwrite(buf, 1, received, fd))) {
             /* Couldn't write everything to file!
              * Storage may be full? */
-            fclose(fd);
-            unlink(filepath);
-
             ESP_LOGE(TAG, "File write failed!");
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
             return ESP_FAIL;
         }
+        *crc = esp_rom_crc32_le(*crc, (uint8_t *) buf, received);
+        *size += received;
 
         /* Keep track of remaining size of
          * the file left to be uploaded */
         remaining -= received;
     }
+    return ESP_OK;
+}
+
+/* Move a complete upload to its real name */
+static esp_err_t upload_commit(httpd_req_t *req, const char *temppath, const char *filepath, const char *filename,
+                               uint32_t size) {
+    if (rename(temppath, filepath) != 0) {
+        ESP_LOGE(TAG, "Failed to rename %s", temppath);
+        unlink(temppath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store file");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "File reception complete");
+
+    file_index_entry_t entry = {
+            .size = size,
+            .mtime = time(NULL),
+    };
+    strlcpy(entry.name, filename + 1, sizeof(entry.name));
+    file_index_update(&entry);
+    return ESP_OK;
+}
+
+/* Paths of an upload target and its temp file, responds with an error
+ * and returns NULL if the name is not acceptable */
+static const char *upload_paths(httpd_req_t *req, char *filepath, char *temppath) {
+    struct stat file_stat;
+
+    /* Skip leading "/upload" from URI to get filename */
+    /* Note sizeof() counts NULL termination hence the -1 */
+    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *) req->user_ctx)->base_path,
+                                             req->uri + sizeof("/upload") - 1, FILE_PATH_MAX);
+    if (!filename || strlen(filename) + sizeof(UPLOAD_TEMP_EXT) > CONFIG_SPIFFS_OBJ_NAME_LEN) {
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return NULL;
+    }
+
+    /* Filename cannot have a trailing '/' */
+    if (filename[strlen(filename) - 1] == '/') {
+        ESP_LOGE(TAG, "Invalid filename : %s", filename);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filename");
+        return NULL;
+    }
+
+    if (stat(filepath, &file_stat) == 0) {
+        ESP_LOGE(TAG, "File already exists : %s", filepath);
+        /* Respond with 400 Bad Request */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File already exists");
+        return NULL;
+    }
+
+    snprintf(temppath, FILE_PATH_MAX, "%s" UPLOAD_TEMP_EXT, filepath);
+    return filename;
+}
+
+/* Upload a file onto the server in a single POST, runs on a transfer worker */
+static esp_err_t upload_transfer(httpd_req_t *req, char *buf) {
+    char filepath[FILE_PATH_MAX];
+    char temppath[FILE_PATH_MAX];
+
+    const char *filename = upload_paths(req, filepath, temppath);
+    if (!filename) {
+        return ESP_FAIL;
+    }
+
+    /* File cannot be larger than the free space */
+    if (req->content_len > upload_space_left()) {
+        ESP_LOGE(TAG, "File too large : %zu bytes", req->content_len);
+        /* Respond with 400 Bad Request */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not enough free space");
+        /* Return failure to close underlying connection else the
+         * incoming file content will keep the socket busy */
+        return ESP_FAIL;
+    }
+
+    FILE *fd = fopen(temppath, "w");
+    if (!fd) {
+        ESP_LOGE(TAG, "Failed to create file : %s", temppath);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Receiving file : %s...", filename);
+    uint32_t crc = 0;
+    uint32_t size = 0;
+    esp_err_t err = upload_receive(req, fd, buf, &crc, &size);
 
     /* Close file upon upload completion */
     fclose(fd);
-    ESP_LOGI(TAG, "File reception complete");
+    if (err != ESP_OK) {
+        /* a form upload cannot be resumed, delete the unfinished file */
+        unlink(temppath);
+        return ESP_FAIL;
+    }
+    if (upload_commit(req, temppath, filepath, filename, size) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
     /* Redirect onto root to see the updated file list */
     httpd_resp_set_status(req, "303 See Other");
@@ -416,6 +898,184 @@ static esp_err_t upload_post_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+/* PUT one part of a resumable upload, runs on a transfer worker */
+static esp_err_t upload_put_transfer(httpd_req_t *req, char *buf) {
+    char filepath[FILE_PATH_MAX];
+    char temppath[FILE_PATH_MAX];
+    char value[16];
+    char offset_str[12];
+    char crc_str[12];
+
+    const char *filename = upload_paths(req, filepath, temppath);
+    if (!filename) {
+        return ESP_FAIL;
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "Upload-Offset", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Upload-Offset required");
+        return ESP_FAIL;
+    }
+    uint32_t offset = strtoul(value, NULL, 10);
+    if (httpd_req_get_hdr_value_str(req, "Upload-Length", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Upload-Length required");
+        return ESP_FAIL;
+    }
+    uint32_t length = strtoul(value, NULL, 10);
+    if (offset > length || req->content_len > length - offset) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Part ends past Upload-Length");
+        return ESP_FAIL;
+    }
+    if (length - offset > upload_space_left()) {
+        ESP_LOGE(TAG, "File too large : %" PRIu32 " bytes", length);
+        httpd_resp_set_status(req, "413 Content Too Large");
+        httpd_resp_sendstr(req, "Not enough free space");
+        return ESP_FAIL;
+    }
+
+    upload_state_t *state = upload_state_acquire(filename + 1);
+    if (!state) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "Upload in progress");
+        return ESP_FAIL;
+    }
+    if (offset == 0) {
+        state->size = 0;
+        state->crc = 0;
+    } else {
+        upload_state_sync(state, temppath, buf);
+    }
+    if (offset != state->size) {
+        /* tell the client where to resume */
+        snprintf(offset_str, sizeof(offset_str), "%" PRIu32, state->size);
+        upload_state_release(state, false);
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_set_hdr(req, "Upload-Offset", offset_str);
+        httpd_resp_sendstr(req, "Upload-Offset mismatch");
+        return ESP_FAIL;
+    }
+
+    FILE *fd = fopen(temppath, offset == 0 ? "w" : "a");
+    if (!fd) {
+        ESP_LOGE(TAG, "Failed to open file : %s", temppath);
+        upload_state_release(state, true);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Receiving file : %s at %" PRIu32 " of %" PRIu32 "...", filename, offset, length);
+    esp_err_t err = upload_receive(req, fd, buf, &state->crc, &state->size);
+    fclose(fd);
+    if (err != ESP_OK) {
+        /* keep the part, the size on storage tells where to resume */
+        upload_state_release(state, true);
+        return ESP_FAIL;
+    }
+
+    uint32_t size = state->size;
+    uint32_t crc = state->crc;
+    snprintf(offset_str, sizeof(offset_str), "%" PRIu32, size);
+    snprintf(crc_str, sizeof(crc_str), "%08" PRIx32, crc);
+    httpd_resp_set_hdr(req, "Upload-Offset", offset_str);
+    httpd_resp_set_hdr(req, "Upload-CRC32", crc_str);
+    if (size < length) {
+        upload_state_release(state, false);
+        httpd_resp_set_status(req, "204 No Content");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    upload_state_release(state, true);
+    if (httpd_req_get_hdr_value_str(req, "Upload-CRC32", value, sizeof(value)) == ESP_OK
+        && strtoul(value, NULL, 16) != crc) {
+        ESP_LOGE(TAG, "CRC mismatch : %s", filename);
+        unlink(temppath);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Upload-CRC32 mismatch");
+        return ESP_FAIL;
+    }
+    if (upload_commit(req, temppath, filepath, filename, size) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    httpd_resp_set_status(req, "201 Created");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* HEAD reports how much of a resumable upload has arrived */
+static esp_err_t upload_head_transfer(httpd_req_t *req, char *buf) {
+    char filepath[FILE_PATH_MAX];
+    char temppath[FILE_PATH_MAX];
+    char offset_str[12];
+    char crc_str[12];
+
+    const char *filename = upload_paths(req, filepath, temppath);
+    if (!filename) {
+        return ESP_FAIL;
+    }
+    upload_state_t *state = upload_state_acquire(filename + 1);
+    if (!state) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    upload_state_sync(state, temppath, buf);
+    snprintf(offset_str, sizeof(offset_str), "%" PRIu32, state->size);
+    snprintf(crc_str, sizeof(crc_str), "%08" PRIx32, state->crc);
+    upload_state_release(state, false);
+
+    httpd_resp_set_hdr(req, "Upload-Offset", offset_str);
+    httpd_resp_set_hdr(req, "Upload-CRC32", crc_str);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* Transfers check a buffer out of the pool and continue on a worker */
+static esp_err_t file_list_api_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, file_list_api_transfer);
+}
+
+static bool metrics_ready = false;
+static metrics_hist_t download_us_metric;
+static metrics_counter_t downloads_metric;
+static metrics_counter_t download_errors_metric;
+
+/* Kept registered when the file server is stopped */
+static void download_metrics_init(void) {
+    if (metrics_ready) {
+        return;
+    }
+    metrics_hist_init(&download_us_metric, "http_download_duration_us", "Time to send one file download",
+                      NULL, NULL);
+    metrics_counter_init(&downloads_metric, "http_downloads_total", "File downloads handled", NULL, NULL);
+    metrics_counter_init(&download_errors_metric, "http_download_errors_total", "File downloads that failed",
+                         NULL, NULL);
+    metrics_ready = true;
+}
+
+/* Runs on a transfer worker */
+static esp_err_t download_transfer(httpd_req_t *req, char *buf) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = download_send(req, buf);
+    int64_t us = esp_timer_get_time() - start;
+    metrics_hist_observe(&download_us_metric, us > UINT32_MAX ? UINT32_MAX : (uint32_t) us);
+    metrics_counter_add(&downloads_metric, 1);
+    if (ret != ESP_OK) {
+        metrics_counter_add(&download_errors_metric, 1);
+    }
+    return ret;
+}
+
+static esp_err_t download_get_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, download_transfer);
+}
+
+static esp_err_t upload_post_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, upload_transfer);
+}
+
+static esp_err_t upload_put_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, upload_put_transfer);
+}
+
+static esp_err_t upload_head_handler(httpd_req_t *req) {
+    return xfer_pool_run(req, upload_head_transfer);
+}
+
 /* Handler to delete a file from the server */
 static esp_err_t delete_post_handler(httpd_req_t *req) {
     char filepath[FILE_PATH_MAX];
@@ -448,6 +1108,11 @@ static esp_err_t delete_post_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Deleting file : %s", filename);
     /* Delete file */
     unlink(filepath);
+    if (IS_FILE_EXT(filename, ULOG_FILE_EXT)) {
+        log_segments_remove(filename + 1);
+    } else {
+        file_index_remove(filename + 1);
+    }
 
     /* Redirect onto root to see the updated file list */
     httpd_resp_set_status(req, "303 See Other");
@@ -474,6 +1139,19 @@ esp_err_t register_file_server(const char *base_path, httpd_handle_t server) {
     }
     strlcpy(server_data->base_path, base_path,
             sizeof(server_data->base_path));
+    if (upload_lock == NULL) {
+        upload_lock = xSemaphoreCreateMutex();
+    }
+    download_metrics_init();
+
+    /* File metadata, ahead of the wildcard download handler below */
+    httpd_uri_t file_list_api = {
+            .uri       = "/api/files",
+            .method    = HTTP_GET,
+            .handler   = file_list_api_handler,
+            .user_ctx  = server_data
+    };
+    httpd_register_uri_handler(server, &file_list_api);
 
     /* URI handler for getting uploaded files */
     httpd_uri_t file_download = {
@@ -493,6 +1171,23 @@ esp_err_t register_file_server(const char *base_path, httpd_handle_t server) {
     };
     httpd_register_uri_handler(server, &file_upload);
 
+    /* URI handlers for resumable uploads */
+    httpd_uri_t file_upload_put = {
+            .uri       = "/upload/*",
+            .method    = HTTP_PUT,
+            .handler   = upload_put_handler,
+            .user_ctx  = server_data
+    };
+    httpd_register_uri_handler(server, &file_upload_put);
+
+    httpd_uri_t file_upload_head = {
+            .uri       = "/upload/*",
+            .method    = HTTP_HEAD,
+            .handler   = upload_head_handler,
+            .user_ctx  = server_data
+    };
+    httpd_register_uri_handler(server, &file_upload_head);
+
     /* URI handler for deleting files from server */
     httpd_uri_t file_delete = {
             .uri       = "/delete/*",   // Match all URIs of type /delete/path/to/file
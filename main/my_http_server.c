@@ -11,27 +11,46 @@
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_event.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "esp_app_desc.h"
+#else
 #include "esp_ota_ops.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#endif
 
 #include "esp_app_format.h"
 #include "nvs_flash.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "esp_http_server.h"
-#include "esp_wifi.h"
 
 #include "my_http_server.h"
 #include "my_file_server_common.h"
 #include "my_wsserver.h"
+#include "my_metrics_server.h"
 #include "bike_common.h"
+#include "log_segments.h"
+#include "log_query.h"
+#include "replay.h"
+#include "stimulus.h"
+#include "file_index.h"
+#include "resp_writer.h"
+#include "static_assets.h"
+#include "xfer_pool.h"
 
 static const char *TAG = "http_server";
 
 #define BUFFSIZE 1024
 char buff[BUFFSIZE + 1] = {0};
 
+/* Every websocket viewer and transfer worker, plus a few plain requests */
+#define HTTP_MAX_OPEN_SOCKETS (WS_MAX_CLIENTS + XFER_POOL_SIZE + 3)
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+/* httpd keeps three sockets of its own */
+_Static_assert(HTTP_MAX_OPEN_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS - 3, "raise CONFIG_LWIP_MAX_SOCKETS");
+#endif
+
 typedef struct {
     httpd_handle_t server_hdl;
 } http_server_t;
@@ -42,12 +61,7 @@ http_server_t *my_http_server = NULL;
  * Browsers expect to GET website icon at URI /favicon.ico.
  * This can be overridden by uploading file with same name */
 static esp_err_t favicon_get_handler(httpd_req_t *req) {
-    extern const unsigned char favicon_ico_start[] asm("_binary_favicon_ico_start");
-    extern const unsigned char favicon_ico_end[]   asm("_binary_favicon_ico_end");
-    const size_t favicon_ico_size = (favicon_ico_end - favicon_ico_start);
-    httpd_resp_set_type(req, "image/x-icon");
-    httpd_resp_send(req, (const char *) favicon_ico_start, favicon_ico_size);
-    return ESP_OK;
+    return static_asset_send(req, STATIC_ASSET_FAVICON);
 }
 
 
@@ -63,24 +77,37 @@ static esp_err_t favicon_get_handler(httpd_req_t *req) {
 esp_err_t current_version_handler(httpd_req_t *req) {
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");        //跨域传输协议
 
-    static char json_response[1024];
+    char json_response[256];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
 
+#if CONFIG_IDF_TARGET_LINUX
+    /* no app partitions on the host */
+    esp_app_desc_t running_app_info = *esp_app_get_description();
+    int ota_subtype = -1;
+    int address = 0;
+#else
     esp_app_desc_t running_app_info;
     const esp_partition_t *running = esp_ota_get_running_partition();
     esp_ota_get_partition_description(running, &running_app_info);
-
-    char *p = json_response;
-    *p++ = '{';
-    p += sprintf(p, "\"ota_subtype\":%d,", running->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN);     //OTA分区
-    p += sprintf(p, "\"address\":%ld,", running->address);               //地址
-    p += sprintf(p, "\"version\":\"%s\",", running_app_info.version);   //版本号
-    p += sprintf(p, "\"date\":\"%s\",", running_app_info.date);         //日期
-    p += sprintf(p, "\"time\":\"%s\"", running_app_info.time);          //时间
-    *p++ = '}';
-    *p++ = 0;
+    int ota_subtype = running->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN;
+    int address = running->address;
+#endif
+
+    resp_writer_str(&w, "{\"ota_subtype\":");
+    resp_writer_int(&w, ota_subtype);                                          //OTA分区
+    resp_writer_str(&w, ",\"address\":");
+    resp_writer_int(&w, address);                                              //地址
+    resp_writer_str(&w, ",\"version\":");
+    resp_writer_json_str(&w, running_app_info.version);                        //版本号
+    resp_writer_str(&w, ",\"date\":");
+    resp_writer_json_str(&w, running_app_info.date);                           //日期
+    resp_writer_str(&w, ",\"time\":");
+    resp_writer_json_str(&w, running_app_info.time);                           //时间
+    resp_writer_str(&w, "}");
 
     httpd_resp_set_type(req, "application/json");       // 设置http响应类型
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    return resp_writer_finish(&w);
 }
 
 esp_err_t my_http_server_start() {
@@ -103,6 +130,14 @@ esp_err_t my_http_server_start() {
      * allow the same handler to respond to multiple different
      * target URIs which match the wildcard scheme */
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 20;
+#ifdef SIM_HTTP_PORT
+    config.server_port = SIM_HTTP_PORT;
+#endif
+    /* Websocket viewers and async transfers hold their sockets, so each
+     * gets one. LRU purge stays off, it would close viewers first as
+     * they only receive. */
+    config.max_open_sockets = HTTP_MAX_OPEN_SOCKETS;
 
     ESP_LOGI(TAG, "Starting HTTP Server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) != ESP_OK) {
@@ -111,6 +146,7 @@ esp_err_t my_http_server_start() {
     }
 
     my_http_server->server_hdl = server;
+    ESP_ERROR_CHECK(xfer_pool_init());
 
 //    httpd_uri_t root = {
 //            .uri       = "/",
@@ -138,7 +174,15 @@ esp_err_t my_http_server_start() {
 
     register_ws_handler(server);
 
+    register_metrics_handler(server);
+
     ESP_ERROR_CHECK(mount_storage(FILE_SERVER_BASE_PATH, true));
+    log_segments_init(FILE_SERVER_BASE_PATH);
+    file_index_init(FILE_SERVER_BASE_PATH);
+    /* ahead of the file server, its wildcard download handler matches everything */
+    register_log_query_handler(FILE_SERVER_BASE_PATH, server);
+    register_replay_handler(FILE_SERVER_BASE_PATH, server);
+    register_stimulus_handler(FILE_SERVER_BASE_PATH, server);
     register_file_server(FILE_SERVER_BASE_PATH, server);
 
     return ESP_OK;
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "my_metrics_server.h"
+#include "metrics.h"
+#include "resp_writer.h"
+
+static const char *TAG = "metrics_server";
+
+/* Slots wrap after 2^32, far beyond what a core adds up in this time */
+#define METRICS_FOLD_PERIOD_US (10 * 1000 * 1000)
+
+static esp_timer_handle_t fold_timer = NULL;
+
+static void fold_timer_cb(void *arg) {
+    metrics_fold();
+}
+
+static void metrics_out(void *ctx, const char *str) {
+    resp_writer_str(ctx, str);
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+/* Snapshot of all tasks, NULL on failure */
+static TaskStatus_t *tasks_get(UBaseType_t *count) {
+    UBaseType_t size = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = malloc(size * sizeof(TaskStatus_t));
+    if (tasks == NULL) {
+        return NULL;
+    }
+    *count = uxTaskGetSystemState(tasks, size, NULL);
+    return tasks;
+}
+
+static uint64_t task_run_time(const TaskStatus_t *task) {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    return task->ulRunTimeCounter;
+#else
+    return 0;
+#endif
+}
+#endif
+
+/* The host heap of the linux target is not the device's, it is left out */
+static void write_system_prometheus(resp_writer_t *w) {
+#if !CONFIG_IDF_TARGET_LINUX
+    resp_writer_printf(w, "# HELP heap_free_bytes Free heap\n# TYPE heap_free_bytes gauge\nheap_free_bytes %lu\n",
+                       (unsigned long) esp_get_free_heap_size());
+    resp_writer_printf(w, "# HELP heap_min_free_bytes Lowest free heap since boot\n"
+                          "# TYPE heap_min_free_bytes gauge\nheap_min_free_bytes %lu\n",
+                       (unsigned long) esp_get_minimum_free_heap_size());
+    resp_writer_printf(w, "# HELP heap_largest_free_block_bytes Largest block malloc can return\n"
+                          "# TYPE heap_largest_free_block_bytes gauge\nheap_largest_free_block_bytes %lu\n",
+                       (unsigned long) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#endif
+    resp_writer_printf(w, "# HELP uptime_us Time since boot\n# TYPE uptime_us counter\nuptime_us %lld\n",
+                       (long long) esp_timer_get_time());
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t count;
+    TaskStatus_t *tasks = tasks_get(&count);
+    if (tasks == NULL) {
+        return;
+    }
+    resp_writer_str(w, "# HELP task_stack_free_min_bytes Stack never used by the task so far\n"
+                       "# TYPE task_stack_free_min_bytes gauge\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        resp_writer_printf(w, "task_stack_free_min_bytes{task=\"%s\"} %lu\n", tasks[i].pcTaskName,
+                           (unsigned long) tasks[i].usStackHighWaterMark);
+    }
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    resp_writer_str(w, "# HELP task_cpu_time_us_total CPU time used by the task\n"
+                       "# TYPE task_cpu_time_us_total counter\n");
+    for (UBaseType_t i = 0; i < count; i++) {
+        resp_writer_printf(w, "task_cpu_time_us_total{task=\"%s\"} %llu\n", tasks[i].pcTaskName,
+                           (unsigned long long) task_run_time(&tasks[i]));
+    }
+#endif
+    free(tasks);
+#endif
+}
+
+static void write_system_json(resp_writer_t *w) {
+#if !CONFIG_IDF_TARGET_LINUX
+    resp_writer_printf(w, ",\"heap\":{\"free\":%lu,\"min_free\":%lu,\"largest_free_block\":%lu}",
+                       (unsigned long) esp_get_free_heap_size(), (unsigned long) esp_get_minimum_free_heap_size(),
+                       (unsigned long) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#endif
+    resp_writer_printf(w, ",\"uptime_us\":%lld", (long long) esp_timer_get_time());
+
+    resp_writer_str(w, ",\"tasks\":[");
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t count;
+    TaskStatus_t *tasks = tasks_get(&count);
+    if (tasks != NULL) {
+        for (UBaseType_t i = 0; i < count; i++) {
+            resp_writer_printf(w, "%s{\"name\":", i == 0 ? "" : ",");
+            resp_writer_json_str(w, tasks[i].pcTaskName);
+            resp_writer_printf(w, ",\"priority\":%u,\"stack_free_min\":%lu,\"cpu_us\":%llu}",
+                               (unsigned) tasks[i].uxCurrentPriority, (unsigned long) tasks[i].usStackHighWaterMark,
+                               (unsigned long long) task_run_time(&tasks[i]));
+        }
+        free(tasks);
+    }
+#endif
+    resp_writer_str(w, "]");
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    char query[32] = "";
+    char param[8];
+    bool json = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+                && httpd_query_key_value(query, "format", param, sizeof(param)) == ESP_OK
+                && strcmp(param, "json") == 0;
+
+    char *buf = malloc(RESP_WRITER_MSS);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    resp_writer_t w;
+    resp_writer_init(&w, req, buf, RESP_WRITER_MSS);
+
+    if (json) {
+        httpd_resp_set_type(req, "application/json");
+        resp_writer_str(&w, "{\"metrics\":");
+        metrics_write_json(metrics_out, &w);
+        write_system_json(&w);
+        resp_writer_str(&w, "}");
+    } else {
+        httpd_resp_set_type(req, "text/plain; version=0.0.4");
+        metrics_write_prometheus(metrics_out, &w);
+        write_system_prometheus(&w);
+    }
+
+    esp_err_t err = resp_writer_finish(&w);
+    free(buf);
+    return err;
+}
+
+esp_err_t register_metrics_handler(httpd_handle_t server) {
+    if (fold_timer == NULL) {
+        const esp_timer_create_args_t args = {
+                .callback = fold_timer_cb,
+                .name = "metrics_fold",
+        };
+        ESP_RETURN_ON_ERROR(esp_timer_create(&args, &fold_timer), TAG, "fold timer");
+        ESP_RETURN_ON_ERROR(esp_timer_start_periodic(fold_timer, METRICS_FOLD_PERIOD_US), TAG, "fold timer");
+    }
+
+    httpd_uri_t metrics = {
+            .uri       = "/metrics",
+            .method    = HTTP_GET,
+            .handler   = metrics_get_handler,
+            .user_ctx  = NULL
+    };
+    return httpd_register_uri_handler(server, &metrics);
+}
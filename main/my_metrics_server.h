@@ -0,0 +1,10 @@
+#ifndef MY_METRICS_SERVER_H
+#define MY_METRICS_SERVER_H
+
+#include <esp_http_server.h>
+
+/* /metrics, the registered counters and histograms plus heap and task
+ * statistics, as Prometheus text or with ?format=json as JSON */
+esp_err_t register_metrics_handler(httpd_handle_t server);
+
+#endif //MY_METRICS_SERVER_H
@@ -138,7 +138,7 @@ esp_err_t mount_storage(const char *base_path, bool format_when_failed) {
         return ret;
     }
 
-    ESP_LOGI(TAG, "Partition size: total: %dByte, %dKB used: %dByte %dKB",
+    ESP_LOGI(TAG, "Partition size: total: %zuByte, %zuKB used: %zuByte %zuKB",
              total, total / 1024, used, used / 1024);
 
     // Check consistency of reported partiton size info.
@@ -7,188 +7,392 @@
 #include <esp_event.h>
 #include <esp_log.h>
 #include <nvs_flash.h>
-#include "driver/uart.h"
 #include "my_file_server_common.h"
 #include "bike_common.h"
+#include "uart_ring.h"
+#include "uart_logger.h"
+#include "ulog_format.h"
+#include "capture_port.h"
+#include "debug_tap.h"
+#include "metrics.h"
+#include "static_assets.h"
+#include "resp_writer.h"
+#include "xfer_pool.h"
 
 #include <esp_http_server.h>
 #include <esp_check.h>
 #include <esp_random.h>
+#include <esp_timer.h>
 #include <esp_vfs.h>
+#include <inttypes.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
 
 static const char *TAG = "ws_echo_server";
 
-#define BUF_SIZE (1024)
-static uint8_t uart_buff[BUF_SIZE] = {0};
-static char uart_log_buff[BUF_SIZE * 3] = {0};
-
-static int uart_buff_len = 0;
-static int valid_uart_buff_len = 0;
-static int uart_buff_idx = 0;
-static int lst_uart_buff_idx = 0;
+/* Binary frames carry whole capture records (ulog_rec_hdr_t + data) of
+ * all ports, merged by time */
+#define WS_SEND_MAX (4 * 1024)
+static uint8_t ws_send_buff[WS_SEND_MAX];
+
+/* Max time captured data may wait in the ring before it is pushed, when less than WS_SEND_MAX is pending */
+#define WS_COALESCE_MS_DEFAULT (20)
+static volatile int ws_coalesce_ms = WS_COALESCE_MS_DEFAULT;
+
+static httpd_handle_t ws_server = NULL;
+
+/* A client this far behind the producer is considered too slow */
+#define WS_LAG_MAX (CAPTURE_RING_SIZE / 2)
+
+typedef enum {
+    WS_SLOW_SKIP = 0,   // jump to the newest data and send a gap marker
+    WS_SLOW_CLOSE,      // disconnect the client
+} ws_slow_policy_t;
+
+typedef struct {
+    uart_ring_reader_t reader;
+    ulog_rec_hdr_t next;        // header read ahead of its payload
+    bool has_next;
+    uint32_t pending_gap;       // dropped bytes not yet reported to the client
+} ws_client_port_t;
+
+typedef struct {
+    int fd;                     // -1 when the slot is free
+    bool attached;
+    int tx_port;                // uart the client's frames are written to
+    ws_client_port_t ports[CAPTURE_PORT_MAX];
+    uint32_t lag;               // bytes pending at the last push round
+    uint32_t sent_bytes;
+    uint32_t dropped_bytes;
+    uint32_t gaps;
+    uint32_t send_fails;
+} ws_client_t;
+
+static ws_client_t ws_clients[WS_MAX_CLIENTS];
+static SemaphoreHandle_t ws_clients_lock = NULL;
+static volatile ws_slow_policy_t ws_slow_policy = WS_SLOW_SKIP;
 
 #define MY_HTTP_QUERY_KEY_MAX_LEN (64)
 
-static char log_filepath[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN];
-static FILE *logfile_fd = NULL;
-
-static TaskHandle_t uart_task_hdl = NULL;
-static TaskHandle_t uart_test_task_hdl = NULL;
+static TaskHandle_t ws_push_task_hdl = NULL;
+
+static metrics_hist_t ws_send_us_metric;
+static metrics_hist_t ws_handler_us_metric;
+static metrics_counter_t ws_sent_metric;
+static metrics_counter_t ws_dropped_metric;
+static metrics_counter_t ws_send_fails_metric;
+
+static void ws_metrics_init(void) {
+    metrics_hist_init(&ws_send_us_metric, "ws_send_duration_us", "Time to queue one frame on a client socket",
+                      NULL, NULL);
+    metrics_hist_init(&ws_handler_us_metric, "ws_handler_duration_us",
+                      "Time to handle one handshake or client frame", NULL, NULL);
+    metrics_counter_init(&ws_sent_metric, "ws_sent_bytes_total", "Record bytes sent to clients", NULL, NULL);
+    metrics_counter_init(&ws_dropped_metric, "ws_dropped_bytes_total",
+                         "Record bytes skipped for slow clients or lost in failed sends", NULL, NULL);
+    metrics_counter_init(&ws_send_fails_metric, "ws_send_failures_total", "Failed websocket sends", NULL, NULL);
+}
 
-struct uart_task_arg {
-    int baud_rate;
-    int tx_io_num;
-    int rx_io_num;
-};
+static void ws_client_free(ws_client_t *client) {
+    memset(client, 0, sizeof(ws_client_t));
+    client->fd = -1;
+}
 
-static esp_err_t open_log_file() {
-    uint16_t rndId = esp_random() % 1000;
-    struct stat file_stat;
-    do {
-        struct timeval tv;
-        // 使用 gettimeofday 获取当前时间
-        if (gettimeofday(&tv, NULL) == -1) {
-            perror("gettimeofday");
-            return EXIT_FAILURE;
+static esp_err_t ws_client_add(int fd, int tx_port) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    int slot = -1;
+    xSemaphoreTake(ws_clients_lock, portMAX_DELAY);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (ws_clients[i].fd == fd) {
+            /* socket number reused before the push task noticed the old one closed */
+            slot = i;
+            break;
         }
+        if (ws_clients[i].fd < 0 && slot < 0) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        ws_client_free(&ws_clients[slot]);
+        ws_clients[slot].fd = fd;
+        ws_clients[slot].tx_port = tx_port;
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(ws_clients_lock);
+    return ret;
+}
 
-        struct tm *timeinfo;
-        // 使用 localtime 将时间戳转换为当地时间表示形式
-        timeinfo = localtime(&tv.tv_sec);
-
-        // 打印年月日时分秒
-        printf("Current time: %d-%02d-%02d %02d:%02d:%02d\n",
-               timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-               timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+static int ws_client_tx_port(int fd) {
+    int port = CAPTURE_PORT_FIRST;
+    xSemaphoreTake(ws_clients_lock, portMAX_DELAY);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (ws_clients[i].fd == fd) {
+            port = ws_clients[i].tx_port;
+            break;
+        }
+    }
+    xSemaphoreGive(ws_clients_lock);
+    return port;
+}
 
-        sprintf(log_filepath, "%s/%02d%02d%02d%02d%02d_%d.log", FILE_SERVER_BASE_PATH,
-                timeinfo->tm_mon + 1, timeinfo->tm_mday,
-                timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, rndId);
+static uart_ring_t *ws_port_ring(int i) {
+    return capture_port_ring(CAPTURE_PORT_FIRST + i);
+}
 
-        rndId += 1;
-        ESP_LOGI(TAG, "log file path %s for file", log_filepath);
-    } while (stat(log_filepath, &file_stat) == 0); // == 0  file exist
+/* Drop everything pending on one port and continue at the newest data */
+static void ws_port_skip(ws_client_t *client, int i, uint32_t lost) {
+    ws_client_port_t *cp = &client->ports[i];
+    cp->pending_gap += lost;
+    client->dropped_bytes += lost;
+    metrics_counter_add(&ws_dropped_metric, lost);
+    client->gaps++;
+    uart_ring_reader_attach(ws_port_ring(i), &cp->reader);
+    cp->has_next = false;
+}
 
-    logfile_fd = fopen(log_filepath, "w");
-    if (logfile_fd == NULL) {
-        ESP_LOGE(TAG, "Failed to create log file : %s", log_filepath);
-        return ESP_FAIL;
+/* Read ahead the next record header of a port, false if there is none */
+static bool ws_port_peek(ws_client_t *client, int i) {
+    ws_client_port_t *cp = &client->ports[i];
+    uart_ring_t *ring = ws_port_ring(i);
+    if (cp->has_next) {
+        return true;
+    }
+    if (uart_ring_readable(ring, &cp->reader) < sizeof(ulog_rec_hdr_t)) {
+        return false;
+    }
+    uart_ring_read(ring, &cp->reader, (uint8_t *) &cp->next, sizeof(ulog_rec_hdr_t));
+    if (cp->reader.overrun_count > 0 || cp->next.sync != ULOG_REC_SYNC || cp->next.len > CAPTURE_REC_MAX) {
+        /* lapped by the producer, the position is no longer a record start */
+        ws_port_skip(client, i, cp->reader.overrun_bytes + uart_ring_readable(ring, &cp->reader));
+        return false;
     }
-    return ESP_OK;
+    cp->has_next = true;
+    return true;
 }
 
-static void uart_task(void *args) {
-    struct uart_task_arg *arg = args;
-    /* Configure parameters of an UART driver,
-     * communication pins and install the driver */
-    uart_config_t uart_config = {
-            .baud_rate = arg->baud_rate,
-            .data_bits = UART_DATA_8_BITS,
-            .parity    = UART_PARITY_DISABLE,
-            .stop_bits = UART_STOP_BITS_1,
-            .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-            .source_clk = UART_SCLK_DEFAULT,
-    };
-    int intr_alloc_flags = 0;
+static uint32_t ws_client_pending(ws_client_t *client) {
+    uint32_t pending = 0;
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        ws_client_port_t *cp = &client->ports[i];
+        pending += uart_ring_readable(ws_port_ring(i), &cp->reader) + cp->pending_gap;
+        if (cp->has_next) {
+            pending += sizeof(ulog_rec_hdr_t) + cp->next.len;
+        }
+    }
+    return pending;
+}
 
-#if CONFIG_UART_ISR_IN_IRAM
-    intr_alloc_flags = ESP_INTR_FLAG_IRAM;
-#endif
+/* Account the records of a frame that could not be sent as gaps */
+static void ws_frame_lost(ws_client_t *client, const uint8_t *frame, uint32_t len) {
+    ulog_rec_hdr_t hdr;
+    for (uint32_t off = 0; off + sizeof(hdr) <= len; off += sizeof(hdr) + hdr.len) {
+        memcpy(&hdr, frame + off, sizeof(hdr));
+        int i = ULOG_FLAG_PORT_OF(hdr.flags) - CAPTURE_PORT_FIRST;
+        if (i >= 0 && i < CAPTURE_PORT_MAX) {
+            client->ports[i].pending_gap += hdr.len;
+        }
+        client->dropped_bytes += hdr.len;
+        metrics_counter_add(&ws_dropped_metric, hdr.len);
+    }
+}
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_NUM_1, BUF_SIZE * 2, 0, 0, NULL, intr_alloc_flags));
-    ESP_ERROR_CHECK(uart_param_config(UART_NUM_1, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_NUM_1, arg->tx_io_num, arg->rx_io_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-    ESP_LOGI(TAG, "start uart, speed:%d tx:%d, rx:%d", arg->baud_rate, arg->tx_io_num, arg->rx_io_num);
+/* Send pending data to one client, returns true if it has more to send */
+static bool ws_client_push(ws_client_t *client, bool writable) {
+    if (!client->attached) {
+        /* a new client only sees data captured from now on */
+        for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+            uart_ring_reader_attach(ws_port_ring(i), &client->ports[i].reader);
+            client->ports[i].has_next = false;
+        }
+        client->attached = true;
+        return false;
+    }
 
-    while (1) {
-        // Read data from the UART
-        uart_buff_len = uart_read_bytes(UART_NUM_1, uart_buff, (BUF_SIZE - 1), 10 / portTICK_PERIOD_MS);
-        // Write data back to the UART
-        if (uart_buff_len > 0) {
+    client->lag = 0;
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        uint32_t lag = uart_ring_readable(ws_port_ring(i), &client->ports[i].reader);
+        if (lag > WS_LAG_MAX) {
+            if (ws_slow_policy == WS_SLOW_CLOSE) {
+                ESP_LOGW(TAG, "ws client %d too slow (lag %" PRIu32 "), closing", client->fd, lag);
+                httpd_sess_trigger_close(ws_server, client->fd);
+                ws_client_free(client);
+                return false;
+            }
+            /* skip to latest */
+            ws_port_skip(client, i, lag);
+            lag = 0;
+        }
+        client->lag += lag;
+    }
 
-            valid_uart_buff_len = uart_buff_len;
-            uart_buff_idx ++;
+    if (!writable) {
+        return ws_client_pending(client) > 0;
+    }
 
-            print_bytes(uart_buff, uart_buff_len);
+    for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+        ws_client_port_t *cp = &client->ports[i];
+        if (cp->pending_gap == 0) {
+            continue;
+        }
+        char marker[40];
+        httpd_ws_frame_t gap_pkt = {
+                .final = true,
+                .type = HTTPD_WS_TYPE_TEXT,
+                .payload = (uint8_t *) marker,
+                .len = snprintf(marker, sizeof(marker), "{\"gap\":%" PRIu32 ",\"port\":%d}", cp->pending_gap,
+                                CAPTURE_PORT_FIRST + i),
+        };
+        if (httpd_ws_send_frame_async(ws_server, client->fd, &gap_pkt) != ESP_OK) {
+            client->send_fails++;
+            metrics_counter_add(&ws_send_fails_metric, 1);
+            return true;
+        }
+        cp->pending_gap = 0;
+    }
 
-            if (logfile_fd == NULL) {
-                open_log_file();
+    /* merge the ports into one frame of whole records, oldest first */
+    uint32_t len = 0;
+    while (1) {
+        int best = -1;
+        for (int i = 0; i < CAPTURE_PORT_MAX; i++) {
+            if (ws_port_peek(client, i)
+                && (best < 0 || client->ports[i].next.ts_us < client->ports[best].next.ts_us)) {
+                best = i;
             }
+        }
+        if (best < 0) {
+            break;
+        }
+        ws_client_port_t *cp = &client->ports[best];
+        if (len + sizeof(ulog_rec_hdr_t) + cp->next.len > WS_SEND_MAX) {
+            break;
+        }
+        memcpy(ws_send_buff + len, &cp->next, sizeof(ulog_rec_hdr_t));
+        uint32_t n = uart_ring_read(ws_port_ring(best), &cp->reader, ws_send_buff + len + sizeof(ulog_rec_hdr_t),
+                                    cp->next.len);
+        if (n != cp->next.len || cp->reader.overrun_count > 0) {
+            ws_port_skip(client, best, cp->reader.overrun_bytes + n);
+            continue;
+        }
+        cp->has_next = false;
+        len += sizeof(ulog_rec_hdr_t) + n;
+    }
+    if (len == 0) {
+        return ws_client_pending(client) > 0;
+    }
+
+    httpd_ws_frame_t ws_pkt = {
+            .final = true,
+            .type = HTTPD_WS_TYPE_BINARY,
+            .payload = ws_send_buff,
+            .len = len,
+    };
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = httpd_ws_send_frame_async(ws_server, client->fd, &ws_pkt);
+    metrics_hist_observe(&ws_send_us_metric, (uint32_t) (esp_timer_get_time() - start));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_ws_send_frame_async to %d failed with %d", client->fd, ret);
+        client->send_fails++;
+        metrics_counter_add(&ws_send_fails_metric, 1);
+        ws_frame_lost(client, ws_send_buff, len);
+        return true;
+    }
+    client->sent_bytes += len;
+    metrics_counter_add(&ws_sent_metric, len);
+    return ws_client_pending(client) > 0;
+}
 
-            if (logfile_fd != NULL) {
-                //fwrite(uart_buff, 1, len + 1, logfile_fd);
-                int i;
+/* Push captured data to every websocket client as it arrives, batching
+ * up to WS_SEND_MAX bytes or ws_coalesce_ms, whichever comes first.
+ * Only sockets with free send buffer are written, so one slow client
+ * falls behind on its own instead of stalling the others. */
+static void ws_push_task(void *args) {
+    TickType_t wait = portMAX_DELAY;
 
-                struct timeval tv;
-                gettimeofday(&tv, NULL);
-
-                struct tm *timeinfo;
-                timeinfo = localtime(&tv.tv_sec);
-
-                sprintf(uart_log_buff, "\n%02d:%02d:%02d.%03ld: ", timeinfo->tm_hour, timeinfo->tm_min,
-                        timeinfo->tm_sec,
-                        tv.tv_usec / 1000);
-                int start_idx = strlen(uart_log_buff) - 1;
-                for (i = 0; i < uart_buff_len; i++) {
-                    sprintf(uart_log_buff + start_idx, "%s%02x", i != 0 ? " " : "", uart_buff[i]);
-                    start_idx += (i != 0 ? 3 : 2);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(ws_coalesce_ms);
+        while (1) {
+            uint32_t max_pending = 0;
+            xSemaphoreTake(ws_clients_lock, portMAX_DELAY);
+            for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+                if (ws_clients[i].fd >= 0 && ws_clients[i].attached) {
+                    max_pending = max(max_pending, ws_client_pending(&ws_clients[i]));
                 }
+            }
+            xSemaphoreGive(ws_clients_lock);
 
-                fwrite(uart_log_buff, sizeof(uart_log_buff[0]), strlen(uart_log_buff), logfile_fd);
+            TickType_t now = xTaskGetTickCount();
+            if (max_pending >= WS_SEND_MAX || (int32_t) (deadline - now) <= 0) {
+                break;
             }
+            ulTaskNotifyTake(pdTRUE, deadline - now);
         }
-    }
-}
 
-static void uart_test_write_task(void *args) {
-    // Configure a temporary buffer for the incoming data
-    uint8_t *data = (uint8_t *) malloc(12);
-    uint32_t x = 0;
+        fd_set wfds;
+        int max_fd = -1;
+        FD_ZERO(&wfds);
 
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(500));
-        ((uint32_t *) data)[0] = x;
-        x++;
-        // Write data back to the UART
-        uart_write_bytes(UART_NUM_1, data, 8);
-        print_bytes(data, 8);
-    }
-}
+        xSemaphoreTake(ws_clients_lock, portMAX_DELAY);
+        for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+            if (ws_clients[i].fd < 0) {
+                continue;
+            }
+            if (httpd_ws_get_fd_info(ws_server, ws_clients[i].fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+                ESP_LOGI(TAG, "ws client %d gone", ws_clients[i].fd);
+                ws_client_free(&ws_clients[i]);
+                continue;
+            }
+            FD_SET(ws_clients[i].fd, &wfds);
+            max_fd = max(max_fd, ws_clients[i].fd);
+        }
 
-static void stop_uart_task() {
-    if (uart_test_task_hdl) {
-        vTaskDelete(uart_test_task_hdl);
-    }
-    uart_test_task_hdl = NULL;
+        if (max_fd >= 0) {
+            struct timeval tv = {0};
+            if (select(max_fd + 1, NULL, &wfds, NULL, &tv) < 0) {
+                FD_ZERO(&wfds);
+            }
+        }
 
-    if (uart_task_hdl != NULL) {
-        vTaskDelete(uart_task_hdl);
-        uart_task_hdl = NULL;
-        uart_driver_delete(UART_NUM_1);
-    }
+        bool more = false;
+        for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+            if (ws_clients[i].fd >= 0) {
+                more |= ws_client_push(&ws_clients[i], FD_ISSET(ws_clients[i].fd, &wfds));
+            }
+        }
+        xSemaphoreGive(ws_clients_lock);
 
-    if (logfile_fd != NULL) {
-        fclose(logfile_fd);
-        logfile_fd = NULL;
+        /* come back soon if some client still has data queued */
+        wait = more ? 1 : portMAX_DELAY;
     }
 }
 
-static void start_uart_task(int baud_rate, int tx_io_num, int rx_io_num) {
-    stop_uart_task();
-    struct uart_task_arg *arg = malloc(sizeof(struct uart_task_arg));
-    arg->baud_rate = baud_rate;
-    arg->rx_io_num = rx_io_num;
-    arg->tx_io_num = tx_io_num;
-    xTaskCreate(uart_task, "uart_task", 8192, arg, 5, &uart_task_hdl);
-    free(arg);
-
-    // for test
-    // xTaskCreate(uart_test_write_task, "uart_test_task", 8192, NULL, 10, &uart_test_task_hdl);
+/* Uart number from a "port" query parameter, default when absent */
+static int ws_query_port(const char *query, int def) {
+    char param[8];
+    if (httpd_query_key_value(query, "port", param, sizeof(param)) == ESP_OK) {
+        return atoi(param);
+    }
+    return def;
 }
 
-static esp_err_t ws_handler(httpd_req_t *req) {
+static esp_err_t ws_handle_req(httpd_req_t *req) {
     if (req->method == HTTP_GET) {
         ESP_LOGI(TAG, "Handshake done, the new connection was opened");
+        /* frames from the client are written to ?port=N */
+        char query[32] = "";
+        httpd_req_get_url_query_str(req, query, sizeof(query));
+        int tx_port = ws_query_port(query, CAPTURE_PORT_FIRST);
+        if (!capture_port_valid(tx_port)) {
+            tx_port = CAPTURE_PORT_FIRST;
+        }
+        if (ws_client_add(httpd_req_to_sockfd(req), tx_port) != ESP_OK) {
+            ESP_LOGE(TAG, "Too many ws clients");
+            return ESP_FAIL;
+        }
+        xTaskNotifyGive(ws_push_task_hdl);
         return ESP_OK;
     }
     httpd_ws_frame_t ws_pkt;
@@ -218,21 +422,9 @@ static esp_err_t ws_handler(httpd_req_t *req) {
             return ret;
         }
 
-        ESP_LOGI(TAG, "frame len is %d, packet type: %d message:%s", ws_pkt.len, ws_pkt.type, ws_pkt.payload);
-    }
-
-    if (lst_uart_buff_idx != uart_buff_idx) {
-        lst_uart_buff_idx = uart_buff_idx;
-
-        // new data come
-        memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-        ws_pkt.type = HTTPD_WS_TYPE_BINARY;
-        ws_pkt.payload = uart_buff;
-        ws_pkt.len = valid_uart_buff_len;
-
-        ret = httpd_ws_send_frame(req, &ws_pkt);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "httpd_ws_send_frame failed with %d", ret);
+        ESP_LOGD(TAG, "frame len is %zu, packet type: %d", ws_pkt.len, ws_pkt.type);
+        if (ws_pkt.type == HTTPD_WS_TYPE_TEXT || ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+            capture_port_write(ws_client_tx_port(httpd_req_to_sockfd(req)), ws_pkt.payload, ws_pkt.len);
         }
     }
 
@@ -240,6 +432,13 @@ static esp_err_t ws_handler(httpd_req_t *req) {
     return ret;
 }
 
+static esp_err_t ws_handler(httpd_req_t *req) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = ws_handle_req(req);
+    metrics_hist_observe(&ws_handler_us_metric, (uint32_t) (esp_timer_get_time() - start));
+    return ret;
+}
+
 static const httpd_uri_t ws = {
         .uri        = "/ws",
         .method     = HTTP_GET,
@@ -249,22 +448,34 @@ static const httpd_uri_t ws = {
 };
 
 static esp_err_t ws_uart_get_handler(httpd_req_t *req) {
-    extern const unsigned char wsuart_html_start[] asm("_binary_wsuart_html_start");
-    extern const unsigned char wsuart_html_end[]   asm("_binary_wsuart_html_end");
-    const size_t wsuart_html_size = (wsuart_html_end - wsuart_html_start);
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, (const char *) wsuart_html_start, wsuart_html_size);
-    return ESP_OK;
+    return static_asset_send(req, STATIC_ASSET_WSUART);
+}
+
+/* Size in KB from a query value, false unless it is a number within
+ * min and max bytes */
+static bool query_kb(const char *param, uint32_t min, uint32_t max, uint32_t *bytes) {
+    char *end;
+    unsigned long kb = strtoul(param, &end, 10);
+    if (end == param || *end != '\0' || param[0] == '-' || kb > max / 1024 || kb * 1024 < min) {
+        return false;
+    }
+    *bytes = kb * 1024;
+    return true;
 }
 
 esp_err_t ws_uart_config_handler(httpd_req_t *req) {
+    const char *bad_param = NULL;
     char *buf;
     size_t buf_len;
     int speed = 9600;
     int tx = 4;
     int rx = 5;
+    int port = CAPTURE_PORT_FIRST;
     int stop = 0;
     int time = 0;
+    int coalesce = ws_coalesce_ms;
+    int slow = ws_slow_policy;
+    capture_port_config_t port_config = {0};
 
     /* Read URL query string length and allocate memory for length + 1,
      * extra byte for null termination */
@@ -297,6 +508,7 @@ esp_err_t ws_uart_config_handler(httpd_req_t *req) {
                 rx = atoi(dec_param);
                 memset(dec_param, 0, MY_HTTP_QUERY_KEY_MAX_LEN);
             }
+            port = ws_query_port(buf, port);
             if (httpd_query_key_value(buf, "stop", param, sizeof(param)) == ESP_OK) {
                 ESP_LOGI(TAG, "Found URL query parameter => stop=%s", param);
                 uri_decode(dec_param, param, strnlen(param, MY_HTTP_QUERY_KEY_MAX_LEN));
@@ -319,32 +531,229 @@ esp_err_t ws_uart_config_handler(httpd_req_t *req) {
                 setenv("TZ", "CST-8", 1);
                 tzset();
 
+#if CONFIG_IDF_TARGET_LINUX
+                (void) tv;      // the simulation keeps the host clock
+#else
                 settimeofday(&tv, NULL);
+#endif
+            }
+            if (httpd_query_key_value(buf, "coalesce", param, sizeof(param)) == ESP_OK) {
+                ESP_LOGI(TAG, "Found URL query parameter => coalesce=%s", param);
+                uri_decode(dec_param, param, strnlen(param, MY_HTTP_QUERY_KEY_MAX_LEN));
+                ESP_LOGI(TAG, "Decoded query parameter => %s", dec_param);
+                coalesce = atoi(dec_param);
+                memset(dec_param, 0, MY_HTTP_QUERY_KEY_MAX_LEN);
+            }
+            if (httpd_query_key_value(buf, "slow", param, sizeof(param)) == ESP_OK) {
+                ESP_LOGI(TAG, "Found URL query parameter => slow=%s", param);
+                uri_decode(dec_param, param, strnlen(param, MY_HTTP_QUERY_KEY_MAX_LEN));
+                ESP_LOGI(TAG, "Decoded query parameter => %s", dec_param);
+                slow = strcmp(dec_param, "close") == 0 ? WS_SLOW_CLOSE : WS_SLOW_SKIP;
+                memset(dec_param, 0, MY_HTTP_QUERY_KEY_MAX_LEN);
+            }
+            /* log rotation, sizes in KB, age in seconds */
+            if (httpd_query_key_value(buf, "segsize", param, sizeof(param)) == ESP_OK
+                && !query_kb(param, UART_LOGGER_SEGMENT_SIZE_MIN, UART_LOGGER_SEGMENT_SIZE_MAX,
+                             &port_config.logger.segment_size)) {
+                bad_param = "Invalid segsize";
+            }
+            if (httpd_query_key_value(buf, "segage", param, sizeof(param)) == ESP_OK) {
+                port_config.logger.segment_age_s = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "minfree", param, sizeof(param)) == ESP_OK
+                && !query_kb(param, 0, UART_LOGGER_MIN_FREE_MAX, &port_config.logger.min_free)) {
+                bad_param = "Invalid minfree";
+            }
+            if (httpd_query_key_value(buf, "compress", param, sizeof(param)) == ESP_OK) {
+                port_config.logger.compress = atoi(param) != 0;
+            }
+            /* reception, FIFO threshold in bytes, timeout in symbol times,
+             * pattern as a hex byte repeated patnum times */
+            if (httpd_query_key_value(buf, "rxfull", param, sizeof(param)) == ESP_OK) {
+                port_config.rx_full_thresh = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "rxtimeout", param, sizeof(param)) == ESP_OK) {
+                port_config.rx_timeout = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "pattern", param, sizeof(param)) == ESP_OK) {
+                port_config.pattern_chr = (int) strtol(param, NULL, 16) & 0xff;
+                port_config.pattern_num = 1;
+            }
+            if (httpd_query_key_value(buf, "patnum", param, sizeof(param)) == ESP_OK) {
+                port_config.pattern_num = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "decode", param, sizeof(param)) == ESP_OK) {
+                port_config.decoder = frame_proto_from_name(param);
+            }
+            /* triggers, hex patterns with '?' nibbles, windows in ms */
+            char trigger[TRIGGER_SPEC_MAX];
+            if (httpd_query_key_value(buf, "trigger", trigger, sizeof(trigger)) == ESP_OK) {
+                uri_decode(port_config.trigger, trigger, strnlen(trigger, sizeof(trigger)));
+            }
+            if (httpd_query_key_value(buf, "pre", param, sizeof(param)) == ESP_OK) {
+                port_config.trigger_pre_ms = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "post", param, sizeof(param)) == ESP_OK) {
+                port_config.trigger_post_ms = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "trigonly", param, sizeof(param)) == ESP_OK) {
+                port_config.trigger_only = atoi(param) != 0;
             }
         }
         free(buf);
     }
 
-    static char json_response[128];
-    char *p = json_response;
+    if (!capture_port_valid(port)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid port");
+        return ESP_OK;
+    }
+    if (bad_param != NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad_param);
+        return ESP_OK;
+    }
+
+    char json_response[256];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
     if (stop == 0) {
-        start_uart_task(speed, tx, rx);
-        *p++ = '{';
-        p += sprintf(p, "\"speed\":%d,", speed);
-        p += sprintf(p, "\"tx\":%d,", tx);
-        p += sprintf(p, "\"rx\":%d", rx);
-        *p++ = '}';
-        *p++ = 0;
+        ws_coalesce_ms = coalesce < 0 ? 0 : coalesce;
+        ws_slow_policy = slow;
+        port_config.baud_rate = speed;
+        port_config.tx_io_num = tx;
+        port_config.rx_io_num = rx;
+        esp_err_t err = capture_port_start(port, &port_config);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid port configuration");
+            return ESP_OK;
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start port");
+            return ESP_OK;
+        }
+        resp_writer_printf(&w, "{\"port\":%d,\"speed\":%d,\"tx\":%d,\"rx\":%d,\"decode\":\"%s\","
+                               "\"coalesce\":%d,\"slow\":\"%s\"}",
+                           port, speed, tx, rx, frame_proto_name(port_config.decoder), ws_coalesce_ms,
+                           ws_slow_policy == WS_SLOW_CLOSE ? "close" : "skip");
     } else {
-        stop_uart_task();
-        *p++ = '{';
-        p += sprintf(p, "\"stop\":%d", 1);
-        *p++ = '}';
-        *p++ = 0;
+        capture_port_stop(port);
+        resp_writer_printf(&w, "{\"port\":%d,\"stop\":1}", port);
     }
 
     httpd_resp_set_type(req, "application/json");       // 设置http响应类型
-    return httpd_resp_send(req, json_response, strlen(json_response));
+    return resp_writer_finish(&w);
+}
+
+/* Per client push statistics */
+static esp_err_t ws_clients_handler(httpd_req_t *req) {
+    char json_response[512];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
+
+    resp_writer_printf(&w, "{\"policy\":\"%s\",\"clients\":[", ws_slow_policy == WS_SLOW_CLOSE ? "close" : "skip");
+    xSemaphoreTake(ws_clients_lock, portMAX_DELAY);
+    bool first = true;
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        ws_client_t *c = &ws_clients[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        resp_writer_printf(&w, "%s{\"fd\":%d,\"lag\":%" PRIu32 ",\"sent\":%" PRIu32 ",\"dropped\":%" PRIu32 ","
+                               "\"gaps\":%" PRIu32 ",\"send_fails\":%" PRIu32 "}",
+                           first ? "" : ",", c->fd, c->lag,
+                           c->sent_bytes, c->dropped_bytes, c->gaps, c->send_fails);
+        first = false;
+    }
+    xSemaphoreGive(ws_clients_lock);
+    resp_writer_str(&w, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    return resp_writer_finish(&w);
+}
+
+/* Capture pipeline and transfer pool statistics */
+static esp_err_t uart_stats_handler(httpd_req_t *req) {
+    char json_response[640];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
+
+    resp_writer_str(&w, "{\"ports\":[");
+    for (int port = CAPTURE_PORT_FIRST; port < CAPTURE_PORT_FIRST + CAPTURE_PORT_MAX; port++) {
+        capture_port_stats_t stats;
+        capture_port_get_stats(port, &stats);
+        resp_writer_printf(&w, "%s{\"port\":%d,\"running\":%s,\"baud\":%d,\"rx_bytes\":%" PRIu32 ","
+                               "\"rx_overflows\":%" PRIu32 ",\"rx_breaks\":%" PRIu32 ","
+                               "\"decoder\":\"%s\",\"frames\":%" PRIu32 ",\"frame_errors\":%" PRIu32 ","
+                               "\"triggers\":%" PRIu32 ",\"filtered_bytes\":%" PRIu32 ","
+                               "\"tx\":{\"queue_depth\":%" PRIu32 ",\"frames\":%" PRIu32 ","
+                               "\"bytes_written\":%" PRIu32 ",\"bytes_dropped\":%" PRIu32 "},",
+                           port == CAPTURE_PORT_FIRST ? "" : ",", port, stats.running ? "true" : "false",
+                           stats.baud_rate, stats.rx_bytes, stats.rx_overflows, stats.rx_breaks,
+                           frame_proto_name(stats.decoder), stats.frames, stats.frame_errors,
+                           stats.triggers, stats.filtered_bytes,
+                           stats.tx_queue_depth, stats.tx_frames, stats.tx_bytes_written, stats.tx_bytes_dropped);
+        if (stats.has_logger) {
+            uart_logger_stats_t *l = &stats.logger;
+            resp_writer_printf(&w, "\"logger\":{\"queue_depth\":%" PRIu32 ",\"queue_depth_max\":%" PRIu32 ","
+                                   "\"blocks_written\":%" PRIu32 ",\"drop_episodes\":%" PRIu32 ","
+                                   "\"bytes_written\":%" PRIu32 ",\"bytes_padded\":%" PRIu32 ","
+                                   "\"bytes_raw\":%" PRIu32 ","
+                                   "\"bytes_dropped\":%" PRIu32 ",\"write_errors\":%" PRIu32 ","
+                                   "\"longest_stall_us\":%" PRIu32 ","
+                                   "\"segments_opened\":%" PRIu32 ",\"segments_deleted\":%" PRIu32 "}}",
+                               l->queue_depth, l->queue_depth_max, l->blocks_written, l->drop_episodes,
+                               l->bytes_written, l->bytes_padded, l->bytes_raw, l->bytes_dropped, l->write_errors,
+                               l->longest_stall_us, l->segments_opened, l->segments_deleted);
+        } else {
+            resp_writer_str(&w, "\"logger\":null}");
+        }
+    }
+
+    xfer_pool_stats_t xfer;
+    xfer_pool_get_stats(&xfer);
+    resp_writer_printf(&w, "],\"xfer\":{\"size\":%" PRIu32 ",\"in_use\":%" PRIu32 ",\"high_water\":%" PRIu32 ","
+                           "\"rejected\":%" PRIu32 "}}",
+                       xfer.size, xfer.in_use, xfer.high_water, xfer.rejected);
+
+    httpd_resp_set_type(req, "application/json");
+    return resp_writer_finish(&w);
+}
+
+/* Console debug tap, /debugtap?level=off|summary|hex&rate=<sampled bytes per second> */
+static esp_err_t debug_tap_handler(httpd_req_t *req) {
+    char *buf;
+    size_t buf_len;
+
+    buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len > 1) {
+        buf = malloc(buf_len);
+        ESP_RETURN_ON_FALSE(buf, ESP_ERR_NO_MEM, TAG, "buffer alloc failed");
+        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
+            char param[MY_HTTP_QUERY_KEY_MAX_LEN], dec_param[MY_HTTP_QUERY_KEY_MAX_LEN] = {0};
+            if (httpd_query_key_value(buf, "rate", param, sizeof(param)) == ESP_OK) {
+                uri_decode(dec_param, param, strnlen(param, MY_HTTP_QUERY_KEY_MAX_LEN));
+                debug_tap_set_rate(max(atoi(dec_param), 0));
+                memset(dec_param, 0, MY_HTTP_QUERY_KEY_MAX_LEN);
+            }
+            if (httpd_query_key_value(buf, "level", param, sizeof(param)) == ESP_OK) {
+                uri_decode(dec_param, param, strnlen(param, MY_HTTP_QUERY_KEY_MAX_LEN));
+                debug_tap_set_level(debug_tap_level_from_name(dec_param));
+                ESP_LOGI(TAG, "Debug tap level %s", debug_tap_level_name(debug_tap_get_level()));
+            }
+        }
+        free(buf);
+    }
+
+    char json_response[64];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
+    resp_writer_str(&w, "{\"level\":");
+    resp_writer_json_str(&w, debug_tap_level_name(debug_tap_get_level()));
+    resp_writer_str(&w, ",\"rate\":");
+    resp_writer_int(&w, debug_tap_get_rate());
+    resp_writer_str(&w, "}");
+
+    httpd_resp_set_type(req, "application/json");
+    return resp_writer_finish(&w);
 }
 
 httpd_uri_t uart_page_server = {
@@ -361,12 +770,50 @@ httpd_uri_t uart_config_server = {
         .user_ctx  = NULL,
 };
 
+httpd_uri_t uart_stats_server = {
+        .uri       = "/uartstats",
+        .method    = HTTP_GET,
+        .handler   = uart_stats_handler,
+        .user_ctx  = NULL,
+};
+
+httpd_uri_t ws_clients_server = {
+        .uri       = "/wsclients",
+        .method    = HTTP_GET,
+        .handler   = ws_clients_handler,
+        .user_ctx  = NULL,
+};
+
+httpd_uri_t debug_tap_server = {
+        .uri       = "/debugtap",
+        .method    = HTTP_GET,
+        .handler   = debug_tap_handler,
+        .user_ctx  = NULL,
+};
+
 esp_err_t register_ws_handler(httpd_handle_t server) {
+    ws_server = server;
+    if (ws_push_task_hdl == NULL) {
+        ws_metrics_init();
+        ESP_ERROR_CHECK(capture_port_init());
+        ws_clients_lock = xSemaphoreCreateMutex();
+        for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+            ws_client_free(&ws_clients[i]);
+        }
+        xTaskCreate(ws_push_task, "ws_push_task", 4096, NULL, 4, &ws_push_task_hdl);
+        capture_port_set_notify(ws_push_task_hdl);
+    }
 
     httpd_register_uri_handler(server, &uart_page_server);
 
     httpd_register_uri_handler(server, &uart_config_server);
 
+    httpd_register_uri_handler(server, &ws_clients_server);
+
+    httpd_register_uri_handler(server, &uart_stats_server);
+
+    httpd_register_uri_handler(server, &debug_tap_server);
+
     ESP_LOGI(TAG, "Ws server register successful!");
     return httpd_register_uri_handler(server, &ws);
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 
 #include <esp_http_server.h>
 
+/* Each websocket client keeps its own position in every capture ring */
+#define WS_MAX_CLIENTS (4)
+
 esp_err_t register_ws_handler(httpd_handle_t server);
 
 #endif //WS_ECHO_SERVER_MY_WSSERVER_H
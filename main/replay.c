@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/message_buffer.h"
+
+#include "replay.h"
+#include "bike_common.h"
+#include "capture_port.h"
+#include "ulog_format.h"
+#include "metrics.h"
+#include "resp_writer.h"
+
+static const char *TAG = "replay";
+
+/* Decoded data read ahead of the timer, about 1.4 s at 115200 baud */
+#define REPLAY_PREFETCH_SIZE    (16 * 1024)
+#define REPLAY_CHUNK_MAX        (CAPTURE_REC_MAX)
+#define REPLAY_READ_SIZE        (2048)
+/* Longest hex text line read, longer ones are skipped */
+#define REPLAY_LINE_MAX         (ULOG_TEXT_MAX(CAPTURE_REC_MAX))
+/* Time the reader gets to fill the prefetch buffer before the first chunk */
+#define REPLAY_PREFILL_US       (200 * 1000)
+/* Retry period while the reader is behind */
+#define REPLAY_UNDERRUN_US      (1000)
+/* Longest sleep while sent chunks wait for their TX record, the port
+ * ring must not lap the TX reader meanwhile */
+#define REPLAY_POLL_US          (50 * 1000)
+/* How long the end of the file waits for the last TX records */
+#define REPLAY_DRAIN_US         (1000 * 1000)
+/* Sent chunks waiting for their TX record, more are timed as one */
+#define REPLAY_SENT_MAX         (64)
+#define REPLAY_READER_PRIO      (3)
+
+/* A message with only a time stamp marks the end of a pass over the file */
+#define REPLAY_MARK_PASS        (0)
+#define REPLAY_MARK_END         (1)
+
+#define DAY_US                  (24LL * 60 * 60 * 1000000)
+
+typedef struct {
+    int64_t ts_us;
+    uint8_t data[REPLAY_CHUNK_MAX];
+} replay_chunk_t;
+
+typedef struct {
+    int64_t queued_us;          // handed to the port
+    int64_t due_us;
+    uint32_t left;              // bytes without a TX record yet
+    bool timed;
+} replay_sent_t;
+
+typedef struct {
+    replay_config_t config;
+    esp_timer_handle_t timer;
+    MessageBufferHandle_t mb;
+    atomic_bool stopping;
+    atomic_bool timer_busy;
+    atomic_bool reader_running;
+
+    /* reader task */
+    replay_chunk_t in;
+    uint32_t byte_ns;           // of the log being read, 0 if unknown
+    uint32_t pass_chunks;
+    int64_t text_day_us;        // text times are times of day, this counts midnights
+    int64_t text_last_us;
+    size_t line_len;
+    bool line_overflow;
+    char line[REPLAY_LINE_MAX];
+
+    /* timer callback */
+    replay_chunk_t out;
+    size_t out_len;
+    bool have_out;
+    bool rebase;                // the next chunk starts a pass
+    int64_t base_us;            // esp_timer time the pass started
+    int64_t t0_us;              // recording time the pass started
+    int64_t due_us;
+    int64_t finish_us;          // end of the file reached, 0 before
+    replay_sent_t sent[REPLAY_SENT_MAX];
+    uint32_t sent_head;
+    uint32_t sent_count;
+    uart_ring_reader_t tx_reader;
+    ulog_rec_hdr_t tx_hdr;
+    uint8_t tx_data[CAPTURE_REC_MAX];
+
+    volatile bool running;
+    volatile bool text;
+    portMUX_TYPE stats_lock;    // the 64 bit and double fields tear without it
+    uint32_t chunks;
+    uint32_t bytes;
+    uint32_t bytes_dropped;
+    uint32_t underruns;
+    uint32_t loops;
+    int64_t position_us;
+    uint32_t late_count;
+    int64_t late_max_us;
+    double late_sum;
+    double late_sq_sum;
+} replay_t;
+
+static replay_t *replay = NULL;
+static char base_path[ESP_VFS_PATH_MAX + 1];
+
+static metrics_hist_t lateness_metric;
+static metrics_counter_t bytes_metric;
+
+static void replay_metrics_init(void) {
+    metrics_hist_init(&lateness_metric, "replay_lateness_us",
+                      "Time a replayed chunk was sent after its recorded time", NULL, NULL);
+    metrics_counter_init(&bytes_metric, "replay_bytes_total", "Bytes replayed into a TX line", NULL, NULL);
+}
+
+/* Reader side */
+
+/* Hand a message to the timer, waiting while the prefetch buffer is full.
+ * False once the replay is stopping. */
+static bool queue_message(replay_t *r, size_t len) {
+    while (!atomic_load(&r->stopping)) {
+        if (xMessageBufferSend(r->mb, &r->in, len, pdMS_TO_TICKS(100)) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void queue_mark(replay_t *r, int64_t mark) {
+    r->in.ts_us = mark;
+    queue_message(r, sizeof(r->in.ts_us));
+}
+
+/* Queue received data in chunks the timer sends whole, later chunks of
+ * a long record are dated by the byte time */
+static void queue_data(replay_t *r, int64_t ts_us, const uint8_t *data, size_t len) {
+    for (size_t off = 0; off < len; off += REPLAY_CHUNK_MAX) {
+        size_t n = len - off < REPLAY_CHUNK_MAX ? len - off : REPLAY_CHUNK_MAX;
+        /* PASS and END marks are the times 0 and 1, keep data clear of them */
+        r->in.ts_us = max(ts_us + (int64_t) off * r->byte_ns / 1000, 2);
+        memcpy(r->in.data, data + off, n);
+        if (!queue_message(r, sizeof(r->in.ts_us) + n)) {
+            return;
+        }
+        r->pass_chunks++;
+    }
+}
+
+static void replay_record_cb(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr,
+                             const uint8_t *data) {
+    replay_t *r = ctx;
+    if ((hdr->flags & (ULOG_FLAG_TX | ULOG_FLAG_EVENT | ULOG_FLAG_FRAME)) != 0 || hdr->len == 0) {
+        return;
+    }
+    int port = ULOG_FLAG_PORT_OF(hdr->flags);
+    if (r->config.from_port != 0 && port != 0 && port != r->config.from_port) {
+        return;
+    }
+    r->byte_ns = hdr->aux != 0 ? hdr->aux : file->baud_rate != 0 ? 10000000000ULL / file->baud_rate : 0;
+    queue_data(r, hdr->ts_us, data, hdr->len);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* "HH:MM:SS.mmm: [uN] xx xx ..", as written by ulog_format_text() and
+ * without the space after the time by the old text logger. Lines marked
+ * TX, FRAME or with an event are not received data and are skipped. */
+static void text_line(replay_t *r) {
+    int h, m, s, ms, n = 0;
+    r->line[r->line_len] = '\0';
+    if (sscanf(r->line, "%2d:%2d:%2d.%3d:%n", &h, &m, &s, &ms, &n) != 4 || n == 0) {
+        return;
+    }
+    int64_t ts_us = ((((int64_t) h * 60 + m) * 60 + s) * 1000 + ms) * 1000;
+    if (ts_us + DAY_US / 2 < r->text_last_us) {
+        r->text_day_us += DAY_US;
+    }
+    r->text_last_us = ts_us;
+
+    /* the bytes are decoded in place, each takes at least 2 characters */
+    uint8_t *data = (uint8_t *) r->line;
+    size_t len = 0;
+    int port = 0;
+    for (char *p = r->line + n; *p != '\0';) {
+        while (*p == ' ') {
+            p++;
+        }
+        char *tok = p;
+        while (*p != ' ' && *p != '\0') {
+            p++;
+        }
+        int hi, lo;
+        if (p - tok == 2 && (hi = hex_value(tok[0])) >= 0 && (lo = hex_value(tok[1])) >= 0) {
+            data[len++] = (uint8_t) (hi << 4 | lo);
+        } else if (p - tok == 2 && tok[0] == 'u' && tok[1] >= '0' && tok[1] <= '9') {
+            port = tok[1] - '0';
+        } else if (p != tok) {
+            return;
+        }
+    }
+    if (len > 0 && (r->config.from_port == 0 || port == 0 || port == r->config.from_port)) {
+        queue_data(r, r->text_day_us + ts_us, data, len);
+    }
+}
+
+static void text_feed(replay_t *r, const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = (char) buf[i];
+        if (c == '\n' || c == '\r') {
+            if (!r->line_overflow && r->line_len > 0) {
+                text_line(r);
+            }
+            r->line_len = 0;
+            r->line_overflow = false;
+        } else if (r->line_len < sizeof(r->line) - 1) {
+            r->line[r->line_len++] = c;
+        } else {
+            r->line_overflow = true;
+        }
+    }
+}
+
+static void replay_reader_task(void *args) {
+    replay_t *r = args;
+    uint8_t *buf = malloc(REPLAY_READ_SIZE);
+    ulog_decoder_t *dec = malloc(sizeof(ulog_decoder_t));
+    if (buf == NULL || dec == NULL) {
+        ESP_LOGE(TAG, "Out of memory");
+    }
+
+    while (buf != NULL && dec != NULL && !atomic_load(&r->stopping)) {
+        FILE *f = fopen(r->config.path, "rb");
+        if (f == NULL) {
+            ESP_LOGE(TAG, "Failed to open %s", r->config.path);
+            break;
+        }
+        ulog_decoder_init(dec);
+        r->byte_ns = 0;
+        r->pass_chunks = 0;
+        r->text_day_us = 0;
+        r->text_last_us = 0;
+        r->line_len = 0;
+        r->line_overflow = false;
+
+        size_t n;
+        bool first = true;
+        while (!atomic_load(&r->stopping) && (n = fread(buf, 1, REPLAY_READ_SIZE, f)) > 0) {
+            if (first) {
+                r->text = n < sizeof(ulog_file_hdr_t) || memcmp(buf, ULOG_MAGIC, strlen(ULOG_MAGIC)) != 0;
+                first = false;
+            }
+            if (r->text) {
+                text_feed(r, buf, n);
+            } else {
+                ulog_decode(dec, buf, n, replay_record_cb, r);
+            }
+        }
+        if (r->text && !r->line_overflow && r->line_len > 0) {
+            text_line(r);
+        }
+        fclose(f);
+
+        if (r->pass_chunks == 0) {
+            ESP_LOGW(TAG, "No received data in %s", r->config.path);
+            break;
+        }
+        if (!r->config.loop) {
+            break;
+        }
+        queue_mark(r, REPLAY_MARK_PASS);
+    }
+    queue_mark(r, REPLAY_MARK_END);
+
+    free(dec);
+    free(buf);
+    atomic_store(&r->reader_running, false);
+    vTaskDelete(NULL);
+}
+
+/* Timer side */
+
+static void replay_late(replay_t *r, int64_t late) {
+    portENTER_CRITICAL(&r->stats_lock);
+    r->late_count++;
+    r->late_sum += (double) late;
+    r->late_sq_sum += (double) late * (double) late;
+    if (late > r->late_max_us) {
+        r->late_max_us = late;
+    }
+    portEXIT_CRITICAL(&r->stats_lock);
+    metrics_hist_observe(&lateness_metric, (uint32_t) min(late, (int64_t) UINT32_MAX));
+}
+
+/* A chunk goes out when the TX task hands it to the driver, which the
+ * port publishes as a TX record; the TX queue in front of it can hold the
+ * chunk back well past the send. Records are matched to the sent chunks
+ * in order by length, so data other writers put on the port meanwhile
+ * is counted to the chunks. */
+static void replay_poll_tx(replay_t *r) {
+    uart_ring_t *ring = capture_port_ring(r->config.port);
+    if (r->sent_count == 0) {
+        /* nothing to match, skip what the port published */
+        uart_ring_reader_attach(ring, &r->tx_reader);
+        return;
+    }
+    while (r->sent_count > 0 && uart_ring_readable(ring, &r->tx_reader) >= sizeof(ulog_rec_hdr_t)) {
+        uart_ring_read(ring, &r->tx_reader, (uint8_t *) &r->tx_hdr, sizeof(r->tx_hdr));
+        if (r->tx_reader.overrun_count > 0 || r->tx_hdr.sync != ULOG_REC_SYNC || r->tx_hdr.len > CAPTURE_REC_MAX
+            || uart_ring_read(ring, &r->tx_reader, r->tx_data, r->tx_hdr.len) != r->tx_hdr.len
+            || r->tx_reader.overrun_count > 0) {
+            /* which chunk the next record belongs to is lost, those in
+             * flight stay untimed */
+            uart_ring_reader_attach(ring, &r->tx_reader);
+            r->sent_count = 0;
+            return;
+        }
+        replay_sent_t *sent = &r->sent[r->sent_head];
+        if (!(r->tx_hdr.flags & ULOG_FLAG_TX) || r->tx_hdr.ts_us < sent->queued_us) {
+            continue;
+        }
+        if (!sent->timed) {
+            sent->timed = true;
+            replay_late(r, r->tx_hdr.ts_us - sent->due_us);
+        }
+        sent->left -= min(sent->left, (uint32_t) r->tx_hdr.len);
+        if (sent->left == 0) {
+            r->sent_head = (r->sent_head + 1) % REPLAY_SENT_MAX;
+            r->sent_count--;
+        }
+    }
+}
+
+static void replay_send(replay_t *r, int64_t now) {
+    size_t n = capture_port_write(r->config.port, r->out.data, r->out_len);
+    if (n > 0 && r->sent_count < REPLAY_SENT_MAX) {
+        replay_sent_t *sent = &r->sent[(r->sent_head + r->sent_count++) % REPLAY_SENT_MAX];
+        sent->queued_us = now;
+        sent->due_us = r->due_us;
+        sent->left = n;
+        sent->timed = false;
+    } else if (n > 0) {
+        /* goes out after the last one tracked, timed with it */
+        r->sent[(r->sent_head + r->sent_count - 1) % REPLAY_SENT_MAX].left += n;
+    }
+    portENTER_CRITICAL(&r->stats_lock);
+    r->chunks++;
+    r->bytes += n;
+    r->bytes_dropped += r->out_len - n;
+    r->position_us = r->out.ts_us - r->t0_us;
+    portEXIT_CRITICAL(&r->stats_lock);
+    metrics_counter_add(&bytes_metric, n);
+}
+
+/* Sleep until delay_us from now, shorter while TX records are expected */
+static void replay_arm(replay_t *r, int64_t delay_us) {
+    replay_poll_tx(r);
+    if (r->sent_count > 0) {
+        delay_us = min(delay_us, (int64_t) REPLAY_POLL_US);
+    }
+    esp_timer_start_once(r->timer, delay_us);
+}
+
+static void replay_finish(replay_t *r) {
+    r->running = false;
+    replay_stats_t stats;
+    replay_get_stats(&stats);
+    ESP_LOGI(TAG, "%s done: %" PRIu32 " chunks, %" PRIu32 " bytes, %" PRIu32 " dropped, %" PRIu32 " underruns, "
+                  "late mean %" PRId64 " us max %" PRId64 " us jitter %" PRId64 " us",
+             r->config.path, stats.chunks, stats.bytes, stats.bytes_dropped, stats.underruns, stats.late_mean_us,
+             stats.late_max_us, stats.jitter_us);
+}
+
+/* Send everything due, then sleep until the next chunk is */
+static void replay_step(replay_t *r) {
+    while (r->finish_us == 0) {
+        if (r->have_out) {
+            int64_t now = esp_timer_get_time();
+            if (r->due_us > now) {
+                replay_arm(r, r->due_us - now);
+                return;
+            }
+            replay_send(r, now);
+            r->have_out = false;
+        }
+
+        size_t len = xMessageBufferReceive(r->mb, &r->out, sizeof(r->out), 0);
+        if (len == 0) {
+            /* only counted once playing, the first chunk may take a while */
+            if (!r->rebase) {
+                portENTER_CRITICAL(&r->stats_lock);
+                r->underruns++;
+                portEXIT_CRITICAL(&r->stats_lock);
+            }
+            replay_arm(r, REPLAY_UNDERRUN_US);
+            return;
+        }
+        if (len == sizeof(r->out.ts_us)) {
+            if (r->out.ts_us == REPLAY_MARK_END) {
+                r->finish_us = esp_timer_get_time() + REPLAY_DRAIN_US;
+                continue;
+            }
+            r->rebase = true;
+            portENTER_CRITICAL(&r->stats_lock);
+            r->loops++;
+            portEXIT_CRITICAL(&r->stats_lock);
+            continue;
+        }
+        r->out_len = len - sizeof(r->out.ts_us);
+        if (r->rebase) {
+            r->rebase = false;
+            r->t0_us = r->out.ts_us;
+            r->base_us = esp_timer_get_time();
+        }
+        r->due_us = r->base_us + (int64_t) ((r->out.ts_us - r->t0_us) / r->config.speed);
+        r->have_out = true;
+    }
+
+    /* the last chunks are timed once their TX records are in */
+    replay_poll_tx(r);
+    if (r->sent_count > 0 && esp_timer_get_time() < r->finish_us) {
+        esp_timer_start_once(r->timer, REPLAY_POLL_US);
+        return;
+    }
+    replay_finish(r);
+}
+
+static void replay_timer_cb(void *arg) {
+    replay_t *r = arg;
+    atomic_store(&r->timer_busy, true);
+    if (!atomic_load(&r->stopping)) {
+        replay_step(r);
+    }
+    atomic_store(&r->timer_busy, false);
+}
+
+/* Control */
+
+void replay_stop(void) {
+    replay_t *r = replay;
+    if (r == NULL || r->mb == NULL) {
+        return;
+    }
+    /* Once stopping is seen the callback neither sends nor re-arms, one
+     * already past that check is waited for before the timer is stopped */
+    atomic_store(&r->stopping, true);
+    while (atomic_load(&r->timer_busy)) {
+        vTaskDelay(1);
+    }
+    esp_timer_stop(r->timer);
+    while (atomic_load(&r->timer_busy) || atomic_load(&r->reader_running)) {
+        vTaskDelay(1);
+    }
+    vMessageBufferDelete(r->mb);
+    r->mb = NULL;
+    if (r->running) {
+        r->running = false;
+        ESP_LOGI(TAG, "%s stopped", r->config.path);
+    }
+}
+
+esp_err_t replay_start(const replay_config_t *config) {
+    if (!capture_port_valid(config->port) || !(config->speed > 0)
+        || (config->from_port != 0 && !capture_port_valid(config->from_port))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!capture_port_running(config->port)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    struct stat st;
+    if (stat(config->path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    replay_stop();
+    if (replay == NULL) {
+        replay_t *r = calloc(1, sizeof(replay_t));
+        if (r == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        portMUX_INITIALIZE(&r->stats_lock);
+        const esp_timer_create_args_t args = {
+                .callback = replay_timer_cb,
+                .arg = r,
+                .name = "replay",
+        };
+        if (esp_timer_create(&args, &r->timer) != ESP_OK) {
+            free(r);
+            return ESP_ERR_NO_MEM;
+        }
+        replay_metrics_init();
+        replay = r;
+    }
+
+    replay_t *r = replay;
+    r->config = *config;
+    r->mb = xMessageBufferCreate(REPLAY_PREFETCH_SIZE);
+    if (r->mb == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    r->have_out = false;
+    r->rebase = true;
+    r->finish_us = 0;
+    r->sent_head = 0;
+    r->sent_count = 0;
+    r->text = false;
+    r->chunks = 0;
+    r->bytes = 0;
+    r->bytes_dropped = 0;
+    r->underruns = 0;
+    r->loops = 0;
+    r->position_us = 0;
+    r->late_count = 0;
+    r->late_max_us = 0;
+    r->late_sum = 0;
+    r->late_sq_sum = 0;
+    atomic_store(&r->stopping, false);
+    atomic_store(&r->reader_running, true);
+    r->running = true;
+
+    if (xTaskCreate(replay_reader_task, "replay_reader", 4096, r, REPLAY_READER_PRIO, NULL) != pdPASS) {
+        atomic_store(&r->reader_running, false);
+        replay_stop();
+        return ESP_ERR_NO_MEM;
+    }
+    uart_ring_reader_attach(capture_port_ring(config->port), &r->tx_reader);
+    esp_timer_start_once(r->timer, REPLAY_PREFILL_US);
+    ESP_LOGI(TAG, "Replaying %s on uart%d at %.2fx%s", config->path, config->port, config->speed,
+             config->loop ? ", looped" : "");
+    return ESP_OK;
+}
+
+void replay_get_stats(replay_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    replay_t *r = replay;
+    if (r == NULL) {
+        return;
+    }
+    stats->running = r->running;
+    stats->text = r->text;
+    portENTER_CRITICAL(&r->stats_lock);
+    stats->chunks = r->chunks;
+    stats->bytes = r->bytes;
+    stats->bytes_dropped = r->bytes_dropped;
+    stats->underruns = r->underruns;
+    stats->loops = r->loops;
+    stats->position_us = r->position_us;
+    uint32_t late_count = r->late_count;
+    stats->late_max_us = r->late_max_us;
+    double late_sum = r->late_sum;
+    double late_sq_sum = r->late_sq_sum;
+    portEXIT_CRITICAL(&r->stats_lock);
+    if (late_count > 0) {
+        double mean = late_sum / late_count;
+        double var = late_sq_sum / late_count - mean * mean;
+        stats->late_mean_us = (int64_t) mean;
+        stats->jitter_us = var > 0 ? (int64_t) sqrt(var) : 0;
+    }
+}
+
+/* HTTP */
+
+static int query_int(const char *query, const char *key, int def) {
+    char param[16];
+    return httpd_query_key_value(query, key, param, sizeof(param)) == ESP_OK ? atoi(param) : def;
+}
+
+static esp_err_t replay_handler(httpd_req_t *req) {
+    char query[160] = "";
+    char name[REPLAY_PATH_MAX];
+    char param[16];
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+
+    if (query_int(query, "stop", 0) != 0) {
+        replay_stop();
+    } else if (httpd_query_key_value(query, "file", name, sizeof(name)) == ESP_OK) {
+        replay_config_t config = {
+                .port = query_int(query, "port", CAPTURE_PORT_FIRST),
+                .speed = 1,
+                .from_port = query_int(query, "from", 0),
+                .loop = query_int(query, "loop", 0) != 0,
+        };
+        if (httpd_query_key_value(query, "speed", param, sizeof(param)) == ESP_OK) {
+            config.speed = strtof(param, NULL);
+        }
+        if (strchr(name, '/') != NULL
+            || snprintf(config.path, sizeof(config.path), "%s/%s", base_path, name) >= sizeof(config.path)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+            return ESP_OK;
+        }
+
+        esp_err_t err = replay_start(&config);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid port or speed");
+            return ESP_OK;
+        }
+        if (err == ESP_ERR_INVALID_STATE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Port is not capturing, start it with /uartconfig");
+            return ESP_OK;
+        }
+        if (err == ESP_ERR_NOT_FOUND) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+            return ESP_OK;
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start replay");
+            return ESP_OK;
+        }
+    }
+
+    replay_stats_t stats;
+    replay_get_stats(&stats);
+    char json_response[384];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
+    resp_writer_printf(&w, "{\"running\":%s", stats.running ? "true" : "false");
+    if (replay != NULL) {
+        resp_writer_str(&w, ",\"file\":");
+        resp_writer_json_str(&w, replay->config.path + strlen(base_path) + 1);
+        resp_writer_printf(&w, ",\"port\":%d,\"speed\":%.2f,\"loop\":%s,\"text\":%s",
+                           replay->config.port, replay->config.speed, replay->config.loop ? "true" : "false",
+                           stats.text ? "true" : "false");
+    }
+    resp_writer_printf(&w, ",\"chunks\":%" PRIu32 ",\"bytes\":%" PRIu32 ",\"bytes_dropped\":%" PRIu32 ","
+                           "\"underruns\":%" PRIu32 ",\"loops\":%" PRIu32 ",\"position_ms\":%" PRId64 ","
+                           "\"late_us\":{\"mean\":%" PRId64 ",\"max\":%" PRId64 ",\"jitter\":%" PRId64 "}}",
+                       stats.chunks, stats.bytes, stats.bytes_dropped, stats.underruns, stats.loops,
+                       stats.position_us / 1000, stats.late_mean_us, stats.late_max_us, stats.jitter_us);
+
+    httpd_resp_set_type(req, "application/json");
+    return resp_writer_finish(&w);
+}
+
+esp_err_t register_replay_handler(const char *path, httpd_handle_t server) {
+    strlcpy(base_path, path, sizeof(base_path));
+
+    httpd_uri_t replay_uri = {
+            .uri       = "/replay",
+            .method    = HTTP_GET,
+            .handler   = replay_handler,
+            .user_ctx  = NULL
+    };
+    return httpd_register_uri_handler(server, &replay_uri);
+}
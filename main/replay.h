@@ -0,0 +1,64 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/*
+ * Replay of a capture log into a port's TX line.
+ *
+ * The received data of a .ulg log, or of a hex text log, is sent on a
+ * capturing port at its recorded times, or speed times faster. A reader
+ * task decodes the file ahead into a prefetch buffer, so flash latency
+ * only shows once the buffer runs dry; a one shot esp_timer sends each
+ * chunk when it is due. How late every chunk went out against the
+ * recording, taken from the TX record the port logs when the driver
+ * took it, is kept and published as the replay_lateness_us histogram.
+ *
+ * GET /replay?file=<name>[&port=1][&speed=1][&from=<port>][&loop=1]
+ * starts, /replay?stop=1 stops, /replay alone reports the progress.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPLAY_PATH_MAX     (64)
+
+typedef struct {
+    char path[REPLAY_PATH_MAX];
+    int port;               // port the data is sent on, must be capturing
+    float speed;            // 2 plays twice as fast
+    int from_port;          // only data received on this port, 0 for all
+    bool loop;              // start over at the end
+} replay_config_t;
+
+typedef struct {
+    bool running;
+    bool text;              // the log is hex text, times have ms resolution
+    uint32_t chunks;        // chunks sent
+    uint32_t bytes;
+    uint32_t bytes_dropped; // did not fit the port's TX queue
+    uint32_t underruns;     // a chunk was due but not read from the file yet
+    uint32_t loops;
+    int64_t position_us;    // recording time of the last chunk sent, from its start
+    int64_t late_mean_us;   // written to the driver after the recorded time, scaled by speed
+    int64_t late_max_us;
+    int64_t jitter_us;      // standard deviation of the lateness
+} replay_stats_t;
+
+esp_err_t replay_start(const replay_config_t *config);
+
+void replay_stop(void);
+
+void replay_get_stats(replay_stats_t *stats);
+
+esp_err_t register_replay_handler(const char *base_path, httpd_handle_t server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //REPLAY_H
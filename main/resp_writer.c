@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "resp_writer.h"
+
+static const char *TAG = "resp_writer";
+
+void resp_writer_init(resp_writer_t *w, httpd_req_t *req, char *buf, size_t size) {
+    w->req = req;
+    w->buf = buf;
+    w->size = size;
+    w->fill = 0;
+    w->chunks = 0;
+    w->err = ESP_OK;
+}
+
+static void resp_writer_flush(resp_writer_t *w) {
+    if (w->err == ESP_OK && w->fill > 0) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->fill);
+        w->chunks++;
+    }
+    w->fill = 0;
+}
+
+void resp_writer_write(resp_writer_t *w, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        if (w->fill == w->size) {
+            resp_writer_flush(w);
+        }
+        size_t n = MIN(len, w->size - w->fill);
+        memcpy(w->buf + w->fill, p, n);
+        w->fill += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void resp_writer_str(resp_writer_t *w, const char *str) {
+    resp_writer_write(w, str, strlen(str));
+}
+
+void resp_writer_int(resp_writer_t *w, int64_t value) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    uint64_t v = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    do {
+        *--p = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    resp_writer_write(w, p, digits + sizeof(digits) - p);
+}
+
+void resp_writer_printf(resp_writer_t *w, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buf + w->fill, w->size - w->fill, fmt, args);
+    va_end(args);
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t) n < w->size - w->fill) {
+        w->fill += n;
+        return;
+    }
+    if ((size_t) n < w->size) {
+        /* did not fit, retry in an empty buffer */
+        resp_writer_flush(w);
+        va_start(args, fmt);
+        vsnprintf(w->buf, w->size, fmt, args);
+        va_end(args);
+        w->fill = n;
+        return;
+    }
+    /* longer than the whole buffer, format it aside and send it in pieces */
+    char *text = malloc((size_t) n + 1);
+    if (text == NULL) {
+        ESP_LOGE(TAG, "No memory to format %d bytes of response", n);
+        if (w->err == ESP_OK) {
+            w->err = ESP_ERR_NO_MEM;
+        }
+        return;
+    }
+    va_start(args, fmt);
+    vsnprintf(text, (size_t) n + 1, fmt, args);
+    va_end(args);
+    resp_writer_write(w, text, n);
+    free(text);
+}
+
+void resp_writer_json_str(resp_writer_t *w, const char *str) {
+    const char *run = str;
+    resp_writer_write(w, "\"", 1);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            resp_writer_write(w, run, str - run);
+            run = str + 1;
+            if (c < 0x20) {
+                resp_writer_printf(w, "\\u%04x", c);
+            } else {
+                char esc[2] = {'\\', (char) c};
+                resp_writer_write(w, esc, sizeof(esc));
+            }
+        }
+    }
+    resp_writer_write(w, run, str - run);
+    resp_writer_write(w, "\"", 1);
+}
+
+void resp_writer_html(resp_writer_t *w, const char *str) {
+    const char *run = str;
+    for (; *str; str++) {
+        const char *entity;
+        switch (*str) {
+            case '<':
+                entity = "&lt;";
+                break;
+            case '>':
+                entity = "&gt;";
+                break;
+            case '&':
+                entity = "&amp;";
+                break;
+            case '"':
+                entity = "&quot;";
+                break;
+            default:
+                continue;
+        }
+        resp_writer_write(w, run, str - run);
+        resp_writer_str(w, entity);
+        run = str + 1;
+    }
+    resp_writer_write(w, run, str - run);
+}
+
+char *resp_writer_reserve(resp_writer_t *w, size_t len) {
+    if (w->fill + len > w->size) {
+        resp_writer_flush(w);
+    }
+    return w->buf + w->fill;
+}
+
+void resp_writer_commit(resp_writer_t *w, size_t len) {
+    w->fill += len;
+}
+
+esp_err_t resp_writer_finish(resp_writer_t *w) {
+    if (w->err == ESP_OK && w->chunks == 0) {
+        /* everything fit, one plain response with a Content-Length */
+        w->err = httpd_resp_send(w->req, w->buf, w->fill);
+        return w->err;
+    }
+    resp_writer_flush(w);
+    if (w->err != ESP_OK) {
+        httpd_resp_sendstr_chunk(w->req, NULL);
+        return w->err;
+    }
+    return httpd_resp_send_chunk(w->req, NULL, 0);
+}
@@ -0,0 +1,70 @@
+#ifndef RESP_WRITER_H
+#define RESP_WRITER_H
+
+/*
+ * Buffered HTTP response builder.
+ *
+ * Handlers append small pieces, the writer sends them as one chunk each
+ * time its buffer fills up. A response that fits the buffer completely
+ * goes out with httpd_resp_send and a Content-Length instead. Use a
+ * buffer of at least RESP_WRITER_MSS bytes so every chunk fills whole
+ * TCP segments. The buffer belongs to the caller, so a writer on the
+ * stack is reentrant.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESP_WRITER_MSS CONFIG_LWIP_TCP_MSS
+
+typedef struct {
+    httpd_req_t *req;
+    char *buf;
+    size_t size;
+    size_t fill;
+    uint32_t chunks;        // chunks sent so far
+    esp_err_t err;          // first send error, later appends are dropped
+} resp_writer_t;
+
+void resp_writer_init(resp_writer_t *w, httpd_req_t *req, char *buf, size_t size);
+
+void resp_writer_write(resp_writer_t *w, const void *data, size_t len);
+
+void resp_writer_str(resp_writer_t *w, const char *str);
+
+void resp_writer_int(resp_writer_t *w, int64_t value);
+
+/* Output longer than the buffer is formatted on the heap and sent in
+ * pieces. Without the memory for it the response fails with
+ * ESP_ERR_NO_MEM. */
+void resp_writer_printf(resp_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Quoted JSON string */
+void resp_writer_json_str(resp_writer_t *w, const char *str);
+
+/* Text or attribute value with the HTML special characters escaped */
+void resp_writer_html(resp_writer_t *w, const char *str);
+
+/* Room for len bytes to format in place, len must not exceed the buffer
+ * size. Follow with resp_writer_commit of the bytes actually used. */
+char *resp_writer_reserve(resp_writer_t *w, size_t len);
+
+void resp_writer_commit(resp_writer_t *w, size_t len);
+
+/* Send whatever is buffered and complete the response. On an earlier
+ * send error the chunked response is aborted and the error returned. */
+esp_err_t resp_writer_finish(resp_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RESP_WRITER_H
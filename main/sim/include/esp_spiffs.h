@@ -0,0 +1,11 @@
+#ifndef SIM_ESP_SPIFFS_H
+#define SIM_ESP_SPIFFS_H
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/* Size of the storage directory, see sim_storage.c */
+esp_err_t esp_spiffs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes);
+
+#endif //SIM_ESP_SPIFFS_H
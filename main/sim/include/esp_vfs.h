@@ -0,0 +1,10 @@
+#ifndef SIM_ESP_VFS_H
+#define SIM_ESP_VFS_H
+
+/* The file store is a host directory, only the path limit is kept so
+ * names fit the same buffers as on the device */
+#ifndef ESP_VFS_PATH_MAX
+#define ESP_VFS_PATH_MAX (15)
+#endif
+
+#endif //SIM_ESP_VFS_H
@@ -0,0 +1,25 @@
+#ifndef SIM_CONFIG_H
+#define SIM_CONFIG_H
+
+/*
+ * Included ahead of every source of the linux build. Supplies the settings
+ * of components the linux target does not build and keeps the file store
+ * in a directory below the working directory.
+ */
+
+#include "sdkconfig.h"
+
+#ifndef CONFIG_SPIFFS_OBJ_NAME_LEN
+#define CONFIG_SPIFFS_OBJ_NAME_LEN  (32)
+#endif
+
+#ifndef CONFIG_SPIFFS_PAGE_SIZE
+#define CONFIG_SPIFFS_PAGE_SIZE     (256)
+#endif
+
+#define FILE_SERVER_BASE_PATH       "data"
+
+/* Port 80 needs privileges on the host */
+#define SIM_HTTP_PORT               (8080)
+
+#endif //SIM_CONFIG_H
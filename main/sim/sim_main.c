@@ -0,0 +1,19 @@
+/*
+ * Entry point of the linux target: no wifi, the http server starts right
+ * away on SIM_HTTP_PORT. Received uart data comes from the sources set up
+ * in sim_uart.c.
+ */
+
+#include <esp_log.h>
+
+#include "bike_common.h"
+#include "my_http_server.h"
+
+static const char *TAG = "sim";
+
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Simulation, http on port %d", SIM_HTTP_PORT);
+    common_init_nvs();
+    my_http_server_start();
+}
@@ -0,0 +1,67 @@
+/*
+ * File store of the linux target: a directory below the working directory
+ * in place of the SPIFFS partition. Its size is SIM_STORAGE_SIZE bytes,
+ * by default that of the partition, so the logger rotates and uploads are
+ * refused at the same fill level as on the device.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_vfs.h"
+#include "my_file_server_common.h"
+
+static const char *TAG = "sim_storage";
+
+#define SIM_STORAGE_SIZE_DEFAULT (1600 * 1024)  // storage partition in partitions_singleapp.csv
+
+static char storage_path[ESP_VFS_PATH_MAX + 1];
+static size_t storage_size;
+
+esp_err_t mount_storage(const char *base_path, bool format_when_failed) {
+    if (mkdir(base_path, 0755) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Cannot create %s: %s", base_path, strerror(errno));
+        return ESP_FAIL;
+    }
+    const char *size = getenv("SIM_STORAGE_SIZE");
+    storage_size = size != NULL ? strtoul(size, NULL, 0) : SIM_STORAGE_SIZE_DEFAULT;
+    strlcpy(storage_path, base_path, sizeof(storage_path));
+    ESP_LOGI(TAG, "Storage in ./%s, %u KB", storage_path, (unsigned) (storage_size / 1024));
+    return ESP_OK;
+}
+
+esp_err_t unmount_storage() {
+    storage_path[0] = '\0';
+    return ESP_OK;
+}
+
+/* Files take whole pages as they would on SPIFFS */
+esp_err_t esp_spiffs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes) {
+    if (storage_path[0] == '\0') {
+        return ESP_ERR_INVALID_STATE;
+    }
+    DIR *dir = opendir(storage_path);
+    if (dir == NULL) {
+        return ESP_FAIL;
+    }
+    size_t used = 0;
+    char path[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN + 2];
+    struct dirent *entry;
+    struct stat st;
+    while ((entry = readdir(dir)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", storage_path, entry->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            used += (st.st_size + CONFIG_SPIFFS_PAGE_SIZE - 1) / CONFIG_SPIFFS_PAGE_SIZE * CONFIG_SPIFFS_PAGE_SIZE;
+        }
+    }
+    closedir(dir);
+    *total_bytes = storage_size;
+    *used_bytes = used;
+    return ESP_OK;
+}
@@ -0,0 +1,634 @@
+/*
+ * uart driver for the linux target. Each port gets its received bytes from
+ * the source named by the SIM_UART<n> environment variable:
+ *
+ *   pty                         a pseudo terminal, its path is logged on install
+ *   loop                        what is written to the port is received again
+ *   file:<path>[:fast][:repeat] a recorded .ulg log, its received data records
+ *                               are played back at their recorded time and byte
+ *                               rate; any other file is sent as is at the baud
+ *                               rate. fast feeds as fast as the reader takes it,
+ *                               repeat starts over at the end.
+ *
+ * A feeder thread writes the bytes into the rx buffer, a task standing in for
+ * the uart interrupt posts the driver events: UART_DATA when rx_full bytes
+ * are buffered or the line was idle for the rx timeout, UART_PATTERN_DET and
+ * UART_BUFFER_FULL when paced input found the buffer full.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // posix_openpt() and friends
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+
+#include "ulog_format.h"
+
+static const char *TAG = "sim_uart";
+
+#define SIM_PATTERN_QUEUE   (32)
+#define SIM_SLICE_US        (1000)      // paced input arrives in slices of this much line time
+#define SIM_RX_FULL_DEFAULT (120)       // UART_FULL_THRESH_DEFAULT of the real driver
+#define SIM_RX_TOUT_DEFAULT (10)        // symbol times
+#define SIM_SYMBOL_BITS     (10)
+#define SIM_ISR_STACK       (4096)
+
+typedef enum {
+    SIM_SRC_NONE,
+    SIM_SRC_PTY,
+    SIM_SRC_LOOP,
+    SIM_SRC_FILE,
+} sim_src_t;
+
+/* A run of received bytes in the trace */
+typedef struct {
+    int64_t ts_us;
+    uint32_t byte_ns;       // 0 for the port's baud rate
+    uint32_t offset;
+    uint32_t len;
+} sim_chunk_t;
+
+typedef struct {
+    bool installed;
+    uart_port_t num;
+    QueueHandle_t event_q;
+    TaskHandle_t isr_hdl;
+
+    /* rx buffer, written by one producer (the feeder, or the writer in
+     * loop mode) and read by the driver user */
+    uint8_t *fifo;
+    uint32_t fifo_size;
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic int64_t last_rx_us;
+    atomic_bool overflow;
+    uint32_t seen_head;     // isr task: received bytes already reported
+
+    /* rx stream offsets of detected patterns */
+    atomic_int pattern_num;
+    _Atomic char pattern_chr;
+    int pattern_run;
+    uint32_t pattern_pos[SIM_PATTERN_QUEUE];
+    _Atomic uint32_t pat_head;
+    _Atomic uint32_t pat_tail;
+    uint32_t seen_pat_head;
+
+    _Atomic uint32_t byte_ns;
+    atomic_int rx_full;
+    atomic_int rx_tout;
+
+    sim_src_t src;
+    bool fast;
+    bool repeat;
+    int pty_fd;
+    int pty_slave_fd;
+    uint8_t *trace;
+    sim_chunk_t *chunks;
+    size_t chunk_count;
+    pthread_t feeder;
+    bool feeder_running;
+    atomic_bool stop;
+} sim_uart_t;
+
+static sim_uart_t sim_uarts[UART_NUM_MAX];
+
+static int64_t sim_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sim_sleep_until(int64_t us) {
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static sim_uart_t *sim_uart_get(uart_port_t num) {
+    if (num < 0 || num >= UART_NUM_MAX || !sim_uarts[num].installed) {
+        return NULL;
+    }
+    return &sim_uarts[num];
+}
+
+static void pattern_scan(sim_uart_t *u, const uint8_t *data, size_t len, uint32_t pos) {
+    int num = atomic_load_explicit(&u->pattern_num, memory_order_relaxed);
+    if (num <= 0) {
+        return;
+    }
+    char chr = atomic_load_explicit(&u->pattern_chr, memory_order_relaxed);
+    for (size_t i = 0; i < len; i++) {
+        if ((char) data[i] != chr) {
+            u->pattern_run = 0;
+            continue;
+        }
+        if (++u->pattern_run < num) {
+            continue;
+        }
+        u->pattern_run = 0;
+        uint32_t head = atomic_load_explicit(&u->pat_head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&u->pat_tail, memory_order_acquire) < SIM_PATTERN_QUEUE) {
+            u->pattern_pos[head % SIM_PATTERN_QUEUE] = pos + i + 1 - num;
+            atomic_store_explicit(&u->pat_head, head + 1, memory_order_release);
+        }
+    }
+}
+
+/* Append received bytes, waiting for room if wait is set and dropping
+ * what does not fit otherwise. Returns the bytes taken. */
+static size_t fifo_push(sim_uart_t *u, const uint8_t *data, size_t len, bool wait) {
+    size_t done = 0;
+    while (done < len && !atomic_load_explicit(&u->stop, memory_order_relaxed)) {
+        uint32_t head = atomic_load_explicit(&u->head, memory_order_relaxed);
+        uint32_t space = u->fifo_size - (head - atomic_load_explicit(&u->tail, memory_order_acquire));
+        if (space == 0) {
+            if (!wait) {
+                break;
+            }
+            usleep(100);
+            continue;
+        }
+        size_t n = len - done < space ? len - done : space;
+        for (size_t i = 0; i < n; i++) {
+            u->fifo[(head + i) % u->fifo_size] = data[done + i];
+        }
+        pattern_scan(u, data + done, n, head);
+        atomic_store_explicit(&u->head, head + n, memory_order_release);
+        done += n;
+    }
+    if (done > 0) {
+        atomic_store_explicit(&u->last_rx_us, sim_now_us(), memory_order_relaxed);
+    }
+    if (done < len) {
+        atomic_store_explicit(&u->overflow, true, memory_order_relaxed);
+    }
+    return done;
+}
+
+static void feed_pty(sim_uart_t *u) {
+    uint8_t buf[256];
+    while (!atomic_load(&u->stop)) {
+        struct pollfd pfd = {.fd = u->pty_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        ssize_t n = read(u->pty_fd, buf, sizeof(buf));
+        if (n > 0) {
+            fifo_push(u, buf, n, false);
+        }
+    }
+}
+
+/* Feed a slice of line time at a time, each byte becomes readable once
+ * it has been fully received. byte_ns 0 follows the port's baud rate. */
+static void feed_paced(sim_uart_t *u, const uint8_t *data, size_t len, uint32_t byte_ns, int64_t at_us) {
+    int64_t next_us = at_us;
+    size_t n;
+    for (size_t off = 0; off < len && !atomic_load(&u->stop); off += n) {
+        uint32_t ns = byte_ns != 0 ? byte_ns : atomic_load(&u->byte_ns);
+        n = (size_t) SIM_SLICE_US * 1000 / ns;
+        n = n == 0 ? 1 : n > len - off ? len - off : n;
+        next_us += (int64_t) n * ns / 1000;
+        sim_sleep_until(next_us);
+        fifo_push(u, data + off, n, false);
+    }
+}
+
+static void feed_trace(sim_uart_t *u) {
+    int64_t t0 = u->chunks[0].ts_us;
+    do {
+        int64_t start_us = sim_now_us();
+        for (size_t i = 0; i < u->chunk_count && !atomic_load(&u->stop); i++) {
+            const sim_chunk_t *c = &u->chunks[i];
+            if (u->fast) {
+                fifo_push(u, u->trace + c->offset, c->len, true);
+                continue;
+            }
+            feed_paced(u, u->trace + c->offset, c->len, c->byte_ns, start_us + (c->ts_us - t0));
+        }
+    } while (u->repeat && !atomic_load(&u->stop));
+    ESP_LOGI(TAG, "uart%d: end of trace", u->num);
+}
+
+static void *sim_feeder(void *arg) {
+    sim_uart_t *u = arg;
+    if (u->src == SIM_SRC_PTY) {
+        feed_pty(u);
+    } else {
+        feed_trace(u);
+    }
+    return NULL;
+}
+
+static void sim_isr_task(void *args) {
+    sim_uart_t *u = args;
+    while (true) {
+        vTaskDelay(1);
+
+        uart_event_t event = {0};
+        if (atomic_exchange_explicit(&u->overflow, false, memory_order_relaxed)) {
+            event.type = UART_BUFFER_FULL;
+            xQueueSend(u->event_q, &event, 0);
+        }
+        uint32_t pat_head = atomic_load_explicit(&u->pat_head, memory_order_acquire);
+        if (pat_head != u->seen_pat_head) {
+            u->seen_pat_head = pat_head;
+            event.type = UART_PATTERN_DET;
+            xQueueSend(u->event_q, &event, 0);
+        }
+
+        uint32_t head = atomic_load_explicit(&u->head, memory_order_acquire);
+        if (head == u->seen_head) {
+            continue;
+        }
+        uint32_t level = head - atomic_load_explicit(&u->tail, memory_order_relaxed);
+        int64_t idle_us = sim_now_us() - atomic_load_explicit(&u->last_rx_us, memory_order_relaxed);
+        int64_t tout_us = (int64_t) atomic_load(&u->rx_tout) * atomic_load(&u->byte_ns) / 1000;
+        if (level >= (uint32_t) atomic_load(&u->rx_full) || idle_us >= tout_us) {
+            event.type = UART_DATA;
+            event.size = level;
+            event.timeout_flag = idle_us >= tout_us;
+            u->seen_head = head;
+            xQueueSend(u->event_q, &event, 0);
+        }
+    }
+}
+
+static esp_err_t open_pty(sim_uart_t *u) {
+    u->pty_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (u->pty_fd < 0 || grantpt(u->pty_fd) != 0 || unlockpt(u->pty_fd) != 0) {
+        ESP_LOGE(TAG, "uart%d: no pty: %s", u->num, strerror(errno));
+        return ESP_FAIL;
+    }
+    /* Keep the slave open so the master does not see hangups between clients */
+    const char *name = ptsname(u->pty_fd);
+    u->pty_slave_fd = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (u->pty_slave_fd >= 0 && tcgetattr(u->pty_slave_fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(u->pty_slave_fd, TCSANOW, &tio);
+    }
+    ESP_LOGI(TAG, "uart%d: pty %s", u->num, name);
+    return ESP_OK;
+}
+
+typedef struct {
+    sim_uart_t *u;
+    size_t data_len;
+    size_t data_size;
+    size_t chunk_size;
+} trace_load_t;
+
+static void trace_record_cb(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    trace_load_t *load = ctx;
+    sim_uart_t *u = load->u;
+    if ((hdr->flags & (ULOG_FLAG_TX | ULOG_FLAG_EVENT | ULOG_FLAG_FRAME)) != 0 || hdr->len == 0) {
+        return;
+    }
+    if (ULOG_FLAG_PORT_OF(hdr->flags) != 0 && ULOG_FLAG_PORT_OF(hdr->flags) != u->num) {
+        return;
+    }
+    if (u->chunk_count == load->chunk_size) {
+        load->chunk_size = load->chunk_size ? 2 * load->chunk_size : 256;
+        sim_chunk_t *chunks = realloc(u->chunks, load->chunk_size * sizeof(sim_chunk_t));
+        if (chunks == NULL) {
+            return;
+        }
+        u->chunks = chunks;
+    }
+    /* compressed logs inflate, the payloads may outgrow the file */
+    if (load->data_len + hdr->len > load->data_size) {
+        size_t data_size = 2 * load->data_size;
+        if (data_size < load->data_len + hdr->len) {
+            data_size = load->data_len + hdr->len;
+        }
+        uint8_t *trace = realloc(u->trace, data_size);
+        if (trace == NULL) {
+            return;
+        }
+        u->trace = trace;
+        load->data_size = data_size;
+    }
+    memcpy(u->trace + load->data_len, data, hdr->len);
+    u->chunks[u->chunk_count++] = (sim_chunk_t) {
+            .ts_us = hdr->ts_us,
+            .byte_ns = hdr->aux,
+            .offset = load->data_len,
+            .len = hdr->len,
+    };
+    load->data_len += hdr->len;
+}
+
+static esp_err_t load_trace(sim_uart_t *u, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "uart%d: cannot open %s", u->num, path);
+        return ESP_FAIL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *file = malloc(size > 0 ? size : 1);
+    size_t got = file != NULL ? fread(file, 1, size, f) : 0;
+    fclose(f);
+    if (size <= 0 || got != (size_t) size) {
+        ESP_LOGE(TAG, "uart%d: cannot read %s", u->num, path);
+        free(file);
+        return ESP_FAIL;
+    }
+
+    /* Payloads go to their own buffer, the decoder hands out compressed
+     * records from its inflate buffer while it still reads the file */
+    ulog_decoder_t *dec = malloc(sizeof(ulog_decoder_t));
+    if (dec == NULL) {
+        free(file);
+        return ESP_ERR_NO_MEM;
+    }
+    ulog_decoder_init(dec);
+    trace_load_t load = {.u = u};
+    bool is_log = ulog_decode(dec, file, size, trace_record_cb, &load);
+    free(dec);
+    if (is_log) {
+        free(file);
+    } else {
+        /* raw bytes, played as they are */
+        free(u->trace);
+        u->trace = file;
+    }
+
+    if (!is_log) {
+        free(u->chunks);
+        u->chunks = malloc(sizeof(sim_chunk_t));
+        if (u->chunks == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        u->chunks[0] = (sim_chunk_t) {.len = size};
+        u->chunk_count = 1;
+        ESP_LOGI(TAG, "uart%d: %s, %ld bytes at the baud rate", u->num, path, size);
+    } else if (u->chunk_count == 0) {
+        ESP_LOGE(TAG, "uart%d: %s has no received data for this port", u->num, path);
+        return ESP_FAIL;
+    } else {
+        ESP_LOGI(TAG, "uart%d: %s, %u records, %u bytes, %.1f s", u->num, path, (unsigned) u->chunk_count,
+                 (unsigned) load.data_len,
+                 (u->chunks[u->chunk_count - 1].ts_us - u->chunks[0].ts_us) / 1e6);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t open_source(sim_uart_t *u) {
+    char var[16];
+    snprintf(var, sizeof(var), "SIM_UART%d", u->num);
+    const char *spec = getenv(var);
+
+    if (spec == NULL || spec[0] == '\0' || strcmp(spec, "none") == 0) {
+        u->src = SIM_SRC_NONE;
+        ESP_LOGW(TAG, "uart%d: nothing to receive, set %s", u->num, var);
+        return ESP_OK;
+    }
+    if (strcmp(spec, "loop") == 0) {
+        u->src = SIM_SRC_LOOP;
+        return ESP_OK;
+    }
+    if (strcmp(spec, "pty") == 0) {
+        u->src = SIM_SRC_PTY;
+        return open_pty(u);
+    }
+    if (strncmp(spec, "file:", 5) != 0) {
+        ESP_LOGE(TAG, "%s: unknown source %s", var, spec);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    u->src = SIM_SRC_FILE;
+    char path[256];
+    strlcpy(path, spec + 5, sizeof(path));
+    char *opt;
+    while ((opt = strrchr(path, ':')) != NULL) {
+        if (strcmp(opt + 1, "fast") == 0) {
+            u->fast = true;
+        } else if (strcmp(opt + 1, "repeat") == 0) {
+            u->repeat = true;
+        } else {
+            break;
+        }
+        *opt = '\0';
+    }
+    return load_trace(u, path);
+}
+
+static void sim_uart_free(sim_uart_t *u) {
+    if (u->feeder_running) {
+        atomic_store(&u->stop, true);
+        pthread_join(u->feeder, NULL);
+    }
+    if (u->isr_hdl != NULL) {
+        vTaskDelete(u->isr_hdl);
+    }
+    if (u->event_q != NULL) {
+        vQueueDelete(u->event_q);
+    }
+    if (u->pty_slave_fd >= 0) {
+        close(u->pty_slave_fd);
+    }
+    if (u->pty_fd >= 0) {
+        close(u->pty_fd);
+    }
+    free(u->fifo);
+    free(u->trace);
+    free(u->chunks);
+    memset(u, 0, sizeof(*u));
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *uart_queue, int intr_alloc_flags) {
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || rx_buffer_size <= 0 || queue_size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_uart_t *u = &sim_uarts[uart_num];
+    if (u->installed) {
+        return ESP_FAIL;
+    }
+    memset(u, 0, sizeof(*u));
+    u->num = uart_num;
+    u->pty_fd = -1;
+    u->pty_slave_fd = -1;
+    u->fifo_size = rx_buffer_size;
+    atomic_init(&u->byte_ns, 1000000000u / 115200 * SIM_SYMBOL_BITS);
+    atomic_init(&u->rx_full, SIM_RX_FULL_DEFAULT);
+    atomic_init(&u->rx_tout, SIM_RX_TOUT_DEFAULT);
+
+    u->fifo = malloc(u->fifo_size);
+    u->event_q = xQueueCreate(queue_size, sizeof(uart_event_t));
+    if (u->fifo == NULL || u->event_q == NULL) {
+        sim_uart_free(u);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = open_source(u);
+    if (err != ESP_OK) {
+        sim_uart_free(u);
+        return err;
+    }
+    if (xTaskCreate(sim_isr_task, "sim_uart_isr", SIM_ISR_STACK, u, configMAX_PRIORITIES - 1, &u->isr_hdl)
+        != pdPASS) {
+        sim_uart_free(u);
+        return ESP_ERR_NO_MEM;
+    }
+    if (u->src == SIM_SRC_PTY || u->src == SIM_SRC_FILE) {
+        if (pthread_create(&u->feeder, NULL, sim_feeder, u) != 0) {
+            sim_uart_free(u);
+            return ESP_FAIL;
+        }
+        u->feeder_running = true;
+    }
+
+    u->installed = true;
+    if (uart_queue != NULL) {
+        *uart_queue = u->event_q;
+    }
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_uart_free(u);
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config) {
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || uart_config == NULL || uart_config->baud_rate <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&sim_uarts[uart_num].byte_ns, 1000000000u / uart_config->baud_rate * SIM_SYMBOL_BITS);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num) {
+    return uart_num >= 0 && uart_num < UART_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_rx_full_threshold(uart_port_t uart_num, int threshold) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL || threshold <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&u->rx_full, threshold);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&u->rx_tout, tout_thresh);
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *size = atomic_load_explicit(&u->head, memory_order_acquire) - atomic_load_explicit(&u->tail, memory_order_relaxed);
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return -1;
+    }
+    TickType_t start = xTaskGetTickCount();
+    uint32_t tail = atomic_load_explicit(&u->tail, memory_order_relaxed);
+    uint32_t avail;
+    while ((avail = atomic_load_explicit(&u->head, memory_order_acquire) - tail) == 0
+           && xTaskGetTickCount() - start < ticks_to_wait) {
+        vTaskDelay(1);
+    }
+    uint32_t n = avail < length ? avail : length;
+    for (uint32_t i = 0; i < n; i++) {
+        ((uint8_t *) buf)[i] = u->fifo[(tail + i) % u->fifo_size];
+    }
+    atomic_store_explicit(&u->tail, tail + n, memory_order_release);
+    return n;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return -1;
+    }
+    if (u->src == SIM_SRC_LOOP) {
+        fifo_push(u, src, size, false);
+    } else if (u->src == SIM_SRC_PTY && write(u->pty_fd, src, size) < 0 && errno != EAGAIN) {
+        ESP_LOGW(TAG, "uart%d: pty write: %s", uart_num, strerror(errno));
+    }
+    return size;
+}
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t uart_num, char pattern_chr, uint8_t chr_num, int chr_tout,
+                                            int post_idle, int pre_idle) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL || chr_num == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&u->pattern_chr, pattern_chr);
+    atomic_store(&u->pattern_num, chr_num);
+    return ESP_OK;
+}
+
+esp_err_t uart_pattern_queue_reset(uart_port_t uart_num, int queue_length) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    if (u == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    atomic_store_explicit(&u->pat_tail, atomic_load_explicit(&u->pat_head, memory_order_acquire),
+                          memory_order_release);
+    return ESP_OK;
+}
+
+/* Offset of the oldest pattern still in the rx buffer, dropping those
+ * already read past */
+static int pattern_next(sim_uart_t *u, bool pop) {
+    uint32_t tail = atomic_load_explicit(&u->tail, memory_order_relaxed);
+    uint32_t pat_tail = atomic_load_explicit(&u->pat_tail, memory_order_relaxed);
+    while (pat_tail != atomic_load_explicit(&u->pat_head, memory_order_acquire)) {
+        int32_t pos = (int32_t) (u->pattern_pos[pat_tail % SIM_PATTERN_QUEUE] - tail);
+        if (pos >= 0) {
+            atomic_store_explicit(&u->pat_tail, pat_tail + (pop ? 1 : 0), memory_order_release);
+            return pos;
+        }
+        pat_tail++;
+        atomic_store_explicit(&u->pat_tail, pat_tail, memory_order_release);
+    }
+    return -1;
+}
+
+int uart_pattern_get_pos(uart_port_t uart_num) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    return u != NULL ? pattern_next(u, false) : -1;
+}
+
+int uart_pattern_pop_pos(uart_port_t uart_num) {
+    sim_uart_t *u = sim_uart_get(uart_num);
+    return u != NULL ? pattern_next(u, true) : -1;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_http_server.h"
+
+#include "static_assets.h"
+
+static const char *TAG = "static_assets";
+
+extern const uint8_t favicon_ico_start[] asm("_binary_favicon_ico_start");
+extern const uint8_t favicon_ico_end[]   asm("_binary_favicon_ico_end");
+extern const uint8_t wsuart_html_start[] asm("_binary_wsuart_html_start");
+extern const uint8_t wsuart_html_end[]   asm("_binary_wsuart_html_end");
+/* made by main/CMakeLists.txt */
+extern const uint8_t wsuart_html_gz_start[] asm("_binary_wsuart_html_gz_start");
+extern const uint8_t wsuart_html_gz_end[]   asm("_binary_wsuart_html_gz_end");
+
+typedef struct {
+    const char *type;
+    const char *cache_control;
+    const uint8_t *start;
+    const uint8_t *end;
+    const uint8_t *gz_start;        // NULL when gzip does not pay off
+    const uint8_t *gz_end;
+} static_asset_def_t;
+
+/* Pages keep a short max-age, their URLs are not versioned and a firmware
+ * update has to show up. Browser reloads revalidate regardless. */
+static const static_asset_def_t static_assets[STATIC_ASSET_MAX] = {
+        [STATIC_ASSET_FAVICON] = {
+                .type = "image/x-icon",
+                .cache_control = "public, max-age=604800",
+                .start = favicon_ico_start,
+                .end = favicon_ico_end,
+        },
+        [STATIC_ASSET_WSUART] = {
+                .type = "text/html",
+                .cache_control = "public, max-age=3600",
+                .start = wsuart_html_start,
+                .end = wsuart_html_end,
+                .gz_start = wsuart_html_gz_start,
+                .gz_end = wsuart_html_gz_end,
+        },
+};
+
+/* CRC of the raw content, computed on first use */
+static uint32_t static_asset_crc[STATIC_ASSET_MAX];
+
+static bool accepts_gzip(const char *accept_encoding) {
+    const char *p = strstr(accept_encoding, "gzip");
+    if (p == NULL) {
+        return false;
+    }
+    /* "gzip;q=0" explicitly refuses it */
+    p += 4;
+    while (*p == ' ') {
+        p++;
+    }
+    if (strncmp(p, ";q=", 3) == 0) {
+        return strtod(p + 3, NULL) > 0;
+    }
+    return true;
+}
+
+esp_err_t static_asset_send(httpd_req_t *req, static_asset_t id) {
+    const static_asset_def_t *asset = &static_assets[id];
+    char accept_encoding[96];
+    char if_none_match[64];
+    char etag[24];
+
+    bool gzip = asset->gz_start != NULL
+                && httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept_encoding, sizeof(accept_encoding)) == ESP_OK
+                && accepts_gzip(accept_encoding);
+
+    if (static_asset_crc[id] == 0) {
+        static_asset_crc[id] = esp_rom_crc32_le(0, asset->start, asset->end - asset->start);
+    }
+    /* strong tags, so each encoding gets its own */
+    snprintf(etag, sizeof(etag), "\"%08" PRIx32 "%s\"", static_asset_crc[id], gzip ? "-gz" : "");
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+    if (asset->gz_start != NULL) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+        && strstr(if_none_match, etag) != NULL) {
+        ESP_LOGD(TAG, "%s not modified", req->uri);
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset->type);
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, (const char *) asset->gz_start, asset->gz_end - asset->gz_start);
+    }
+    return httpd_resp_send(req, (const char *) asset->start, asset->end - asset->start);
+}
@@ -0,0 +1,31 @@
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+/*
+ * Pages and icons embedded in the firmware.
+ *
+ * Assets are sent gzip encoded when the build made a smaller gzip copy
+ * and the client accepts it, always with a strong ETag and a
+ * Cache-Control max-age, so a reload costs a single 304.
+ */
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    STATIC_ASSET_FAVICON,
+    STATIC_ASSET_WSUART,
+    STATIC_ASSET_MAX,
+} static_asset_t;
+
+esp_err_t static_asset_send(httpd_req_t *req, static_asset_t asset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STATIC_ASSETS_H
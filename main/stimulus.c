@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "stimulus.h"
+#include "bike_common.h"
+#include "capture_port.h"
+#include "ulog_format.h"
+#include "metrics.h"
+#include "resp_writer.h"
+
+static const char *TAG = "stimulus";
+
+#define STIM_SCRIPT_MAX         (8 * 1024)
+#define STIM_STEPS_MAX          (128)
+#define STIM_SEND_MAX           (256)
+#define STIM_PATTERN_MAX        (64)
+_Static_assert(STIM_SEND_MAX <= CAPTURE_TX_CHUNK_MAX, "a send is queued in one piece");
+#define STIM_LOOP_DEPTH         (8)
+/* Received bytes kept for matching, the oldest half goes when it is full */
+#define STIM_RX_KEEP            (512)
+/* Received data is published once the line goes quiet, a match that
+ * arrived before the deadline is waited for this much longer */
+#define STIM_RX_SLACK_US        (20 * 1000)
+/* Steps run without waiting before the task gives lower priorities a tick */
+#define STIM_YIELD_STEPS        (256)
+#define STIM_TASK_PRIO          (3)
+
+typedef enum {
+    STIM_SEND = 0,
+    STIM_EXPECT,
+    STIM_ASSERT,
+    STIM_DELAY,
+    STIM_FLUSH,
+    STIM_LOOP,
+    STIM_END,
+} stim_op_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t expect;             // statistics slot of an expect or assert
+    uint16_t line;
+    uint16_t len;               // data bytes, a pattern is followed by as many mask bytes
+    uint16_t jump;              // loop: its end, end: its loop
+    uint32_t off;               // into the data pool
+    uint32_t arg;               // ms, or the loop count
+} stim_step_t;
+
+typedef struct {
+    stim_step_t steps[STIM_STEPS_MAX];
+    int count;
+    int expects;
+    size_t pool_len;
+    uint8_t pool[];
+} stim_script_t;
+
+typedef struct {
+    stimulus_config_t config;
+    stim_script_t *script;
+    atomic_bool stopping;
+    atomic_bool task_running;
+
+    /* script task */
+    uart_ring_reader_t reader;
+    ulog_rec_hdr_t hdr;
+    uint8_t rec[CAPTURE_REC_MAX];
+    uint8_t rx[STIM_RX_KEEP];
+    int64_t rx_us[STIM_RX_KEEP];    // arrival of each byte
+    size_t rx_len;
+    size_t scanned;                 // bytes the current pattern did not end in
+    int64_t send_call_us;
+    int64_t sent_us;                // TX record of the last send, 0 before the first
+    uint32_t byte_ns;               // at the port's baud rate, for records without one
+    int unwaited;
+    struct {
+        uint16_t step;
+        uint32_t left;
+    } loops[STIM_LOOP_DEPTH];
+    int depth;
+
+    portMUX_TYPE stats_lock;
+    stimulus_stats_t stats;
+    int64_t start_us;
+    int64_t end_us;
+} stim_t;
+
+static stim_t *stim = NULL;
+static char base_path[ESP_VFS_PATH_MAX + 1];
+
+static metrics_hist_t rtt_metric;
+static metrics_counter_t timeouts_metric;
+
+static void stim_metrics_init(void) {
+    metrics_hist_init(&rtt_metric, "stimulus_rtt_us", "Time from a scripted send to the expected response",
+                      NULL, NULL);
+    metrics_counter_init(&timeouts_metric, "stimulus_timeouts_total", "Scripted expects that timed out",
+                         NULL, NULL);
+}
+
+/* Parser */
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char) tolower((unsigned char) c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static const char *skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+/* Hex bytes, quoted strings and, in patterns, "??" up to the end of the
+ * line or a comment. Returns NULL on success, else what is wrong. */
+static const char *parse_data(stim_script_t *script, const char *p, bool pattern, stim_step_t *step) {
+    uint8_t data[STIM_SEND_MAX];
+    uint8_t mask[STIM_SEND_MAX];
+    size_t limit = pattern ? STIM_PATTERN_MAX : STIM_SEND_MAX;
+    size_t n = 0;
+
+    while (*(p = skip_space(p)) != '\0' && *p != '#') {
+        if (*p == '"') {
+            for (p++; *p != '"'; p++) {
+                if (*p == '\0') {
+                    return "unterminated string";
+                }
+                uint8_t c = (uint8_t) *p;
+                if (c == '\\') {
+                    p++;
+                    switch (*p) {
+                        case 'r': c = '\r'; break;
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case '0': c = 0; break;
+                        case '\\': c = '\\'; break;
+                        case '"': c = '"'; break;
+                        case 'x':
+                            if (hex_digit(p[1]) < 0 || hex_digit(p[2]) < 0) {
+                                return "bad \\x escape";
+                            }
+                            c = (uint8_t) (hex_digit(p[1]) << 4 | hex_digit(p[2]));
+                            p += 2;
+                            break;
+                        default:
+                            return "bad escape";
+                    }
+                }
+                if (n == limit) {
+                    return "data too long";
+                }
+                data[n] = c;
+                mask[n++] = 0xff;
+            }
+            p++;
+        } else if (p[0] == '?' && p[1] == '?') {
+            if (!pattern) {
+                return "?? only matches, it cannot be sent";
+            }
+            if (n == limit) {
+                return "data too long";
+            }
+            data[n] = 0;
+            mask[n++] = 0;
+            p += 2;
+        } else {
+            const char *start = p;
+            while (hex_digit(p[0]) >= 0 && hex_digit(p[1]) >= 0) {
+                if (n == limit) {
+                    return "data too long";
+                }
+                data[n] = (uint8_t) (hex_digit(p[0]) << 4 | hex_digit(p[1]));
+                mask[n++] = 0xff;
+                p += 2;
+            }
+            if (p == start || (*p != '\0' && *p != ' ' && *p != '\t' && *p != '#')) {
+                return "bad data, expected hex bytes, \"text\" or ??";
+            }
+        }
+    }
+    if (n == 0) {
+        return "no data";
+    }
+
+    step->off = script->pool_len;
+    step->len = n;
+    memcpy(script->pool + script->pool_len, data, n);
+    script->pool_len += n;
+    if (pattern) {
+        memcpy(script->pool + script->pool_len, mask, n);
+        script->pool_len += n;
+    }
+    return NULL;
+}
+
+/* A number followed by nothing but, if rest is given, more arguments */
+static const char *parse_uint(const char *p, uint32_t *value, const char **rest) {
+    char *end;
+    p = skip_space(p);
+    if (!isdigit((unsigned char) *p)) {
+        return "expected a number";
+    }
+    unsigned long v = strtoul(p, &end, 10);
+    end = (char *) skip_space(end);
+    if (rest != NULL) {
+        *rest = end;
+    } else if (*end != '\0' && *end != '#') {
+        return "unexpected text after the number";
+    }
+    *value = v > UINT32_MAX / 1000 ? UINT32_MAX / 1000 : (uint32_t) v;
+    return NULL;
+}
+
+static const char *parse_line(stim_script_t *script, char *line, uint16_t line_no, uint16_t *open,
+                              int *depth) {
+    char cmd[8];
+    int n = 0;
+    const char *p = skip_space(line);
+    if (*p == '\0' || *p == '#') {
+        return NULL;
+    }
+    if (sscanf(p, "%7[a-z]%n", cmd, &n) != 1 || (p[n] != '\0' && p[n] != ' ' && p[n] != '\t' && p[n] != '#')) {
+        return "unknown command";
+    }
+    p += n;
+    if (script->count == STIM_STEPS_MAX) {
+        return "too many commands";
+    }
+    stim_step_t *step = &script->steps[script->count];
+    memset(step, 0, sizeof(*step));
+    step->line = line_no;
+
+    const char *err = NULL;
+    if (strcmp(cmd, "send") == 0) {
+        step->op = STIM_SEND;
+        err = parse_data(script, p, false, step);
+    } else if (strcmp(cmd, "expect") == 0 || strcmp(cmd, "assert") == 0) {
+        step->op = cmd[0] == 'e' ? STIM_EXPECT : STIM_ASSERT;
+        step->expect = min(script->expects, STIMULUS_EXPECTS_MAX - 1);
+        script->expects++;
+        if ((err = parse_uint(p, &step->arg, &p)) == NULL) {
+            err = step->arg == 0 ? "timeout must be at least 1 ms" : parse_data(script, p, true, step);
+        }
+    } else if (strcmp(cmd, "delay") == 0) {
+        step->op = STIM_DELAY;
+        err = parse_uint(p, &step->arg, NULL);
+    } else if (strcmp(cmd, "flush") == 0) {
+        step->op = STIM_FLUSH;
+        p = skip_space(p);
+        err = *p != '\0' && *p != '#' ? "flush takes no arguments" : NULL;
+    } else if (strcmp(cmd, "loop") == 0) {
+        step->op = STIM_LOOP;
+        if (*depth == STIM_LOOP_DEPTH) {
+            return "loops nested too deep";
+        }
+        err = parse_uint(p, &step->arg, NULL);
+        open[(*depth)++] = script->count;
+    } else if (strcmp(cmd, "end") == 0) {
+        step->op = STIM_END;
+        if (*depth == 0) {
+            return "end without loop";
+        }
+        uint16_t loop = open[--(*depth)];
+        if (loop + 1 == script->count) {
+            return "empty loop";
+        }
+        step->jump = loop;
+        script->steps[loop].jump = script->count;
+    } else {
+        return "unknown command";
+    }
+    if (err == NULL) {
+        script->count++;
+    }
+    return err;
+}
+
+static stim_script_t *parse_script(const char *path, char error[STIMULUS_ERROR_MAX]) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        snprintf(error, STIMULUS_ERROR_MAX, "cannot open the script");
+        return NULL;
+    }
+    char *text = malloc(STIM_SCRIPT_MAX + 1);
+    /* the pool holds at most one data byte per character, and a mask byte */
+    stim_script_t *script = calloc(1, sizeof(stim_script_t) + 2 * STIM_SCRIPT_MAX);
+    size_t len = text != NULL ? fread(text, 1, STIM_SCRIPT_MAX + 1, f) : 0;
+    fclose(f);
+    if (text == NULL || script == NULL) {
+        snprintf(error, STIMULUS_ERROR_MAX, "out of memory");
+        goto fail;
+    }
+    if (len > STIM_SCRIPT_MAX) {
+        snprintf(error, STIMULUS_ERROR_MAX, "script longer than %d bytes", STIM_SCRIPT_MAX);
+        goto fail;
+    }
+    text[len] = '\0';
+
+    uint16_t open[STIM_LOOP_DEPTH];
+    int depth = 0;
+    uint16_t line_no = 1;
+    for (char *line = text; line != NULL; line_no++) {
+        char *next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        size_t n = strlen(line);
+        if (n > 0 && line[n - 1] == '\r') {
+            line[n - 1] = '\0';
+        }
+        const char *err = parse_line(script, line, line_no, open, &depth);
+        if (err != NULL) {
+            snprintf(error, STIMULUS_ERROR_MAX, "line %u: %s", line_no, err);
+            goto fail;
+        }
+        line = next;
+    }
+    if (depth > 0) {
+        snprintf(error, STIMULUS_ERROR_MAX, "line %u: loop without end", script->steps[open[depth - 1]].line);
+        goto fail;
+    }
+    if (script->count == 0) {
+        snprintf(error, STIMULUS_ERROR_MAX, "empty script");
+        goto fail;
+    }
+    free(text);
+    return script;
+
+fail:
+    free(text);
+    free(script);
+    return NULL;
+}
+
+/* Script task */
+
+static void stim_rx_append(stim_t *s, uint8_t c, int64_t us) {
+    if (s->rx_len == STIM_RX_KEEP) {
+        size_t half = STIM_RX_KEEP / 2;
+        memmove(s->rx, s->rx + half, STIM_RX_KEEP - half);
+        memmove(s->rx_us, s->rx_us + half, (STIM_RX_KEEP - half) * sizeof(s->rx_us[0]));
+        s->rx_len -= half;
+        s->scanned = s->scanned > half ? s->scanned - half : 0;
+        portENTER_CRITICAL(&s->stats_lock);
+        s->stats.rx_discarded += half;
+        portEXIT_CRITICAL(&s->stats_lock);
+    }
+    s->rx[s->rx_len] = c;
+    s->rx_us[s->rx_len++] = us;
+}
+
+static void stim_rx_lost(stim_t *s) {
+    /* a match across the gap would be made up */
+    uart_ring_reader_attach(capture_port_ring(s->config.port), &s->reader);
+    s->rx_len = 0;
+    s->scanned = 0;
+    portENTER_CRITICAL(&s->stats_lock);
+    s->stats.rx_overruns++;
+    portEXIT_CRITICAL(&s->stats_lock);
+}
+
+/* Take in the records the port published since the last poll */
+static void stim_poll(stim_t *s) {
+    uart_ring_t *ring = capture_port_ring(s->config.port);
+    while (uart_ring_readable(ring, &s->reader) >= sizeof(ulog_rec_hdr_t)) {
+        uart_ring_read(ring, &s->reader, (uint8_t *) &s->hdr, sizeof(s->hdr));
+        if (s->reader.overrun_count > 0 || s->hdr.sync != ULOG_REC_SYNC || s->hdr.len > CAPTURE_REC_MAX
+            || uart_ring_read(ring, &s->reader, s->rec, s->hdr.len) != s->hdr.len || s->reader.overrun_count > 0) {
+            stim_rx_lost(s);
+            return;
+        }
+        if (s->hdr.flags & ULOG_FLAG_TX) {
+            /* dated when the driver took it, the first one after our send is ours */
+            if (s->sent_us < s->send_call_us && s->hdr.ts_us >= s->send_call_us) {
+                s->sent_us = s->hdr.ts_us;
+            }
+        } else if (!(s->hdr.flags & (ULOG_FLAG_EVENT | ULOG_FLAG_FRAME))) {
+            uint32_t byte_ns = s->hdr.aux != 0 ? s->hdr.aux : s->byte_ns;
+            for (int i = 0; i < s->hdr.len; i++) {
+                stim_rx_append(s, s->rec[i], s->hdr.ts_us + (int64_t) i * byte_ns / 1000);
+            }
+        }
+    }
+}
+
+static void stim_wait(stim_t *s) {
+    vTaskDelay(1);
+    s->unwaited = 0;
+    stim_poll(s);
+}
+
+/* Index of the last byte of the first match, -1 if there is none yet */
+static int stim_find(stim_t *s, const stim_step_t *step) {
+    const uint8_t *data = s->script->pool + step->off;
+    const uint8_t *mask = data + step->len;
+    for (size_t end = max(s->scanned, (size_t) step->len - 1); end < s->rx_len; end++) {
+        const uint8_t *rx = s->rx + end + 1 - step->len;
+        size_t i = 0;
+        while (i < step->len && ((rx[i] ^ data[i]) & mask[i]) == 0) {
+            i++;
+        }
+        if (i == step->len) {
+            return (int) end;
+        }
+    }
+    s->scanned = s->rx_len;
+    return -1;
+}
+
+/* false if the port stopped before it was queued */
+static bool stim_send(stim_t *s, const stim_step_t *step) {
+    const uint8_t *data = s->script->pool + step->off;
+    bool queued = false;
+    s->send_call_us = esp_timer_get_time();
+    /* a full TX queue holds the script back, nothing is dropped. Queued
+     * in one piece, other writers on the port cannot split it. */
+    while (!atomic_load(&s->stopping)) {
+        queued = capture_port_try_write(s->config.port, data, step->len);
+        if (queued || !capture_port_running(s->config.port)) {
+            break;
+        }
+        stim_wait(s);
+    }
+    if (queued) {
+        portENTER_CRITICAL(&s->stats_lock);
+        s->stats.sends++;
+        s->stats.bytes_sent += step->len;
+        portEXIT_CRITICAL(&s->stats_lock);
+    }
+    return queued || atomic_load(&s->stopping);
+}
+
+/* false if the pattern was not received in time */
+static bool stim_expect(stim_t *s, const stim_step_t *step) {
+    int64_t deadline = esp_timer_get_time() + (int64_t) step->arg * 1000;
+    int end;
+    s->scanned = 0;
+    stim_poll(s);
+    while ((end = stim_find(s, step)) < 0) {
+        if (atomic_load(&s->stopping) || esp_timer_get_time() > deadline + STIM_RX_SLACK_US) {
+            break;
+        }
+        stim_wait(s);
+    }
+
+    stimulus_expect_stats_t *e = &s->stats.expect[step->expect];
+    if (end < 0 || s->rx_us[end] > deadline) {
+        if (atomic_load(&s->stopping)) {
+            return true;
+        }
+        portENTER_CRITICAL(&s->stats_lock);
+        s->stats.timeouts++;
+        e->timeouts++;
+        portEXIT_CRITICAL(&s->stats_lock);
+        metrics_counter_add(&timeouts_metric, 1);
+        return false;
+    }
+
+    int64_t arrived = s->rx_us[end];
+    s->rx_len -= end + 1;
+    memmove(s->rx, s->rx + end + 1, s->rx_len);
+    memmove(s->rx_us, s->rx_us + end + 1, s->rx_len * sizeof(s->rx_us[0]));
+    s->scanned = 0;
+
+    /* the driver may not have taken the request yet when the answer to an
+     * earlier one matched, that is no round trip */
+    int64_t sent = s->sent_us >= s->send_call_us ? s->sent_us : s->send_call_us;
+    bool timed = s->send_call_us > 0 && arrived >= sent;
+    uint32_t rtt = timed ? (uint32_t) min(arrived - sent, (int64_t) UINT32_MAX) : 0;
+    portENTER_CRITICAL(&s->stats_lock);
+    s->stats.matches++;
+    e->matches++;
+    if (timed) {
+        int b = 0;
+        while (b < METRICS_HIST_BUCKETS && rtt > metrics_hist_bounds[b]) {
+            b++;
+        }
+        e->buckets[b]++;
+        e->rtt_sum_us += rtt;
+        e->rtt_max_us = max(e->rtt_max_us, rtt);
+        e->rtt_min_us = min(e->rtt_min_us, rtt);
+    }
+    portEXIT_CRITICAL(&s->stats_lock);
+    if (timed) {
+        metrics_hist_observe(&rtt_metric, rtt);
+    }
+    return true;
+}
+
+static void stim_delay(stim_t *s, uint32_t ms) {
+    int64_t until = esp_timer_get_time() + (int64_t) ms * 1000;
+    while (!atomic_load(&s->stopping) && esp_timer_get_time() < until) {
+        stim_wait(s);
+    }
+}
+
+static void stim_task(void *args) {
+    stim_t *s = args;
+    stim_script_t *script = s->script;
+    stimulus_state_t state = STIMULUS_DONE;
+    const char *failure = NULL;
+    int pc = 0;
+
+    uart_ring_reader_attach(capture_port_ring(s->config.port), &s->reader);
+    while (pc < script->count) {
+        if (atomic_load(&s->stopping)) {
+            state = STIMULUS_STOPPED;
+            break;
+        }
+        const stim_step_t *step = &script->steps[pc];
+        portENTER_CRITICAL(&s->stats_lock);
+        s->stats.line = step->line;
+        portEXIT_CRITICAL(&s->stats_lock);
+        if (!capture_port_running(s->config.port)) {
+            state = STIMULUS_FAILED;
+            failure = "port stopped";
+            break;
+        }
+        if (++s->unwaited > STIM_YIELD_STEPS) {
+            stim_wait(s);
+        }
+
+        switch (step->op) {
+            case STIM_SEND:
+                if (!stim_send(s, step)) {
+                    state = STIMULUS_FAILED;
+                    failure = "port stopped";
+                    pc = script->count;
+                    continue;
+                }
+                break;
+            case STIM_EXPECT:
+            case STIM_ASSERT:
+                if (!stim_expect(s, step) && step->op == STIM_ASSERT) {
+                    state = STIMULUS_FAILED;
+                    failure = "timed out";
+                    pc = script->count;
+                    continue;
+                }
+                break;
+            case STIM_DELAY:
+                stim_delay(s, step->arg);
+                break;
+            case STIM_FLUSH:
+                stim_poll(s);
+                s->rx_len = 0;
+                s->scanned = 0;
+                break;
+            case STIM_LOOP:
+                s->loops[s->depth].step = pc;
+                s->loops[s->depth++].left = step->arg;
+                break;
+            case STIM_END:
+                if (s->loops[s->depth - 1].left == 0 || --s->loops[s->depth - 1].left > 0) {
+                    pc = step->jump + 1;
+                    continue;
+                }
+                s->depth--;
+                break;
+        }
+        pc++;
+    }
+    if (state == STIMULUS_DONE && atomic_load(&s->stopping)) {
+        state = STIMULUS_STOPPED;
+    }
+
+    portENTER_CRITICAL(&s->stats_lock);
+    s->end_us = esp_timer_get_time();
+    s->stats.state = state;
+    portEXIT_CRITICAL(&s->stats_lock);
+    if (state == STIMULUS_FAILED) {
+        ESP_LOGW(TAG, "%s failed, line %u %s", s->config.path, s->stats.line, failure);
+    } else {
+        ESP_LOGI(TAG, "%s %s: %" PRIu32 " sends, %" PRIu32 " matches, %" PRIu32 " timeouts", s->config.path,
+                 state == STIMULUS_DONE ? "done" : "stopped", s->stats.sends, s->stats.matches, s->stats.timeouts);
+    }
+    atomic_store(&s->task_running, false);
+    vTaskDelete(NULL);
+}
+
+/* Control */
+
+void stimulus_stop(void) {
+    stim_t *s = stim;
+    if (s == NULL) {
+        return;
+    }
+    atomic_store(&s->stopping, true);
+    while (atomic_load(&s->task_running)) {
+        vTaskDelay(1);
+    }
+}
+
+esp_err_t stimulus_start(const stimulus_config_t *config, char error[STIMULUS_ERROR_MAX]) {
+    error[0] = '\0';
+    if (!capture_port_valid(config->port)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!capture_port_running(config->port)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    struct stat st;
+    if (stat(config->path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* a script that does not parse leaves a running one alone */
+    stim_script_t *script = parse_script(config->path, error);
+    if (script == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stimulus_stop();
+    if (stim == NULL) {
+        stim_t *s = calloc(1, sizeof(stim_t));
+        if (s == NULL) {
+            free(script);
+            return ESP_ERR_NO_MEM;
+        }
+        portMUX_INITIALIZE(&s->stats_lock);
+        stim_metrics_init();
+        stim = s;
+    }
+
+    stim_t *s = stim;
+    free(s->script);
+    s->script = script;
+    s->config = *config;
+    s->rx_len = 0;
+    s->scanned = 0;
+    s->send_call_us = 0;
+    s->sent_us = 0;
+    capture_port_stats_t port_stats;
+    capture_port_get_stats(config->port, &port_stats);
+    s->byte_ns = port_stats.baud_rate > 0 ? (uint32_t) (10000000000ULL / port_stats.baud_rate) : 0;
+    s->unwaited = 0;
+    s->depth = 0;
+    portENTER_CRITICAL(&s->stats_lock);
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->stats.state = STIMULUS_RUNNING;
+    s->stats.expects = min(script->expects, STIMULUS_EXPECTS_MAX);
+    for (int i = 0; i < STIMULUS_EXPECTS_MAX; i++) {
+        s->stats.expect[i].rtt_min_us = UINT32_MAX;
+    }
+    for (int i = 0; i < script->count; i++) {
+        const stim_step_t *step = &script->steps[i];
+        if ((step->op == STIM_EXPECT || step->op == STIM_ASSERT) && s->stats.expect[step->expect].line == 0) {
+            s->stats.expect[step->expect].line = step->line;
+        }
+    }
+    s->start_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&s->stats_lock);
+    atomic_store(&s->stopping, false);
+    atomic_store(&s->task_running, true);
+
+    if (xTaskCreate(stim_task, "stimulus", 4096, s, STIM_TASK_PRIO, NULL) != pdPASS) {
+        atomic_store(&s->task_running, false);
+        portENTER_CRITICAL(&s->stats_lock);
+        s->stats.state = STIMULUS_IDLE;
+        portEXIT_CRITICAL(&s->stats_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Running %s on uart%d, %d commands", config->path, config->port, script->count);
+    return ESP_OK;
+}
+
+void stimulus_get_stats(stimulus_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stim_t *s = stim;
+    if (s == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&s->stats_lock);
+    *stats = s->stats;
+    int64_t start_us = s->start_us;
+    int64_t end_us = s->end_us;
+    portEXIT_CRITICAL(&s->stats_lock);
+    stats->elapsed_us = (stats->state == STIMULUS_RUNNING ? esp_timer_get_time() : end_us) - start_us;
+}
+
+/* HTTP */
+
+static const char *state_name(stimulus_state_t state) {
+    switch (state) {
+        case STIMULUS_RUNNING: return "running";
+        case STIMULUS_DONE: return "done";
+        case STIMULUS_FAILED: return "failed";
+        case STIMULUS_STOPPED: return "stopped";
+        default: return "idle";
+    }
+}
+
+static esp_err_t stimulus_handler(httpd_req_t *req) {
+    char query[160] = "";
+    char name[STIMULUS_PATH_MAX];
+    char param[16];
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+
+    if (httpd_query_key_value(query, "stop", param, sizeof(param)) == ESP_OK && atoi(param) != 0) {
+        stimulus_stop();
+    } else if (httpd_query_key_value(query, "file", name, sizeof(name)) == ESP_OK) {
+        stimulus_config_t config = {
+                .port = CAPTURE_PORT_FIRST,
+        };
+        if (httpd_query_key_value(query, "port", param, sizeof(param)) == ESP_OK) {
+            config.port = atoi(param);
+        }
+        if (strchr(name, '/') != NULL
+            || snprintf(config.path, sizeof(config.path), "%s/%s", base_path, name) >= sizeof(config.path)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+            return ESP_OK;
+        }
+
+        char error[STIMULUS_ERROR_MAX];
+        esp_err_t err = stimulus_start(&config, error);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error[0] != '\0' ? error : "Invalid port");
+            return ESP_OK;
+        }
+        if (err == ESP_ERR_INVALID_STATE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Port is not capturing, start it with /uartconfig");
+            return ESP_OK;
+        }
+        if (err == ESP_ERR_NOT_FOUND) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+            return ESP_OK;
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, error[0] != '\0' ? error : "Failed to start");
+            return ESP_OK;
+        }
+    }
+
+    /* large, and the handler stack is not */
+    static stimulus_stats_t stats;
+    stimulus_get_stats(&stats);
+    char json_response[512];
+    resp_writer_t w;
+    resp_writer_init(&w, req, json_response, sizeof(json_response));
+    resp_writer_printf(&w, "{\"state\":\"%s\"", state_name(stats.state));
+    if (stim != NULL) {
+        resp_writer_str(&w, ",\"file\":");
+        resp_writer_json_str(&w, stim->config.path + strlen(base_path) + 1);
+        resp_writer_printf(&w, ",\"port\":%d", stim->config.port);
+    }
+    resp_writer_printf(&w, ",\"line\":%u,\"sends\":%" PRIu32 ",\"bytes_sent\":%" PRIu32 ",\"matches\":%" PRIu32 ","
+                           "\"timeouts\":%" PRIu32 ",\"rx_discarded\":%" PRIu32 ",\"rx_overruns\":%" PRIu32 ","
+                           "\"elapsed_ms\":%" PRId64 ",\"bounds_us\":[",
+                       stats.line, stats.sends, stats.bytes_sent, stats.matches, stats.timeouts,
+                       stats.rx_discarded, stats.rx_overruns, stats.elapsed_us / 1000);
+    for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+        resp_writer_printf(&w, "%s%lu", b == 0 ? "" : ",", (unsigned long) metrics_hist_bounds[b]);
+    }
+    resp_writer_str(&w, "],\"expects\":[");
+    for (int i = 0; i < stats.expects; i++) {
+        const stimulus_expect_stats_t *e = &stats.expect[i];
+        uint32_t timed = 0;
+        for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+            timed += e->buckets[b];
+        }
+        resp_writer_printf(&w, "%s{\"line\":%u,\"matches\":%" PRIu32 ",\"timeouts\":%" PRIu32 ","
+                               "\"rtt_us\":{\"min\":%" PRIu32 ",\"mean\":%" PRIu64 ",\"max\":%" PRIu32 "},"
+                               "\"buckets\":[",
+                           i == 0 ? "" : ",", e->line, e->matches, e->timeouts, timed > 0 ? e->rtt_min_us : 0,
+                           timed > 0 ? e->rtt_sum_us / timed : 0, e->rtt_max_us);
+        for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+            resp_writer_printf(&w, "%s%" PRIu32, b == 0 ? "" : ",", e->buckets[b]);
+        }
+        resp_writer_str(&w, "]}");
+    }
+    resp_writer_str(&w, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    return resp_writer_finish(&w);
+}
+
+esp_err_t register_stimulus_handler(const char *path, httpd_handle_t server) {
+    strlcpy(base_path, path, sizeof(base_path));
+
+    httpd_uri_t stimulus_uri = {
+            .uri       = "/stimulus",
+            .method    = HTTP_GET,
+            .handler   = stimulus_handler,
+            .user_ctx  = NULL
+    };
+    return httpd_register_uri_handler(server, &stimulus_uri);
+}
@@ -0,0 +1,98 @@
+#ifndef STIMULUS_H
+#define STIMULUS_H
+
+/*
+ * Scripted request/response stimulus on a capturing port.
+ *
+ * A script is a text file uploaded through the file server, one command
+ * per line, '#' starts a comment:
+ *
+ *   send <data>             queue data on the port
+ *   expect <ms> <pattern>   wait up to ms for the pattern to be received
+ *   assert <ms> <pattern>   the same, but a timeout fails and ends the run
+ *   delay <ms>
+ *   flush                   forget what was received and not matched yet
+ *   loop <n> ... end        repeat the commands between, n = 0 forever
+ *
+ * Data is hex bytes ("01 03 c40b") and quoted strings with C escapes
+ * ("AT\r\n"), mixed freely; in a pattern "??" matches any byte. An expect
+ * searches what was received since the previous match or flush, so a
+ * response that arrives before its expect starts still counts.
+ *
+ * The round trip of an expect that matches is timed from the last send
+ * being handed to the uart driver to the arrival of the last byte of the
+ * match, both from the port's capture records, so how often the script
+ * polls does not show in it. Every expect keeps its own histogram, all
+ * of them go into stimulus_rtt_us on /metrics.
+ *
+ * GET /stimulus?file=<name>[&port=1] starts, /stimulus?stop=1 stops and
+ * /stimulus alone reports the progress.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "metrics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STIMULUS_PATH_MAX       (64)
+#define STIMULUS_ERROR_MAX      (64)
+/* expect and assert lines with their own statistics, later ones share the last */
+#define STIMULUS_EXPECTS_MAX    (16)
+
+typedef enum {
+    STIMULUS_IDLE = 0,
+    STIMULUS_RUNNING,
+    STIMULUS_DONE,
+    STIMULUS_FAILED,            // an assert timed out or the port stopped
+    STIMULUS_STOPPED,
+} stimulus_state_t;
+
+typedef struct {
+    char path[STIMULUS_PATH_MAX];
+    int port;
+} stimulus_config_t;
+
+typedef struct {
+    uint16_t line;
+    uint32_t matches;
+    uint32_t timeouts;
+    uint32_t rtt_min_us;
+    uint32_t rtt_max_us;
+    uint64_t rtt_sum_us;
+    uint32_t buckets[METRICS_HIST_BUCKETS + 1];     // not cumulative, bounds in metrics_hist_bounds
+} stimulus_expect_stats_t;
+
+typedef struct {
+    stimulus_state_t state;
+    uint16_t line;              // being run, or where the run failed
+    uint32_t sends;
+    uint32_t bytes_sent;
+    uint32_t matches;
+    uint32_t timeouts;
+    uint32_t rx_discarded;      // received bytes dropped unmatched to make room
+    uint32_t rx_overruns;       // the capture ring lapped the script
+    int64_t elapsed_us;
+    int expects;
+    stimulus_expect_stats_t expect[STIMULUS_EXPECTS_MAX];
+} stimulus_stats_t;
+
+/* Parse the script and start running it. A script that does not parse
+ * returns ESP_ERR_INVALID_ARG with the reason in error. */
+esp_err_t stimulus_start(const stimulus_config_t *config, char error[STIMULUS_ERROR_MAX]);
+
+void stimulus_stop(void);
+
+void stimulus_get_stats(stimulus_stats_t *stats);
+
+esp_err_t register_stimulus_handler(const char *base_path, httpd_handle_t server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STIMULUS_H
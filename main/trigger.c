@@ -0,0 +1,275 @@
+#include <string.h>
+
+#include "trigger.h"
+#include "ulog_format.h"
+
+#define RECENT_MASK (TRIGGER_PATTERN_MAX - 1)
+
+_Static_assert(TRIGGER_PATTERN_MAX <= 32, "pending completions are a 32 bit mask");
+_Static_assert(TRIGGER_PATTERNS_MAX <= 8, "patterns are a bit each in a byte");
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* One pattern from spec up to ',' or the end, returns the characters used or -1 */
+static int parse_pattern(trigger_pattern_t *pat, const char *spec) {
+    int i = 0;
+    memset(pat, 0, sizeof(trigger_pattern_t));
+    while (spec[i] != '\0' && spec[i] != ',') {
+        if (spec[i + 1] == '\0' || spec[i + 1] == ',' || pat->len == TRIGGER_PATTERN_MAX) {
+            return -1;
+        }
+        uint8_t value = 0, mask = 0;
+        for (int n = 0; n < 2; n++) {
+            char c = spec[i + n];
+            value <<= 4;
+            mask <<= 4;
+            if (c == '?') {
+                continue;
+            }
+            int v = hex_nibble(c);
+            if (v < 0) {
+                return -1;
+            }
+            value |= v;
+            mask |= 0x0F;
+        }
+        pat->value[pat->len] = value;
+        pat->mask[pat->len] = mask;
+        pat->len++;
+        i += 2;
+    }
+
+    /* the automaton looks for the longest fully specified run, the last one on a tie */
+    int best_len = 0;
+    for (int start = 0; start < pat->len;) {
+        if (pat->mask[start] != 0xFF) {
+            start++;
+            continue;
+        }
+        int end = start;
+        while (end < pat->len && pat->mask[end] == 0xFF) {
+            end++;
+        }
+        if (end - start >= best_len) {
+            best_len = end - start;
+            pat->anchor_end = end;
+        }
+        start = end;
+    }
+    return best_len > 0 ? i : -1;
+}
+
+static uint16_t node_child(const trigger_matcher_t *m, uint16_t node, uint8_t c) {
+    if (node == 0) {
+        return m->root_next[c];
+    }
+    for (uint16_t n = m->nodes[node].child; n != 0; n = m->nodes[n].sibling) {
+        if (m->nodes[n].byte == c) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void insert_anchor(trigger_matcher_t *m, int index) {
+    const trigger_pattern_t *pat = &m->patterns[index];
+    int anchor_len = 0;
+    while (anchor_len < pat->anchor_end && pat->mask[pat->anchor_end - 1 - anchor_len] == 0xFF) {
+        anchor_len++;
+    }
+
+    uint16_t node = 0;
+    for (int i = pat->anchor_end - anchor_len; i < pat->anchor_end; i++) {
+        uint8_t c = pat->value[i];
+        uint16_t next = node_child(m, node, c);
+        if (next == 0) {
+            next = m->node_count++;
+            memset(&m->nodes[next], 0, sizeof(trigger_node_t));
+            m->nodes[next].byte = c;
+            m->nodes[next].sibling = m->nodes[node].child;
+            m->nodes[node].child = next;
+            if (node == 0) {
+                m->root_next[c] = next;
+            }
+        }
+        node = next;
+    }
+    m->nodes[node].out |= 1 << index;
+}
+
+/* Failure links breadth first, a node also reports what its fail node reports */
+static void build_links(trigger_matcher_t *m) {
+    uint16_t queue[TRIGGER_NODES_MAX];
+    int head = 0, tail = 0;
+
+    for (uint16_t n = m->nodes[0].child; n != 0; n = m->nodes[n].sibling) {
+        m->nodes[n].fail = 0;
+        queue[tail++] = n;
+    }
+    while (head < tail) {
+        uint16_t node = queue[head++];
+        for (uint16_t n = m->nodes[node].child; n != 0; n = m->nodes[n].sibling) {
+            uint16_t f = m->nodes[node].fail;
+            while (f != 0 && node_child(m, f, m->nodes[n].byte) == 0) {
+                f = m->nodes[f].fail;
+            }
+            f = node_child(m, f, m->nodes[n].byte);
+            m->nodes[n].fail = f;
+            m->nodes[n].out |= m->nodes[f].out;
+            queue[tail++] = n;
+        }
+    }
+}
+
+int trigger_compile(trigger_matcher_t *m, const char *spec) {
+    memset(m, 0, sizeof(trigger_matcher_t));
+    m->node_count = 1;
+
+    while (*spec != '\0') {
+        if (m->pattern_count == TRIGGER_PATTERNS_MAX) {
+            return -1;
+        }
+        int used = parse_pattern(&m->patterns[m->pattern_count], spec);
+        if (used < 0) {
+            return -1;
+        }
+        insert_anchor(m, m->pattern_count);
+        m->pattern_count++;
+        spec += used;
+        if (*spec == ',') {
+            spec++;
+        }
+    }
+    build_links(m);
+    return m->pattern_count;
+}
+
+/* The last pattern byte was just scanned */
+static bool pattern_matches(const trigger_matcher_t *m, const trigger_pattern_t *pat) {
+    if (m->seen < pat->len) {
+        return false;
+    }
+    for (int j = 0; j < pat->len; j++) {
+        uint8_t c = m->recent[(m->seen - pat->len + j) & RECENT_MASK];
+        if ((c & pat->mask[j]) != pat->value[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void trigger_scan(trigger_matcher_t *m, const uint8_t *data, size_t len, trigger_match_cb_t cb, void *ctx) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        m->recent[m->seen++ & RECENT_MASK] = c;
+
+        /* patterns whose anchor was found earlier and that end here */
+        uint8_t pending = m->pending_patterns;
+        for (int k = 0; pending != 0; k++, pending >>= 1) {
+            if (!(pending & 1)) {
+                continue;
+            }
+            m->pending[k] >>= 1;
+            if ((m->pending[k] & 1) && pattern_matches(m, &m->patterns[k])) {
+                cb(ctx, k, i + 1);
+            }
+            m->pending[k] &= ~1u;
+            if (m->pending[k] == 0) {
+                m->pending_patterns &= ~(1u << k);
+            }
+        }
+
+        uint16_t s = m->state;
+        uint16_t next;
+        while ((next = node_child(m, s, c)) == 0 && s != 0) {
+            s = m->nodes[s].fail;
+        }
+        m->state = next;
+        uint8_t out = m->nodes[next].out;
+        if (next == 0 || out == 0) {
+            continue;
+        }
+
+        for (int k = 0; out != 0; k++, out >>= 1) {
+            if (!(out & 1)) {
+                continue;
+            }
+            const trigger_pattern_t *pat = &m->patterns[k];
+            if (pat->anchor_end == pat->len) {
+                if (pattern_matches(m, pat)) {
+                    cb(ctx, k, i + 1);
+                }
+            } else {
+                m->pending[k] |= 1u << (pat->len - pat->anchor_end);
+                m->pending_patterns |= 1u << k;
+            }
+        }
+    }
+}
+
+void trigger_history_init(trigger_history_t *h) {
+    h->head = 0;
+    h->tail = 0;
+}
+
+static void history_copy_in(trigger_history_t *h, uint32_t pos, const uint8_t *data, size_t len) {
+    uint32_t off = pos % TRIGGER_HISTORY_SIZE;
+    size_t first = TRIGGER_HISTORY_SIZE - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(h->buf + off, data, first);
+    memcpy(h->buf, data + first, len - first);
+}
+
+static void history_copy_out(const trigger_history_t *h, uint32_t pos, uint8_t *dst, size_t len) {
+    uint32_t off = pos % TRIGGER_HISTORY_SIZE;
+    size_t first = TRIGGER_HISTORY_SIZE - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, h->buf + off, first);
+    memcpy(dst + first, h->buf, len - first);
+}
+
+static size_t history_rec_len(const trigger_history_t *h, uint32_t pos) {
+    ulog_rec_hdr_t hdr;
+    history_copy_out(h, pos, (uint8_t *) &hdr, sizeof(hdr));
+    return sizeof(hdr) + hdr.len;
+}
+
+bool trigger_history_push(trigger_history_t *h, const uint8_t *rec, size_t len) {
+    if (len > TRIGGER_HISTORY_REC_MAX) {
+        return false;
+    }
+    while (h->head - h->tail + len > TRIGGER_HISTORY_SIZE) {
+        h->tail += history_rec_len(h, h->tail);
+    }
+    history_copy_in(h, h->head, rec, len);
+    h->head += len;
+    return true;
+}
+
+void trigger_history_flush(trigger_history_t *h, int64_t from_us, trigger_rec_cb_t cb, void *ctx) {
+    while (h->tail != h->head) {
+        size_t len = history_rec_len(h, h->tail);
+        history_copy_out(h, h->tail, h->out, len);
+        h->tail += len;
+
+        ulog_rec_hdr_t hdr;
+        memcpy(&hdr, h->out, sizeof(hdr));
+        if (hdr.ts_us >= from_us) {
+            cb(ctx, h->out, len);
+        }
+    }
+    trigger_history_init(h);
+}
@@ -0,0 +1,101 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+/*
+ * Capture triggers.
+ *
+ * A trigger spec is a comma separated list of hex byte patterns, where
+ * '?' matches any nibble ("a5??01,0d0a", "7e?1"). All patterns are
+ * searched for at once: an Aho-Corasick automaton finds the longest
+ * fully specified run of each pattern in the byte stream and the whole
+ * pattern, masks included, is then checked against the bytes around it.
+ *
+ * trigger_history_t keeps the newest records in a circular buffer so
+ * the data leading up to a trigger can still be published.
+ *
+ * Plain C only, shared by the firmware and the host tools.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRIGGER_PATTERNS_MAX    (8)
+#define TRIGGER_PATTERN_MAX     (32)    // bytes per pattern, a power of two
+#define TRIGGER_SPEC_MAX        (128)
+#define TRIGGER_NODES_MAX       (TRIGGER_PATTERNS_MAX * TRIGGER_PATTERN_MAX + 1)
+
+#define TRIGGER_HISTORY_SIZE    (8 * 1024)
+/* Largest record the history keeps, header included */
+#define TRIGGER_HISTORY_REC_MAX (16 + 1024)
+
+typedef struct {
+    uint8_t value[TRIGGER_PATTERN_MAX];
+    uint8_t mask[TRIGGER_PATTERN_MAX];
+    uint8_t len;
+    uint8_t anchor_end;         // end of the exact run the automaton looks for
+} trigger_pattern_t;
+
+typedef struct {
+    uint16_t child;             // first child, 0 if none
+    uint16_t sibling;
+    uint16_t fail;
+    uint8_t byte;
+    uint8_t out;                // patterns whose anchor ends here, bit per pattern
+} trigger_node_t;
+
+typedef struct {
+    trigger_pattern_t patterns[TRIGGER_PATTERNS_MAX];
+    int pattern_count;
+    trigger_node_t nodes[TRIGGER_NODES_MAX];
+    uint16_t node_count;
+    uint16_t root_next[256];    // transitions out of the root, the common case
+    uint16_t state;
+    uint8_t recent[TRIGGER_PATTERN_MAX];
+    uint32_t seen;              // bytes scanned
+    /* anchors found whose pattern is not complete yet: bit n set when
+     * the pattern ends n bytes from now, one word per pattern so every
+     * overlapping occurrence is checked */
+    uint32_t pending[TRIGGER_PATTERNS_MAX];
+    uint8_t pending_patterns;   // bit per pattern with pending != 0
+} trigger_matcher_t;
+
+/* end is the offset in data just after the last byte of the match */
+typedef void (*trigger_match_cb_t)(void *ctx, int pattern, size_t end);
+
+/* Build the matcher from a spec. Returns the number of patterns, or -1
+ * on a syntax error or a pattern without a fully specified byte. */
+int trigger_compile(trigger_matcher_t *m, const char *spec);
+
+/* Scan the next bytes of the stream, matches may span calls */
+void trigger_scan(trigger_matcher_t *m, const uint8_t *data, size_t len, trigger_match_cb_t cb, void *ctx);
+
+typedef struct {
+    uint8_t buf[TRIGGER_HISTORY_SIZE];
+    uint32_t head;              // free running write position
+    uint32_t tail;              // oldest record
+    uint8_t out[TRIGGER_HISTORY_REC_MAX];
+} trigger_history_t;
+
+/* Called with a whole record, ulog_rec_hdr_t and payload */
+typedef void (*trigger_rec_cb_t)(void *ctx, uint8_t *rec, size_t len);
+
+void trigger_history_init(trigger_history_t *h);
+
+/* Keep a whole record, dropping the oldest ones to make room. Returns
+ * false if the record is larger than TRIGGER_HISTORY_REC_MAX. */
+bool trigger_history_push(trigger_history_t *h, const uint8_t *rec, size_t len);
+
+/* Hand out the kept records stamped from_us or later, oldest first, and
+ * empty the history */
+void trigger_history_flush(trigger_history_t *h, int64_t from_us, trigger_rec_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TRIGGER_H
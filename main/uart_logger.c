@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+#include "esp_spiffs.h"
+
+#include "uart_logger.h"
+#include "ulog_format.h"
+#include "log_segments.h"
+#include "metrics.h"
+
+static const char *TAG = "uart_logger";
+
+/* Every write starts on a SPIFFS page: the file header takes a whole
+ * page and blocks are padded to whole pages, so no page is rewritten */
+#define LOGGER_PAGE_SIZE    (CONFIG_SPIFFS_PAGE_SIZE)
+#define LOGGER_PAGE_ALIGN(len) (((len) + LOGGER_PAGE_SIZE - 1) / LOGGER_PAGE_SIZE * LOGGER_PAGE_SIZE)
+#define LOGGER_BLOCK_SIZE   (16 * LOGGER_PAGE_SIZE)
+#define LOGGER_BLOCK_COUNT  (6)
+_Static_assert(LOGGER_BLOCK_SIZE <= ULZ_BLOCK_MAX, "log blocks must fit one compressed block");
+_Static_assert(sizeof(ulog_file_hdr_t) <= LOGGER_PAGE_SIZE, "the file header must fit one page");
+/* Partially filled block is written after the line was quiet this long */
+#define LOGGER_IDLE_FLUSH_US (500 * 1000)
+
+#define LOGGER_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
+
+typedef struct {
+    uint32_t len;
+    int64_t first_us;           // timestamp of the first record
+    bool flush;                 // sync the file after writing this block
+    uint8_t data[LOGGER_BLOCK_SIZE];
+} logger_block_t;
+
+struct uart_logger {
+    uart_logger_config_t config;
+    char base_path[ESP_VFS_PATH_MAX + 1];
+
+    logger_block_t *pool;
+    QueueHandle_t free_q;
+    QueueHandle_t full_q;       // NULL item asks the writer to stop
+    SemaphoreHandle_t done;
+    TaskHandle_t writer_hdl;
+
+    /* producer side */
+    logger_block_t *cur;
+    int64_t cur_last_us;
+    bool dropping;              // records are being dropped, counted as one episode
+
+    /* writer side */
+    FILE *fd;
+    FILE *index_fd;             // time index of the open segment, may be NULL
+    char filepath[LOGGER_PATH_MAX];
+    const char *filename;       // points into filepath, past the base path
+    uint32_t seg_size;
+    int64_t seg_open_us;        // monotonic
+    ulz_state_t *lz_state;      // only allocated when compressing
+    uint8_t *lz_out;            // page aligned size
+
+    uart_logger_stats_t stats;
+};
+
+/* Shared by the loggers of all ports */
+static bool metrics_ready = false;
+static metrics_hist_t write_us_metric;
+static metrics_counter_t dropped_metric;
+static metrics_counter_t errors_metric;
+
+static void logger_metrics_init(void) {
+    if (metrics_ready) {
+        return;
+    }
+    metrics_hist_init(&write_us_metric, "logger_write_duration_us", "Time to write one log block to flash",
+                      NULL, NULL);
+    metrics_counter_init(&dropped_metric, "logger_dropped_bytes_total",
+                         "Captured bytes not logged, no free block or a failed write", NULL, NULL);
+    metrics_counter_init(&errors_metric, "logger_write_errors_total", "Failed log file writes", NULL, NULL);
+    metrics_ready = true;
+}
+
+static int64_t wall_time_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void logger_close_file(uart_logger_t *logger) {
+    if (logger->fd == NULL) {
+        return;
+    }
+    fclose(logger->fd);
+    logger->fd = NULL;
+    if (logger->index_fd != NULL) {
+        fclose(logger->index_fd);
+        logger->index_fd = NULL;
+    }
+    log_segments_update(logger->filename, logger->seg_size, wall_time_us());
+    log_segments_close(logger->filename);
+}
+
+/* Delete the oldest segments until there is room for need bytes */
+static void logger_enforce_retention(uart_logger_t *logger, size_t need) {
+    size_t total = 0, used = 0;
+    while (esp_spiffs_info(NULL, &total, &used) == ESP_OK && used + need + logger->config.min_free > total) {
+        if (!log_segments_delete_oldest()) {
+            break;
+        }
+        logger->stats.segments_deleted++;
+    }
+}
+
+static esp_err_t logger_open_file(uart_logger_t *logger) {
+    uint16_t rndId = esp_random() % 1000;
+    struct stat file_stat;
+    struct timeval tv;
+    struct tm timeinfo;
+
+    gettimeofday(&tv, NULL);
+    localtime_r(&tv.tv_sec, &timeinfo);
+    do {
+        snprintf(logger->filepath, sizeof(logger->filepath), "%s/%02d%02d%02d%02d%02d_%d_u%d" ULOG_FILE_EXT,
+                 logger->base_path, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                 timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, rndId, logger->config.port);
+        rndId += 1;
+    } while (stat(logger->filepath, &file_stat) == 0); // == 0  file exist
+
+    ESP_LOGI(TAG, "log file path %s", logger->filepath);
+    logger->filename = logger->filepath + strlen(logger->base_path) + 1;
+    logger->fd = fopen(logger->filepath, "w");
+    if (logger->fd == NULL) {
+        ESP_LOGE(TAG, "Failed to create log file : %s", logger->filepath);
+        return ESP_FAIL;
+    }
+    /* blocks are already page sized, skip the stdio copy */
+    setvbuf(logger->fd, NULL, _IONBF, 0);
+
+    /* the header fills the first page, readers skip up to hdr_len */
+    uint8_t page[LOGGER_PAGE_SIZE];
+    ulog_file_hdr_t hdr;
+    ulog_file_hdr_init(&hdr, (int64_t) tv.tv_sec * 1000000 + tv.tv_usec, esp_timer_get_time(),
+                       logger->config.baud_rate);
+    hdr.hdr_len = sizeof(page);
+    if (logger->config.compress) {
+        hdr.flags |= ULOG_FILE_F_LZ;
+    }
+    memset(page, ULOG_PAD, sizeof(page));
+    memcpy(page, &hdr, sizeof(hdr));
+    if (fwrite(page, sizeof(page), 1, logger->fd) != 1) {
+        fclose(logger->fd);
+        logger->fd = NULL;
+        unlink(logger->filepath);
+        return ESP_FAIL;
+    }
+
+    /* the index is optional, readers fall back to scanning the segment */
+    char index_path[LOGGER_PATH_MAX];
+    if (ulog_index_name(index_path, sizeof(index_path), logger->filepath)) {
+        logger->index_fd = fopen(index_path, "w");
+    }
+    if (logger->index_fd == NULL) {
+        ESP_LOGW(TAG, "No time index for %s", logger->filepath);
+    }
+
+    logger->seg_size = sizeof(page);
+    logger->seg_open_us = hdr.mono_us;
+    logger->stats.segments_opened++;
+    log_segments_add(logger->filename, hdr.wall_us);
+    return ESP_OK;
+}
+
+static void logger_write_block(uart_logger_t *logger, logger_block_t *block) {
+    uint8_t *data = block->data;
+    size_t len = block->len;
+
+    if (logger->lz_state != NULL) {
+        len = ulz_block_encode(logger->lz_state, block->data, block->len, logger->lz_out);
+        data = logger->lz_out;
+    }
+    /* idle flushes and compression leave a partial last page */
+    size_t padded = LOGGER_PAGE_ALIGN(len);
+    memset(data + len, ULOG_PAD, padded - len);
+    logger->stats.bytes_padded += padded - len;
+    len = padded;
+
+    /* rotate */
+    if (logger->fd != NULL
+        && (logger->seg_size + len > logger->config.segment_size
+            || esp_timer_get_time() - logger->seg_open_us > (int64_t) logger->config.segment_age_s * 1000000)) {
+        logger_close_file(logger);
+    }
+
+    logger_enforce_retention(logger, len + (logger->fd == NULL ? LOGGER_PAGE_SIZE : 0));
+
+    if (logger->fd == NULL && logger_open_file(logger) != ESP_OK) {
+        logger->stats.write_errors++;
+        logger->stats.bytes_dropped += block->len;
+        metrics_counter_add(&errors_metric, 1);
+        metrics_counter_add(&dropped_metric, block->len);
+        return;
+    }
+
+    ulog_index_entry_t entry = {
+            .ts_us = block->first_us,
+            .offset = logger->seg_size,
+    };
+
+    int64_t start = esp_timer_get_time();
+    size_t written = fwrite(data, 1, len, logger->fd);
+    if (written != len && log_segments_delete_oldest()) {
+        /* storage full after all, make room and retry once */
+        logger->stats.segments_deleted++;
+        written += fwrite(data + written, 1, len - written, logger->fd);
+    }
+    if (written == len && logger->index_fd != NULL) {
+        /* stdio buffered, reaches flash every few hundred blocks or on flush */
+        fwrite(&entry, sizeof(entry), 1, logger->index_fd);
+        if (block->flush) {
+            fflush(logger->index_fd);
+        }
+    }
+    if (block->flush) {
+        fsync(fileno(logger->fd));
+    }
+    uint32_t stall = (uint32_t) (esp_timer_get_time() - start);
+    metrics_hist_observe(&write_us_metric, stall);
+
+    if (stall > logger->stats.longest_stall_us) {
+        logger->stats.longest_stall_us = stall;
+    }
+    logger->seg_size += written;
+    logger->stats.bytes_written += written;
+    logger->stats.blocks_written++;
+
+    if (written != len) {
+        /* storage broken, start over with a new segment next time. A
+         * partial compressed block is useless, count the whole block. */
+        ESP_LOGE(TAG, "Failed to write log file : %s", logger->filepath);
+        logger->stats.write_errors++;
+        logger->stats.bytes_dropped += block->len;
+        metrics_counter_add(&errors_metric, 1);
+        metrics_counter_add(&dropped_metric, block->len);
+        logger_close_file(logger);
+        return;
+    }
+    logger->stats.bytes_raw += block->len;
+    log_segments_update(logger->filename, logger->seg_size, wall_time_us());
+}
+
+static void logger_writer_task(void *args) {
+    uart_logger_t *logger = args;
+    logger_block_t *block;
+
+    while (1) {
+        xQueueReceive(logger->full_q, &block, portMAX_DELAY);
+        if (block == NULL) {
+            break;
+        }
+        logger_write_block(logger, block);
+        block->len = 0;
+        block->flush = false;
+        xQueueSend(logger->free_q, &block, portMAX_DELAY);
+    }
+
+    logger_close_file(logger);
+    xSemaphoreGive(logger->done);
+    vTaskDelete(NULL);
+}
+
+static void logger_submit(uart_logger_t *logger, bool flush) {
+    logger->cur->flush = flush;
+    xQueueSend(logger->full_q, &logger->cur, 0);
+    logger->cur = NULL;
+
+    uint32_t depth = uxQueueMessagesWaiting(logger->full_q);
+    if (depth > logger->stats.queue_depth_max) {
+        logger->stats.queue_depth_max = depth;
+    }
+}
+
+void uart_logger_append(uart_logger_t *logger, uint8_t flags, uint32_t aux, int64_t ts_us, const uint8_t *data,
+                        uint16_t len) {
+    size_t rec_len = sizeof(ulog_rec_hdr_t) + len;
+
+    if (logger->cur != NULL && logger->cur->len + rec_len > LOGGER_BLOCK_SIZE) {
+        logger_submit(logger, false);
+    }
+    if (logger->cur == NULL && xQueueReceive(logger->free_q, &logger->cur, 0) != pdTRUE) {
+        if (!logger->dropping) {
+            logger->dropping = true;
+            logger->stats.drop_episodes++;
+        }
+        logger->stats.bytes_dropped += rec_len;
+        metrics_counter_add(&dropped_metric, rec_len);
+        return;
+    }
+    logger->dropping = false;
+
+    /* records never straddle blocks */
+    if (logger->cur->len == 0) {
+        logger->cur->first_us = ts_us;
+    }
+    logger->cur->len += ulog_rec_encode(logger->cur->data + logger->cur->len, flags, aux, ts_us, data, len);
+    logger->cur_last_us = ts_us;
+}
+
+void uart_logger_poll(uart_logger_t *logger, int64_t now_us) {
+    if (logger->cur != NULL && logger->cur->len > 0 && now_us - logger->cur_last_us > LOGGER_IDLE_FLUSH_US) {
+        logger_submit(logger, true);
+    }
+}
+
+void uart_logger_get_stats(uart_logger_t *logger, uart_logger_stats_t *stats) {
+    *stats = logger->stats;
+    stats->queue_depth = uxQueueMessagesWaiting(logger->full_q);
+}
+
+esp_err_t uart_logger_create(const uart_logger_config_t *config, uart_logger_t **ret_logger) {
+    uart_logger_t *logger = calloc(1, sizeof(uart_logger_t));
+    if (logger == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    logger_metrics_init();
+    logger->config = *config;
+    strlcpy(logger->base_path, config->base_path, sizeof(logger->base_path));
+    logger->config.base_path = logger->base_path;
+    if (logger->config.segment_size == 0) {
+        logger->config.segment_size = UART_LOGGER_SEGMENT_SIZE_DEFAULT;
+    }
+    if (logger->config.segment_age_s == 0) {
+        logger->config.segment_age_s = UART_LOGGER_SEGMENT_AGE_DEFAULT;
+    }
+    if (logger->config.min_free == 0) {
+        logger->config.min_free = UART_LOGGER_MIN_FREE_DEFAULT;
+    }
+
+    logger->pool = calloc(LOGGER_BLOCK_COUNT, sizeof(logger_block_t));
+    logger->free_q = xQueueCreate(LOGGER_BLOCK_COUNT, sizeof(logger_block_t *));
+    /* one extra slot for the stop request */
+    logger->full_q = xQueueCreate(LOGGER_BLOCK_COUNT + 1, sizeof(logger_block_t *));
+    logger->done = xSemaphoreCreateBinary();
+    if (logger->config.compress) {
+        logger->lz_state = malloc(sizeof(ulz_state_t));
+        logger->lz_out = malloc(LOGGER_PAGE_ALIGN(sizeof(ulz_block_hdr_t) + ULZ_BOUND(LOGGER_BLOCK_SIZE)));
+        if (!logger->lz_state || !logger->lz_out) {
+            ESP_LOGE(TAG, "Failed to allocate compressor");
+            goto err;
+        }
+    }
+    if (!logger->pool || !logger->free_q || !logger->full_q || !logger->done) {
+        ESP_LOGE(TAG, "Failed to allocate logger");
+        goto err;
+    }
+
+    for (int i = 0; i < LOGGER_BLOCK_COUNT; i++) {
+        logger_block_t *block = &logger->pool[i];
+        xQueueSend(logger->free_q, &block, 0);
+    }
+
+    if (xTaskCreate(logger_writer_task, "log_writer", 4096, logger, 3, &logger->writer_hdl) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        goto err;
+    }
+
+    *ret_logger = logger;
+    return ESP_OK;
+
+    err:
+    if (logger->done) {
+        vSemaphoreDelete(logger->done);
+    }
+    if (logger->full_q) {
+        vQueueDelete(logger->full_q);
+    }
+    if (logger->free_q) {
+        vQueueDelete(logger->free_q);
+    }
+    free(logger->lz_out);
+    free(logger->lz_state);
+    free(logger->pool);
+    free(logger);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t uart_logger_delete(uart_logger_t *logger) {
+    if (logger == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* flush on stop */
+    if (logger->cur != NULL) {
+        if (logger->cur->len > 0) {
+            logger_submit(logger, true);
+        } else {
+            xQueueSend(logger->free_q, &logger->cur, 0);
+            logger->cur = NULL;
+        }
+    }
+    logger_block_t *stop = NULL;
+    xQueueSend(logger->full_q, &stop, portMAX_DELAY);
+    xSemaphoreTake(logger->done, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "log closed, %" PRIu32 " bytes written for %" PRIu32 " captured, %" PRIu32 " dropped, "
+                  "longest stall %" PRIu32 " us",
+             logger->stats.bytes_written, logger->stats.bytes_raw, logger->stats.bytes_dropped,
+             logger->stats.longest_stall_us);
+
+    vSemaphoreDelete(logger->done);
+    vQueueDelete(logger->full_q);
+    vQueueDelete(logger->free_q);
+    free(logger->lz_out);
+    free(logger->lz_state);
+    free(logger->pool);
+    free(logger);
+    return ESP_OK;
+}
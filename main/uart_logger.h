@@ -0,0 +1,81 @@
+#ifndef UART_LOGGER_H
+#define UART_LOGGER_H
+
+/*
+ * Capture log writer.
+ *
+ * The receive task appends records into pre-allocated blocks and hands
+ * full blocks to a lower priority writer task, so a slow SPIFFS write or
+ * garbage collection never blocks uart draining. When no free block is
+ * available the record is dropped and counted instead.
+ *
+ * With compress set the writer stores every block as one ulog_lz block,
+ * capture traffic is repetitive enough that this usually halves the
+ * flash bytes written per captured byte.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct uart_logger uart_logger_t;
+
+typedef struct {
+    int baud_rate;
+    int port;                   // uart number, part of the file names
+    const char *base_path;      // directory the log files are created in
+    uint32_t segment_size;      // start a new segment after this many bytes, 0 for default
+    uint32_t segment_age_s;     // start a new segment after this many seconds, 0 for default
+    uint32_t min_free;          // delete the oldest segments to keep this many bytes free, 0 for default
+    bool compress;              // compress blocks before writing them
+} uart_logger_config_t;
+
+#define UART_LOGGER_SEGMENT_SIZE_DEFAULT    (128 * 1024)
+#define UART_LOGGER_SEGMENT_AGE_DEFAULT     (60 * 60)
+#define UART_LOGGER_MIN_FREE_DEFAULT        (64 * 1024)
+/* Limits for user supplied values. A segment holds at least the header
+ * page and one full block; retention needs room for a closed segment
+ * next to the open one on the 1600K storage partition. */
+#define UART_LOGGER_SEGMENT_SIZE_MIN        (8 * 1024)
+#define UART_LOGGER_SEGMENT_SIZE_MAX        (512 * 1024)
+#define UART_LOGGER_MIN_FREE_MAX            (512 * 1024)
+
+typedef struct {
+    uint32_t queue_depth;       // blocks waiting for the writer
+    uint32_t queue_depth_max;
+    uint32_t blocks_written;
+    uint32_t drop_episodes;     // times the producer ran out of free blocks, see bytes_dropped
+    uint32_t bytes_written;     // bytes stored on flash
+    uint32_t bytes_padded;      // of those, filler up to the next flash page
+    uint32_t bytes_raw;         // record bytes those stand for, before compression
+    uint32_t bytes_dropped;
+    uint32_t write_errors;
+    uint32_t longest_stall_us;  // longest single block write
+    uint32_t segments_opened;
+    uint32_t segments_deleted;  // removed by the retention policy
+} uart_logger_stats_t;
+
+esp_err_t uart_logger_create(const uart_logger_config_t *config, uart_logger_t **ret_logger);
+
+/* Flush everything queued, close the file and free the logger */
+esp_err_t uart_logger_delete(uart_logger_t *logger);
+
+/* Producer side, only called from one task */
+void uart_logger_append(uart_logger_t *logger, uint8_t flags, uint32_t aux, int64_t ts_us, const uint8_t *data,
+                        uint16_t len);
+
+/* Producer side, hand a partially filled block to the writer once the
+ * line has been idle for a while. Call it when a read times out. */
+void uart_logger_poll(uart_logger_t *logger, int64_t now_us);
+
+void uart_logger_get_stats(uart_logger_t *logger, uart_logger_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //UART_LOGGER_H
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "uart_ring.h"
+
+bool uart_ring_init(uart_ring_t *ring, uint8_t *buf, uint32_t size) {
+    if (ring == NULL || buf == NULL || size == 0 || (size & (size - 1)) != 0) {
+        return false;
+    }
+
+    ring->buf = buf;
+    ring->size = size;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->reserve, 0);
+    return true;
+}
+
+static void ring_copy_in(uart_ring_t *ring, uint32_t pos, const uint8_t *data, uint32_t len) {
+    uint32_t off = pos & ring->mask;
+    uint32_t first = ring->size - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(ring->buf + off, data, first);
+    memcpy(ring->buf, data + first, len - first);
+}
+
+static void ring_copy_out(const uart_ring_t *ring, uint32_t pos, uint8_t *dst, uint32_t len) {
+    uint32_t off = pos & ring->mask;
+    uint32_t first = ring->size - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, ring->buf + off, first);
+    memcpy(dst + first, ring->buf, len - first);
+}
+
+void uart_ring_write(uart_ring_t *ring, const uint8_t *data, uint32_t len) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (len > ring->size) {
+        /* only the newest bytes can survive anyway */
+        head += len - ring->size;
+        data += len - ring->size;
+        len = ring->size;
+    }
+
+    /* announce the slots we are about to overwrite before touching them,
+     * readers check this after copying to detect torn reads */
+    atomic_store_explicit(&ring->reserve, head + len, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    ring_copy_in(ring, head, data, len);
+
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+void uart_ring_reader_attach(uart_ring_t *ring, uart_ring_reader_t *reader) {
+    reader->pos = atomic_load_explicit(&ring->head, memory_order_acquire);
+    reader->overrun_bytes = 0;
+    reader->overrun_count = 0;
+}
+
+uint32_t uart_ring_readable(uart_ring_t *ring, const uart_ring_reader_t *reader) {
+    uint32_t avail = atomic_load_explicit(&ring->head, memory_order_acquire) - reader->pos;
+    return avail > ring->size ? ring->size : avail;
+}
+
+uint32_t uart_ring_read(uart_ring_t *ring, uart_ring_reader_t *reader, uint8_t *dst, uint32_t max) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t pos = reader->pos;
+    uint32_t lost = 0;
+
+    if (head - pos > ring->size) {
+        lost = head - pos - ring->size;
+        pos = head - ring->size;
+    }
+
+    uint32_t len = head - pos;
+    if (len > max) {
+        len = max;
+    }
+    ring_copy_out(ring, pos, dst, len);
+
+    /* anything the producer started overwriting while we copied is garbage */
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t reserve = atomic_load_explicit(&ring->reserve, memory_order_relaxed);
+    if (reserve - pos > ring->size) {
+        uint32_t torn = reserve - pos - ring->size;
+        if (torn > len) {
+            torn = len;
+        }
+        memmove(dst, dst + torn, len - torn);
+        lost += torn;
+        pos += torn;
+        len -= torn;
+    }
+
+    if (lost > 0) {
+        reader->overrun_bytes += lost;
+        reader->overrun_count++;
+    }
+    reader->pos = pos + len;
+    return len;
+}
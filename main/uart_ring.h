@@ -0,0 +1,55 @@
+#ifndef UART_RING_H
+#define UART_RING_H
+
+/*
+ * Fixed capacity byte ring shared between the uart receive task (single
+ * producer) and its consumers. The producer never blocks: when a reader
+ * falls more than one ring size behind, the oldest bytes are overwritten
+ * and accounted in that reader's overrun counters instead.
+ *
+ * Plain C11 only, so it can also be built and stress tested on the host.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;              /* capacity, power of two */
+    uint32_t mask;
+    _Atomic uint32_t head;      /* total bytes published, wraps at 2^32 */
+    _Atomic uint32_t reserve;   /* head + length of the write in progress */
+} uart_ring_t;
+
+typedef struct {
+    uint32_t pos;               /* total bytes consumed by this reader */
+    uint32_t overrun_bytes;     /* bytes lost because the producer lapped us */
+    uint32_t overrun_count;     /* number of times that happened */
+} uart_ring_reader_t;
+
+/* buf must stay valid for the ring lifetime, size must be a power of two */
+bool uart_ring_init(uart_ring_t *ring, uint8_t *buf, uint32_t size);
+
+/* Producer side, only one task may call this */
+void uart_ring_write(uart_ring_t *ring, const uint8_t *data, uint32_t len);
+
+/* Position the reader at the current head, so it only sees new data */
+void uart_ring_reader_attach(uart_ring_t *ring, uart_ring_reader_t *reader);
+
+/* Bytes the reader could get right now (capped at ring size) */
+uint32_t uart_ring_readable(uart_ring_t *ring, const uart_ring_reader_t *reader);
+
+/* Copy up to max bytes into dst and advance the reader, returns bytes copied.
+ * Each reader must only be used from one task at a time. */
+uint32_t uart_ring_read(uart_ring_t *ring, uart_ring_reader_t *reader, uint8_t *dst, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //UART_RING_H
@@ -0,0 +1,230 @@
+#include <string.h>
+#include <time.h>
+
+#include "ulog_format.h"
+
+void ulog_file_hdr_init(ulog_file_hdr_t *hdr, int64_t wall_us, int64_t mono_us, uint32_t baud_rate) {
+    memset(hdr, 0, sizeof(ulog_file_hdr_t));
+    memcpy(hdr->magic, ULOG_MAGIC, sizeof(hdr->magic));
+    hdr->version = ULOG_VERSION;
+    hdr->hdr_len = sizeof(ulog_file_hdr_t);
+    hdr->wall_us = wall_us;
+    hdr->mono_us = mono_us;
+    hdr->baud_rate = baud_rate;
+}
+
+bool ulog_file_hdr_valid(const ulog_file_hdr_t *hdr) {
+    return memcmp(hdr->magic, ULOG_MAGIC, sizeof(hdr->magic)) == 0
+           && hdr->version >= 1
+           && hdr->hdr_len >= sizeof(ulog_file_hdr_t);
+}
+
+size_t ulog_rec_encode(uint8_t *dst, uint8_t flags, uint32_t aux, int64_t ts_us, const uint8_t *data,
+                       uint16_t len) {
+    ulog_rec_hdr_t hdr = {
+            .sync = ULOG_REC_SYNC,
+            .flags = flags,
+            .len = len,
+            .aux = aux,
+            .ts_us = ts_us,
+    };
+    memcpy(dst, &hdr, sizeof(hdr));
+    memcpy(dst + sizeof(hdr), data, len);
+    return sizeof(hdr) + len;
+}
+
+void ulog_decoder_init(ulog_decoder_t *dec) {
+    dec->file_fill = 0;
+    dec->rec_fill = 0;
+    dec->resyncs = 0;
+    dec->bad_file = false;
+    ulz_reader_init(&dec->lz);
+}
+
+static void decode_records(ulog_decoder_t *dec, const uint8_t *data, size_t len, ulog_rec_cb_t cb, void *ctx);
+
+struct lz_bridge {
+    ulog_decoder_t *dec;
+    ulog_rec_cb_t cb;
+    void *ctx;
+};
+
+static void lz_bridge_cb(void *ctx, const uint8_t *data, size_t len) {
+    struct lz_bridge *bridge = ctx;
+    decode_records(bridge->dec, data, len, bridge->cb, bridge->ctx);
+}
+
+bool ulog_decode(ulog_decoder_t *dec, const uint8_t *data, size_t len, ulog_rec_cb_t cb, void *ctx) {
+    const uint8_t *end = data + len;
+
+    if (dec->bad_file) {
+        return false;
+    }
+
+    /* file header, including any trailing fields of newer writers */
+    while (data < end && (dec->file_fill < sizeof(ulog_file_hdr_t) || dec->file_fill < dec->file.hdr_len)) {
+        if (dec->file_fill < sizeof(ulog_file_hdr_t)) {
+            size_t n = sizeof(ulog_file_hdr_t) - dec->file_fill;
+            if (n > (size_t) (end - data)) {
+                n = end - data;
+            }
+            memcpy((uint8_t *) &dec->file + dec->file_fill, data, n);
+            dec->file_fill += n;
+            data += n;
+            if (dec->file_fill == sizeof(ulog_file_hdr_t) && !ulog_file_hdr_valid(&dec->file)) {
+                dec->bad_file = true;
+                return false;
+            }
+        } else {
+            size_t n = dec->file.hdr_len - dec->file_fill;
+            if (n > (size_t) (end - data)) {
+                n = end - data;
+            }
+            dec->file_fill += n;
+            data += n;
+        }
+    }
+
+    if (data < end && (dec->file.flags & ULOG_FILE_F_LZ)) {
+        struct lz_bridge bridge = {
+                .dec = dec,
+                .cb = cb,
+                .ctx = ctx,
+        };
+        ulz_reader_feed(&dec->lz, data, end - data, lz_bridge_cb, &bridge);
+    } else if (data < end) {
+        decode_records(dec, data, end - data, cb, ctx);
+    }
+    return true;
+}
+
+static void decode_records(ulog_decoder_t *dec, const uint8_t *data, size_t len, ulog_rec_cb_t cb, void *ctx) {
+    const uint8_t *end = data + len;
+
+    while (data < end) {
+        if (dec->rec_fill == 0) {
+            if (*data != ULOG_REC_SYNC) {
+                dec->resyncs += *data != ULOG_PAD;
+                data++;
+                continue;
+            }
+
+            /* fast path, whole record available in the input */
+            if ((size_t) (end - data) >= sizeof(ulog_rec_hdr_t)) {
+                ulog_rec_hdr_t hdr;
+                memcpy(&hdr, data, sizeof(hdr));
+                if (hdr.len > ULOG_REC_MAX) {
+                    dec->resyncs++;
+                    data++;
+                    continue;
+                }
+                if ((size_t) (end - data) >= sizeof(hdr) + hdr.len) {
+                    cb(ctx, &dec->file, &hdr, data + sizeof(hdr));
+                    data += sizeof(hdr) + hdr.len;
+                    continue;
+                }
+            }
+        }
+
+        /* slow path, record split across calls */
+        size_t need;
+        if (dec->rec_fill < sizeof(ulog_rec_hdr_t)) {
+            need = sizeof(ulog_rec_hdr_t) - dec->rec_fill;
+        } else {
+            need = sizeof(ulog_rec_hdr_t) + dec->rec.hdr.len - dec->rec_fill;
+        }
+        if (need > (size_t) (end - data)) {
+            need = end - data;
+        }
+        memcpy(dec->rec.raw + dec->rec_fill, data, need);
+        dec->rec_fill += need;
+        data += need;
+
+        if (dec->rec_fill == sizeof(ulog_rec_hdr_t) && dec->rec.hdr.len > ULOG_REC_MAX) {
+            dec->resyncs++;
+            dec->rec_fill = 0;
+            continue;
+        }
+        if (dec->rec_fill >= sizeof(ulog_rec_hdr_t) && dec->rec_fill == sizeof(ulog_rec_hdr_t) + dec->rec.hdr.len) {
+            cb(ctx, &dec->file, &dec->rec.hdr, dec->rec.raw + sizeof(ulog_rec_hdr_t));
+            dec->rec_fill = 0;
+        }
+    }
+}
+
+bool ulog_index_name(char *dst, size_t size, const char *name) {
+    size_t len = strlen(name);
+    size_t ext_len = sizeof(ULOG_FILE_EXT) - 1;
+    if (len < ext_len || strcmp(name + len - ext_len, ULOG_FILE_EXT) != 0 || len >= size) {
+        return false;
+    }
+    memcpy(dst, name, len - ext_len);
+    memcpy(dst + len - ext_len, ULOG_INDEX_EXT, sizeof(ULOG_INDEX_EXT));
+    return true;
+}
+
+int64_t ulog_rec_wall_us(const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr) {
+    return file->wall_us + (hdr->ts_us - file->mono_us);
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char *put2(char *p, int v) {
+    *p++ = (char) ('0' + v / 10);
+    *p++ = (char) ('0' + v % 10);
+    return p;
+}
+
+size_t ulog_format_text(const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data, char *out) {
+    int64_t wall_us = ulog_rec_wall_us(file, hdr);
+    time_t sec = (time_t) (wall_us / 1000000);
+    int ms = (int) ((wall_us % 1000000) / 1000);
+    struct tm timeinfo;
+    localtime_r(&sec, &timeinfo);
+
+    char *p = out;
+    *p++ = '\n';
+    p = put2(p, timeinfo.tm_hour);
+    *p++ = ':';
+    p = put2(p, timeinfo.tm_min);
+    *p++ = ':';
+    p = put2(p, timeinfo.tm_sec);
+    *p++ = '.';
+    *p++ = (char) ('0' + ms / 100);
+    p = put2(p, ms % 100);
+    *p++ = ':';
+    if (ULOG_FLAG_PORT_OF(hdr->flags) != 0) {
+        /* merged query output mixes ports */
+        memcpy(p, " u", 2);
+        p += 2;
+        *p++ = (char) ('0' + ULOG_FLAG_PORT_OF(hdr->flags));
+    }
+    if (hdr->flags & ULOG_FLAG_TX) {
+        memcpy(p, " TX", 3);
+        p += 3;
+    }
+    if (hdr->flags & ULOG_FLAG_FRAME) {
+        memcpy(p, " FRAME", 6);
+        p += 6;
+        if (ULOG_FRAME_STATUS(hdr->aux) != 0) {
+            memcpy(p, " ERR", 4);
+            p += 4;
+            *p++ = (char) ('0' + ULOG_FRAME_STATUS(hdr->aux) % 10);
+        }
+    }
+    if (hdr->flags & ULOG_FLAG_EVENT) {
+        const char *name = hdr->aux == ULOG_EVENT_BREAK ? " BREAK"
+                           : hdr->aux == ULOG_EVENT_TRIGGER ? " TRIGGER" : " OVERFLOW";
+        size_t n = strlen(name);
+        memcpy(p, name, n);
+        p += n;
+    }
+
+    for (uint16_t i = 0; i < hdr->len; i++) {
+        *p++ = ' ';
+        *p++ = hex_digits[data[i] >> 4];
+        *p++ = hex_digits[data[i] & 0x0f];
+    }
+    *p = '\0';
+    return p - out;
+}
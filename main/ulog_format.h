@@ -0,0 +1,157 @@
+#ifndef ULOG_FORMAT_H
+#define ULOG_FORMAT_H
+
+/*
+ * Binary capture log format.
+ *
+ * A log file starts with one ulog_file_hdr_t, padded to hdr_len, followed
+ * by records. Every record is a ulog_rec_hdr_t followed by len raw bytes.
+ * All fields are little endian. Record timestamps come from the monotonic esp_timer
+ * clock; the file header pairs one monotonic time with the wall clock so
+ * readers can render local times.
+ *
+ * A data record is stamped with the estimated arrival of its first byte
+ * and carries the time of one character on the line in aux, byte i
+ * arrived at ts_us + i * aux / 1000. The gap to the previous record is
+ * ts_us minus the end of that record.
+ *
+ * With a decoder configured, frame records follow the data they were
+ * reassembled from and repeat it as one frame, stamped like data.
+ *
+ * With ULOG_FILE_F_LZ set, everything after the file header is a
+ * sequence of ulog_lz blocks whose content is the record stream.
+ *
+ * The writer starts every write on a flash page and fills the rest of
+ * the last page with ULOG_PAD bytes, between records or between blocks.
+ *
+ * Next to each log file the writer keeps a sparse time index with the
+ * same name and ULOG_INDEX_EXT, one ulog_index_entry_t per written
+ * block. Decoding may start at any indexed offset.
+ *
+ * Plain C only, shared by the firmware and the host side decoder.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ulog_lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ULOG_MAGIC          "ULOG"
+#define ULOG_VERSION        (1)
+#define ULOG_FILE_EXT       ".ulg"
+#define ULOG_INDEX_EXT      ".tix"
+
+#define ULOG_REC_SYNC       (0xA5)
+/* Filler a writer may put between records (between blocks in compressed
+ * files) to start the next write on a flash page, readers skip it */
+#define ULOG_PAD            (0xFF)
+/* Largest payload a single record may carry */
+#define ULOG_REC_MAX        (4096)
+
+/* File flags */
+#define ULOG_FILE_F_LZ      (0x01)  // records are stored in compressed blocks
+
+/* Record flags */
+#define ULOG_FLAG_TX        (0x01)  // data sent to the device, otherwise received
+#define ULOG_FLAG_EVENT     (0x02)  // line event marker without data, aux holds a ULOG_EVENT_*
+#define ULOG_FLAG_BURST     (0x04)  // first data after the line was idle
+#define ULOG_FLAG_FRAME     (0x08)  // decoded protocol frame, aux holds ULOG_FRAME_AUX()
+/* Bits 4-5, uart number the record was captured on */
+#define ULOG_FLAG_PORT_SHIFT    (4)
+#define ULOG_FLAG_PORT_MASK     (0x30)
+#define ULOG_FLAG_PORT(port)    ((uint8_t) (((port) << ULOG_FLAG_PORT_SHIFT) & ULOG_FLAG_PORT_MASK))
+#define ULOG_FLAG_PORT_OF(flags) (((flags) & ULOG_FLAG_PORT_MASK) >> ULOG_FLAG_PORT_SHIFT)
+
+/* Line events */
+#define ULOG_EVENT_OVERFLOW (1)     // received data was lost, uart FIFO or driver buffer full
+#define ULOG_EVENT_BREAK    (2)     // break condition on the line
+#define ULOG_EVENT_TRIGGER  (3)     // trigger pattern matched, the payload is its index
+
+/* aux of frame records, decoder (frame_proto_t) and FRAME_OK or error */
+#define ULOG_FRAME_AUX(proto, status)   ((uint32_t) (proto) | ((uint32_t) (status) << 8))
+#define ULOG_FRAME_PROTO(aux)           ((aux) & 0xff)
+#define ULOG_FRAME_STATUS(aux)          (((aux) >> 8) & 0xff)
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t flags;
+    uint16_t hdr_len;       // sizeof(ulog_file_hdr_t) of the writer, lets readers skip newer fields
+    int64_t wall_us;        // unix time in us at mono_us
+    int64_t mono_us;        // monotonic time matching wall_us
+    uint32_t baud_rate;
+    uint32_t reserved;
+} ulog_file_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t sync;           // ULOG_REC_SYNC
+    uint8_t flags;          // ULOG_FLAG_*
+    uint16_t len;           // payload length
+    uint32_t aux;           // ULOG_EVENT_*, ULOG_FRAME_AUX() or ns per byte for data, 0 if unknown
+    int64_t ts_us;          // monotonic time of the record, of its first byte for data
+} ulog_rec_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    int64_t ts_us;          // monotonic time of the first record at offset
+    uint32_t offset;        // file offset of a block start
+} ulog_index_entry_t;
+
+/* Called for each complete record, data points to hdr->len bytes */
+typedef void (*ulog_rec_cb_t)(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data);
+
+/* Incremental decoder, feed it any split of the file bytes */
+typedef struct {
+    ulog_file_hdr_t file;
+    uint32_t file_fill;     // bytes of the file header seen so far
+    uint32_t rec_fill;      // bytes of the current record seen so far
+    uint32_t resyncs;       // garbage bytes skipped looking for a record
+    bool bad_file;          // no valid file header
+    ulz_reader_t lz;        // only used for compressed files
+    union {
+        ulog_rec_hdr_t hdr;
+        uint8_t raw[sizeof(ulog_rec_hdr_t) + ULOG_REC_MAX];
+    } rec;
+} ulog_decoder_t;
+
+void ulog_file_hdr_init(ulog_file_hdr_t *hdr, int64_t wall_us, int64_t mono_us, uint32_t baud_rate);
+
+bool ulog_file_hdr_valid(const ulog_file_hdr_t *hdr);
+
+/* Write a record header and payload into dst, which must hold
+ * sizeof(ulog_rec_hdr_t) + len bytes. Returns the bytes written. */
+size_t ulog_rec_encode(uint8_t *dst, uint8_t flags, uint32_t aux, int64_t ts_us, const uint8_t *data,
+                       uint16_t len);
+
+void ulog_decoder_init(ulog_decoder_t *dec);
+
+/* Consume len bytes, calling cb for every record completed. Returns
+ * false once the input is known not to be a ulog stream. */
+bool ulog_decode(ulog_decoder_t *dec, const uint8_t *data, size_t len, ulog_rec_cb_t cb, void *ctx);
+
+/* Derive the time index file name from a log file name or path.
+ * Returns false if name has no ULOG_FILE_EXT or dst is too small. */
+bool ulog_index_name(char *dst, size_t size, const char *name);
+
+/* Wall clock time of a record in us since the epoch */
+int64_t ulog_rec_wall_us(const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr);
+
+/* Worst case text size of one record */
+#define ULOG_TEXT_MAX(len) (32 + 3 * (size_t) (len))
+
+/* Render a record in the classic text view, "\nHH:MM:SS.mmm: xx xx ..",
+ * with " uN" after the time for records that carry a port, the event name
+ * for event records and " FRAME" (" ERRn" if bad) for frame records.
+ * out must hold ULOG_TEXT_MAX(hdr->len) bytes. Returns the length
+ * written, not counting the terminating zero. */
+size_t ulog_format_text(const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ULOG_FORMAT_H
@@ -0,0 +1,267 @@
+#include <string.h>
+
+#include "ulog_lz.h"
+
+#define MIN_MATCH       (4)
+#define LAST_LITERALS   (5)     // block must end with at least this many literals
+#define MF_LIMIT        (12)    // no match may start in the last MF_LIMIT bytes
+#define MAX_OFFSET      (65535)
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - ULZ_HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+size_t ulz_compress(ulz_state_t *state, const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap) {
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *const iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dst_cap;
+
+    if (len > 0xFFFF) {
+        return 0;
+    }
+    memset(state->table, 0, sizeof(state->table));
+
+    if (len >= MF_LIMIT + 1) {
+        const uint8_t *const mflimit = iend - MF_LIMIT;
+        const uint8_t *const matchlimit = iend - LAST_LITERALS;
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t *ref = src + state->table[h];
+            state->table[h] = (uint16_t) (ip - src);
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+                /* skip faster through incompressible data */
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            /* extend backwards over literals */
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t *mp = ip + MIN_MATCH;
+            const uint8_t *mr = ref + MIN_MATCH;
+            while (mp < matchlimit && *mp == *mr) {
+                mp++;
+                mr++;
+            }
+
+            size_t lit = ip - anchor;
+            size_t ml = mp - ip - MIN_MATCH;
+            if (op + 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1 > oend) {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            if (lit >= 15) {
+                *token = 15 << 4;
+                op = put_length(op, lit - 15);
+            } else {
+                *token = (uint8_t) (lit << 4);
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            uint16_t offset = (uint16_t) (ip - ref);
+            *op++ = (uint8_t) offset;
+            *op++ = (uint8_t) (offset >> 8);
+
+            if (ml >= 15) {
+                *token |= 15;
+                op = put_length(op, ml - 15);
+            } else {
+                *token |= (uint8_t) ml;
+            }
+
+            ip = mp;
+            anchor = ip;
+            if (ip < mflimit) {
+                /* seed the table inside the match for the next search */
+                state->table[hash32(read32(ip - 2))] = (uint16_t) (ip - 2 - src);
+            }
+        }
+    }
+
+    /* last literals */
+    size_t lit = iend - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend) {
+        return 0;
+    }
+    if (lit >= 15) {
+        *op++ = 15 << 4;
+        op = put_length(op, lit - 15);
+    } else {
+        *op++ = (uint8_t) (lit << 4);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+int ulz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap) {
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst)) {
+            return -1;
+        }
+
+        size_t ml = token & 15;
+        if (ml == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += MIN_MATCH;
+        if (ml > (size_t) (oend - op)) {
+            return -1;
+        }
+
+        /* byte copy, source and destination may overlap */
+        const uint8_t *ref = op - offset;
+        while (ml--) {
+            *op++ = *ref++;
+        }
+    }
+    return (int) (op - dst);
+}
+
+size_t ulz_block_encode(ulz_state_t *state, const uint8_t *src, size_t len, uint8_t *dst) {
+    ulz_block_hdr_t hdr = {
+            .magic = ULZ_BLOCK_MAGIC,
+            .flags = 0,
+            .reserved = 0,
+            .raw_len = (uint16_t) len,
+    };
+
+    size_t stored = ulz_compress(state, src, len, dst + sizeof(hdr), len);
+    if (stored == 0) {
+        hdr.flags |= ULZ_BLOCK_STORED;
+        stored = len;
+        memcpy(dst + sizeof(hdr), src, len);
+    }
+    hdr.stored_len = (uint16_t) stored;
+    memcpy(dst, &hdr, sizeof(hdr));
+    return sizeof(hdr) + stored;
+}
+
+void ulz_reader_init(ulz_reader_t *reader) {
+    reader->fill = 0;
+    reader->errors = 0;
+}
+
+static bool block_hdr_valid(const ulz_block_hdr_t *hdr) {
+    return hdr->magic == ULZ_BLOCK_MAGIC
+           && hdr->raw_len <= ULZ_BLOCK_MAX
+           && hdr->stored_len <= ULZ_BOUND(ULZ_BLOCK_MAX)
+           && (!(hdr->flags & ULZ_BLOCK_STORED) || hdr->stored_len == hdr->raw_len);
+}
+
+void ulz_reader_feed(ulz_reader_t *reader, const uint8_t *data, size_t len, ulz_out_cb_t cb, void *ctx) {
+    const uint8_t *end = data + len;
+
+    while (data < end) {
+        if (reader->fill == 0 && *data == ULZ_PAD) {
+            data++;
+            continue;
+        }
+        size_t need;
+        if (reader->fill < sizeof(ulz_block_hdr_t)) {
+            need = sizeof(ulz_block_hdr_t) - reader->fill;
+        } else {
+            need = sizeof(ulz_block_hdr_t) + reader->in.hdr.stored_len - reader->fill;
+        }
+        if (need > (size_t) (end - data)) {
+            need = end - data;
+        }
+        memcpy(reader->in.raw + reader->fill, data, need);
+        reader->fill += need;
+        data += need;
+
+        if (reader->fill < sizeof(ulz_block_hdr_t)) {
+            continue;
+        }
+        if (reader->fill == sizeof(ulz_block_hdr_t) && !block_hdr_valid(&reader->in.hdr)) {
+            /* lost framing, slide forward one byte and look again */
+            reader->errors++;
+            memmove(reader->in.raw, reader->in.raw + 1, sizeof(ulz_block_hdr_t) - 1);
+            reader->fill--;
+            continue;
+        }
+        if (reader->fill < sizeof(ulz_block_hdr_t) + reader->in.hdr.stored_len) {
+            continue;
+        }
+
+        const uint8_t *payload = reader->in.raw + sizeof(ulz_block_hdr_t);
+        if (reader->in.hdr.flags & ULZ_BLOCK_STORED) {
+            cb(ctx, payload, reader->in.hdr.raw_len);
+        } else {
+            int n = ulz_decompress(payload, reader->in.hdr.stored_len, reader->out, sizeof(reader->out));
+            if (n == reader->in.hdr.raw_len) {
+                cb(ctx, reader->out, n);
+            } else {
+                reader->errors++;
+            }
+        }
+        reader->fill = 0;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef ULOG_LZ_H
+#define ULOG_LZ_H
+
+/*
+ * Block compression for capture logs.
+ *
+ * Each log writer block is compressed on its own into the LZ4 block
+ * format (so a compressed block can also be inspected with stock lz4
+ * tools) and stored behind a small ulz_block_hdr_t. Incompressible
+ * blocks are stored as is. Compression needs a fixed ulz_state_t and no
+ * heap, decompression needs one raw and one stored block buffer.
+ *
+ * Plain C only, shared by the firmware and the host tools.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ULZ_BLOCK_MAGIC     (0x5A4C)    // "LZ"
+#define ULZ_BLOCK_MAX       (4096)      // largest raw block
+/* Worst case compressed size of len bytes */
+#define ULZ_BOUND(len)      ((len) + (len) / 255 + 16)
+
+#define ULZ_BLOCK_STORED    (0x01)      // payload is not compressed
+/* Filler between blocks, skipped by the reader, never starts a header */
+#define ULZ_PAD             (0xFF)
+
+#define ULZ_HASH_LOG        (11)
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t reserved;
+    uint16_t raw_len;
+    uint16_t stored_len;
+} ulz_block_hdr_t;
+
+typedef struct {
+    uint16_t table[1 << ULZ_HASH_LOG];
+} ulz_state_t;
+
+/* Compress len bytes (at most 64 KB) of src into dst. Returns the
+ * compressed size, or 0 if it would not fit in dst_cap. */
+size_t ulz_compress(ulz_state_t *state, const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap);
+
+/* Returns the decompressed size, or -1 on corrupt input */
+int ulz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap);
+
+/* Build a complete block (header + payload) into dst, which must hold
+ * sizeof(ulz_block_hdr_t) + ULZ_BOUND(len). Returns the bytes used. */
+size_t ulz_block_encode(ulz_state_t *state, const uint8_t *src, size_t len, uint8_t *dst);
+
+typedef void (*ulz_out_cb_t)(void *ctx, const uint8_t *data, size_t len);
+
+/* Incremental block reader, turns a stream of blocks back into raw bytes */
+typedef struct {
+    uint32_t fill;
+    uint32_t errors;            // corrupt blocks skipped
+    union {
+        ulz_block_hdr_t hdr;
+        uint8_t raw[sizeof(ulz_block_hdr_t) + ULZ_BOUND(ULZ_BLOCK_MAX)];
+    } in;
+    uint8_t out[ULZ_BLOCK_MAX];
+} ulz_reader_t;
+
+void ulz_reader_init(ulz_reader_t *reader);
+
+/* Consume len bytes, calling cb with the raw content of every block completed */
+void ulz_reader_feed(ulz_reader_t *reader, const uint8_t *data, size_t len, ulz_out_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ULOG_LZ_H
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "xfer_pool.h"
+
+static const char *TAG = "xfer_pool";
+
+/* Below the UART and websocket tasks, a download never starves the live stream */
+#define XFER_TASK_PRIO  (2)
+#define XFER_TASK_STACK (4096)
+
+typedef struct {
+    httpd_req_t *req;       // async copy, owned by the worker
+    xfer_handler_t handler;
+    char *buf;
+} xfer_job_t;
+
+static QueueHandle_t free_q = NULL;
+static QueueHandle_t job_q = NULL;
+
+/* only written from the httpd task */
+static uint32_t high_water = 0;
+static uint32_t rejected = 0;
+
+static void xfer_worker_task(void *arg) {
+    xfer_job_t job;
+    while (1) {
+        if (xQueueReceive(job_q, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (job.handler(job.req, job.buf) != ESP_OK) {
+            httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+        }
+        xQueueSend(free_q, &job.buf, 0);
+        httpd_req_async_handler_complete(job.req);
+    }
+}
+
+esp_err_t xfer_pool_init(void) {
+    if (free_q != NULL) {
+        return ESP_OK;
+    }
+    free_q = xQueueCreate(XFER_POOL_SIZE, sizeof(char *));
+    job_q = xQueueCreate(XFER_POOL_SIZE, sizeof(xfer_job_t));
+    if (!free_q || !job_q) {
+        ESP_LOGE(TAG, "Failed to create queues");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < XFER_POOL_SIZE; i++) {
+        char *buf = malloc(XFER_BUF_SIZE);
+        if (!buf) {
+            ESP_LOGE(TAG, "Failed to allocate transfer buffer %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+        xQueueSend(free_q, &buf, 0);
+        /* one worker per buffer, a checked out buffer never waits for a worker */
+        if (xTaskCreate(xfer_worker_task, "xfer_worker", XFER_TASK_STACK, NULL, XFER_TASK_PRIO, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create worker %d", i);
+            return ESP_FAIL;
+        }
+    }
+    ESP_LOGI(TAG, "%d transfer buffers of %d bytes", XFER_POOL_SIZE, XFER_BUF_SIZE);
+    return ESP_OK;
+}
+
+esp_err_t xfer_pool_run(httpd_req_t *req, xfer_handler_t handler) {
+    xfer_job_t job = {
+            .handler = handler,
+    };
+
+    if (free_q == NULL || xQueueReceive(free_q, &job.buf, 0) != pdTRUE) {
+        rejected++;
+        ESP_LOGW(TAG, "No transfer buffer free for %s", req->uri);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Too many transfers, try again");
+        return ESP_OK;
+    }
+
+    uint32_t in_use = XFER_POOL_SIZE - uxQueueMessagesWaiting(free_q);
+    if (in_use > high_water) {
+        high_water = in_use;
+        ESP_LOGI(TAG, "High water mark %" PRIu32 " of %d buffers", high_water, XFER_POOL_SIZE);
+    }
+
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        xQueueSend(free_q, &job.buf, 0);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    /* cannot fail, the queue holds as many jobs as there are buffers */
+    xQueueSend(job_q, &job, 0);
+    return ESP_OK;
+}
+
+void xfer_pool_get_stats(xfer_pool_stats_t *stats) {
+    stats->size = XFER_POOL_SIZE;
+    stats->in_use = free_q ? XFER_POOL_SIZE - uxQueueMessagesWaiting(free_q) : 0;
+    stats->high_water = high_water;
+    stats->rejected = rejected;
+}
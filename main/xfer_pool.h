@@ -0,0 +1,48 @@
+#ifndef XFER_POOL_H
+#define XFER_POOL_H
+
+/*
+ * Transfer buffers for long running HTTP requests.
+ *
+ * Downloads, uploads and queries each check a buffer out of a small pool
+ * and run as httpd async requests on a worker task of their own, so
+ * several transfers proceed in parallel without sharing memory and the
+ * httpd task stays free for the websocket and small requests. When all
+ * buffers are in use the request is answered with 503.
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XFER_BUF_SIZE  (8192)
+#define XFER_POOL_SIZE (3)
+
+/* Runs on a worker with buf of XFER_BUF_SIZE bytes, returning ESP_FAIL
+ * closes the connection like it does for a plain handler */
+typedef esp_err_t (*xfer_handler_t)(httpd_req_t *req, char *buf);
+
+typedef struct {
+    uint32_t size;
+    uint32_t in_use;
+    uint32_t high_water;    // most buffers ever in use at once
+    uint32_t rejected;      // requests answered with 503
+} xfer_pool_stats_t;
+
+esp_err_t xfer_pool_init(void);
+
+/* Hand req over to a worker, call from the httpd handler and return the
+ * result. The worker completes the async request when handler returns. */
+esp_err_t xfer_pool_run(httpd_req_t *req, xfer_handler_t handler);
+
+void xfer_pool_get_stats(xfer_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //XFER_POOL_H
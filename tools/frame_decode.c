@@ -0,0 +1,154 @@
+/*
+ * Run a frame decoder over the received data of capture logs (.ulg),
+ * the same way the device does with /uartconfig?decode=..., and report
+ * the frames found and the decoder throughput.
+ *
+ * Build: cc -O2 -I../main -o frame_decode frame_decode.c ../main/frame_decode.c ../main/ulog_format.c ../main/ulog_lz.c
+ * Usage: frame_decode modbus|slip|cobs|nmea|length file.ulg [more.ulg ...]
+ *
+ * Only received data records are decoded, frame records already in the
+ * log are skipped. Frames are printed as "<ts_us> <status> <hex>", the
+ * counts and MB/s of repeated decode passes go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "ulog_format.h"
+#include "frame_decode.h"
+
+/* Received data of all logs, kept in memory so decoding can be timed on its own */
+typedef struct {
+    int64_t ts_us;
+    uint32_t byte_ns;
+    uint16_t len;
+    bool burst;
+    size_t offset;
+} rx_rec_t;
+
+typedef struct {
+    rx_rec_t *recs;
+    size_t count, cap;
+    uint8_t *data;
+    size_t size, data_cap;
+    uint32_t file_byte_ns;
+} rx_log_t;
+
+static const char *status_names[] = {"ok", "checksum", "format", "oversize", "truncated"};
+
+static void print_frame(void *ctx, const uint8_t *frame, uint16_t len, uint8_t status, int64_t ts_us) {
+    if (ctx == NULL) {
+        return;
+    }
+    printf("%lld %s", (long long) ts_us, status < 5 ? status_names[status] : "?");
+    for (uint16_t i = 0; i < len; i++) {
+        printf(" %02x", frame[i]);
+    }
+    printf("\n");
+}
+
+static void collect_record(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    rx_log_t *log = ctx;
+    if (hdr->flags & (ULOG_FLAG_TX | ULOG_FLAG_EVENT | ULOG_FLAG_FRAME)) {
+        return;
+    }
+    if (log->count == log->cap) {
+        log->cap = log->cap ? log->cap * 2 : 1024;
+        log->recs = realloc(log->recs, log->cap * sizeof(rx_rec_t));
+    }
+    while (log->size + hdr->len > log->data_cap) {
+        log->data_cap = log->data_cap ? log->data_cap * 2 : 65536;
+        log->data = realloc(log->data, log->data_cap);
+    }
+    if (log->recs == NULL || log->data == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    /* older logs carry no byte time, derive it from the baud rate */
+    uint32_t byte_ns = hdr->aux ? hdr->aux : (file->baud_rate ? (uint32_t) (10000000000ULL / file->baud_rate) : 0);
+    log->recs[log->count++] = (rx_rec_t) {
+            .ts_us = hdr->ts_us,
+            .byte_ns = byte_ns,
+            .len = hdr->len,
+            .burst = (hdr->flags & ULOG_FLAG_BURST) != 0,
+            .offset = log->size,
+    };
+    memcpy(log->data + log->size, data, hdr->len);
+    log->size += hdr->len;
+}
+
+/* One pass over everything collected, frames go to print_frame(out) */
+static void decode_all(const rx_log_t *log, frame_decoder_t *dec, frame_proto_t proto, void *out) {
+    frame_decoder_init(dec, proto, log->count ? log->recs[0].byte_ns : 0);
+    for (size_t i = 0; i < log->count; i++) {
+        const rx_rec_t *rec = &log->recs[i];
+        if (rec->burst) {
+            frame_decoder_idle(dec, print_frame, out);
+        }
+        frame_decode(dec, log->data + rec->offset, rec->len, rec->ts_us, print_frame, out);
+    }
+    frame_decoder_idle(dec, print_frame, out);
+}
+
+int main(int argc, char **argv) {
+    frame_proto_t proto = argc >= 3 ? frame_proto_from_name(argv[1]) : FRAME_PROTO_NONE;
+    if (proto == FRAME_PROTO_NONE) {
+        fprintf(stderr, "usage: %s modbus|slip|cobs|nmea|length file.ulg [more.ulg ...]\n", argv[0]);
+        return 2;
+    }
+
+    ulog_decoder_t *ulog = malloc(sizeof(ulog_decoder_t));
+    frame_decoder_t *dec = malloc(sizeof(frame_decoder_t));
+    rx_log_t log = {0};
+    if (ulog == NULL || dec == NULL) {
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 2; i < argc; i++) {
+        FILE *fd = fopen(argv[i], "rb");
+        if (fd == NULL) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        uint8_t buf[8192];
+        size_t n;
+        ulog_decoder_init(ulog);
+        while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) {
+            if (!ulog_decode(ulog, buf, n, collect_record, &log)) {
+                fprintf(stderr, "%s: not a capture log\n", argv[i]);
+                ret = 1;
+                break;
+            }
+        }
+        fclose(fd);
+    }
+
+    decode_all(&log, dec, proto, stdout);
+    fprintf(stderr, "%lu frames, %lu bad, %zu bytes", (unsigned long) dec->frames, (unsigned long) dec->errors,
+            log.size);
+
+    /* decode again without printing until enough time has passed to measure */
+    int passes = 0;
+    clock_t start = clock();
+    double elapsed = 0;
+    while (log.size > 0 && elapsed < 0.5) {
+        decode_all(&log, dec, proto, NULL);
+        passes++;
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    }
+    if (elapsed > 0) {
+        fprintf(stderr, ", %.1f MB/s", (double) log.size * passes / elapsed / 1e6);
+    }
+    fprintf(stderr, "\n");
+
+    free(log.recs);
+    free(log.data);
+    free(ulog);
+    free(dec);
+    return ret;
+}
@@ -0,0 +1,20 @@
+/* Just enough of ESP-IDF for the host tools, see README, Host tests.
+ * The tool linking against it provides the response functions. */
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+#include <sys/types.h>
+#include "esp_err.h"
+
+typedef struct httpd_req {
+    const char *uri;
+    void *user_ctx;
+} httpd_req_t;
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len);
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len);
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str);
+
+#endif //ESP_HTTP_SERVER_H
@@ -0,0 +1,11 @@
+/* Just enough of ESP-IDF for the host tools, see README, Host tests */
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+
+#endif //ESP_LOG_H
@@ -0,0 +1,7 @@
+/* Just enough of ESP-IDF for the host tools, see README, Host tests */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_LWIP_TCP_MSS 1440
+
+#endif //SDKCONFIG_H
@@ -0,0 +1,271 @@
+/*
+ * Measure the capture log block compression on traces.
+ *
+ * Build: cc -O2 -I../main -o lz_bench lz_bench.c ../main/ulog_format.c ../main/ulog_lz.c
+ * Usage: lz_bench [file.ulg ...]
+ *
+ * Packs the records of a trace into 4 KB blocks the way the log writer
+ * does (a record never straddles two blocks), compresses every block with
+ * ulz_block_encode() and reads them back with ulz_reader_feed(), checking
+ * the result. Reports the stored size as a share of the raw size and the
+ * compression and decompression rates in MB/s of raw log.
+ *
+ * Without arguments it runs synthetic traces: Modbus RTU polling with
+ * slowly changing registers, NMEA sentences and random bytes. Capture
+ * logs given as arguments are decoded first, so compressed logs can be
+ * measured too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ulog_format.h"
+#include "ulog_lz.h"
+
+#define BLOCK_SIZE      (4096)
+#define TRACE_SIZE      (4 << 20)   // raw log bytes of a synthetic trace
+#define BYTE_NS         (10 * 1000000000ull / 115200)
+
+typedef struct {
+    uint8_t *data;
+    size_t size, cap;
+    size_t blocks;
+    size_t block_start;
+} trace_t;
+
+typedef struct {
+    const trace_t *trace;
+    size_t pos;
+    size_t mismatches;
+} check_ctx_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+/* Append a record, counting the writer blocks it takes */
+static void trace_add(trace_t *t, uint8_t flags, uint32_t aux, int64_t ts_us, const uint8_t *data, uint16_t len) {
+    size_t rec_len = sizeof(ulog_rec_hdr_t) + len;
+    if (t->size + rec_len + BLOCK_SIZE > t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 1 << 20;
+        t->data = realloc(t->data, t->cap);
+        if (t->data == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    if (t->size - t->block_start + rec_len > BLOCK_SIZE) {
+        t->blocks++;
+        t->block_start = t->size;
+    }
+    t->size += ulog_rec_encode(t->data + t->size, flags, aux, ts_us, data, len);
+}
+
+static uint16_t modbus_crc(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void make_modbus(trace_t *t) {
+    uint16_t regs[10] = {2300, 2310, 2295, 512, 498, 505, 5000, 0, 1, 42};
+    uint32_t x = 1;
+    int64_t ts_us = 0;
+    while (t->size < TRACE_SIZE) {
+        uint8_t req[8] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0a};
+        uint16_t crc = modbus_crc(req, 6);
+        req[6] = crc & 0xff;
+        req[7] = crc >> 8;
+        trace_add(t, ULOG_FLAG_TX, 0, ts_us, req, sizeof(req));
+        ts_us += 8 * BYTE_NS / 1000 + 3000;
+
+        uint8_t resp[25] = {0x01, 0x03, 20};
+        for (int i = 0; i < 10; i++) {
+            if (i < 6 && (xorshift(&x) & 3) == 0) {
+                regs[i] += (int) (xorshift(&x) % 5) - 2;
+            }
+            resp[3 + 2 * i] = regs[i] >> 8;
+            resp[4 + 2 * i] = regs[i] & 0xff;
+        }
+        crc = modbus_crc(resp, 23);
+        resp[23] = crc & 0xff;
+        resp[24] = crc >> 8;
+        trace_add(t, ULOG_FLAG_BURST, BYTE_NS, ts_us, resp, sizeof(resp));
+        ts_us += 100000 + xorshift(&x) % 200;
+    }
+}
+
+static void make_nmea(trace_t *t) {
+    uint32_t x = 2;
+    int64_t ts_us = 0;
+    double lat = 4807.038, lon = 1131.000;
+    for (int sec = 0; t->size < TRACE_SIZE; sec++) {
+        char line[128];
+        lat += (int) (xorshift(&x) % 7 - 3) / 1000.0;
+        lon += (int) (xorshift(&x) % 7 - 3) / 1000.0;
+        int hh = sec / 3600 % 24, mm = sec / 60 % 60, ss = sec % 60;
+        unsigned sats = 6 + xorshift(&x) % 4;
+        double alt = 545.4 + (int) (xorshift(&x) % 11 - 5) / 10.0;
+        int len = snprintf(line, sizeof(line),
+                           "$GPGGA,%02d%02d%02d.00,%.3f,N,%09.3f,E,1,%02u,0.9,%.1f,M,46.9,M,,*%02X\r\n",
+                           hh, mm, ss, lat, lon, sats, alt, xorshift(&x) & 0xff);
+        trace_add(t, ULOG_FLAG_BURST, BYTE_NS, ts_us, (uint8_t *) line, (uint16_t) len);
+        unsigned speed = xorshift(&x) % 1000, course = xorshift(&x) % 360;
+        len = snprintf(line, sizeof(line), "$GPRMC,%02d%02d%02d.00,A,%.3f,N,%09.3f,E,0.%03u,%u.0,161026,,,A*%02X\r\n",
+                       hh, mm, ss, lat, lon, speed, course, xorshift(&x) & 0xff);
+        trace_add(t, 0, BYTE_NS, ts_us + 6000, (uint8_t *) line, (uint16_t) len);
+        ts_us += 1000000;
+    }
+}
+
+static void make_random(trace_t *t) {
+    uint32_t x = 3;
+    int64_t ts_us = 0;
+    uint8_t data[120];
+    while (t->size < TRACE_SIZE) {
+        for (size_t i = 0; i < sizeof(data); i++) {
+            data[i] = xorshift(&x);
+        }
+        trace_add(t, 0, BYTE_NS, ts_us, data, sizeof(data));
+        ts_us += 10417;
+    }
+}
+
+static void collect_record(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    (void) file;
+    trace_add(ctx, hdr->flags, hdr->aux, hdr->ts_us, data, hdr->len);
+}
+
+static int load_log(trace_t *t, const char *path) {
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+    ulog_decoder_t *dec = malloc(sizeof(ulog_decoder_t));
+    uint8_t buf[8192];
+    size_t n;
+    int ret = 0;
+    ulog_decoder_init(dec);
+    while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) {
+        if (!ulog_decode(dec, buf, n, collect_record, t)) {
+            fprintf(stderr, "%s: not a capture log\n", path);
+            ret = -1;
+            break;
+        }
+    }
+    free(dec);
+    fclose(fd);
+    return ret;
+}
+
+static void check_block(void *ctx, const uint8_t *data, size_t len) {
+    check_ctx_t *c = ctx;
+    if (c->pos + len > c->trace->size || memcmp(c->trace->data + c->pos, data, len) != 0) {
+        c->mismatches++;
+    }
+    c->pos += len;
+}
+
+/* End of the block starting at start, where the next record no longer fits */
+static size_t next_block(const trace_t *t, size_t start) {
+    size_t pos = start;
+    while (pos < t->size) {
+        const ulog_rec_hdr_t *hdr = (const ulog_rec_hdr_t *) (t->data + pos);
+        size_t rec_len = sizeof(ulog_rec_hdr_t) + hdr->len;
+        if (pos - start + rec_len > BLOCK_SIZE) {
+            break;
+        }
+        pos += rec_len;
+    }
+    return pos;
+}
+
+static int run(const char *name, const trace_t *t) {
+    static ulz_state_t state;
+    static ulz_reader_t reader;
+    size_t out_cap = (t->blocks + 1) * (sizeof(ulz_block_hdr_t) + ULZ_BOUND(BLOCK_SIZE));
+    uint8_t *out = malloc(out_cap);
+    if (out == NULL || t->size == 0) {
+        fprintf(stderr, "%s: nothing to compress\n", name);
+        free(out);
+        return 1;
+    }
+
+    /* repeat until enough time has passed to measure */
+    size_t out_len = 0, stored = 0;
+    int passes = 0;
+    double t0 = now_s(), s;
+    do {
+        out_len = 0;
+        stored = 0;
+        for (size_t start = 0, end; start < t->size; start = end) {
+            end = next_block(t, start);
+            size_t n = ulz_block_encode(&state, t->data + start, end - start, out + out_len);
+            stored += ((ulz_block_hdr_t *) (out + out_len))->flags & ULZ_BLOCK_STORED;
+            out_len += n;
+        }
+        passes++;
+    } while ((s = now_s() - t0) < 0.5);
+    double comp = (double) t->size * passes / s / 1e6;
+
+    check_ctx_t check = {.trace = t};
+    passes = 0;
+    t0 = now_s();
+    do {
+        check.pos = 0;
+        ulz_reader_init(&reader);
+        ulz_reader_feed(&reader, out, out_len, check_block, &check);
+        passes++;
+    } while ((s = now_s() - t0) < 0.5);
+    double decomp = (double) t->size * passes / s / 1e6;
+
+    int bad = check.mismatches != 0 || check.pos != t->size;
+    printf("%-16s %9zu B raw  %6.1f%% stored  %4zu of %4zu blocks stored as is  %7.1f MB/s compress  "
+           "%7.1f MB/s decompress%s\n",
+           name, t->size, 100.0 * out_len / t->size, stored, t->blocks + 1, comp, decomp,
+           bad ? "  ROUND TRIP FAILED" : "");
+    free(out);
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = 0;
+    if (argc < 2) {
+        static void (*const makers[])(trace_t *) = {make_modbus, make_nmea, make_random};
+        static const char *const names[] = {"modbus", "nmea", "random"};
+        for (int i = 0; i < 3; i++) {
+            trace_t t = {0};
+            makers[i](&t);
+            ret |= run(names[i], &t);
+            free(t.data);
+        }
+        return ret;
+    }
+    for (int i = 1; i < argc; i++) {
+        trace_t t = {0};
+        if (load_log(&t, argv[i]) == 0) {
+            ret |= run(argv[i], &t);
+        } else {
+            ret = 1;
+        }
+        free(t.data);
+    }
+    return ret;
+}
@@ -0,0 +1,196 @@
+/*
+ * Stress test the metrics counters and histograms under concurrency and
+ * measure what an update costs.
+ *
+ * Build: cc -O2 -pthread -I../main -o metrics_stress metrics_stress.c ../main/metrics.c
+ * Usage: metrics_stress [writer threads] [updates per thread] [-p]
+ *
+ * Writers add to shared counters and histograms while a reader keeps
+ * folding and checks that no total ever goes backwards. The totals must
+ * match what the writers added exactly, including counters that pass
+ * 2^32 many times between them. -p prints the final Prometheus and JSON output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#define WRITERS_MAX (16)
+/* Slots must not wrap between folds, the reader may sleep for a time
+ * slice on a busy host: keep the adds small enough for that */
+#define BIG_ADD (1u << 12)
+
+static metrics_counter_t events;
+static metrics_counter_t bytes;
+static metrics_counter_t big[2];
+static metrics_hist_t latency;
+
+static uint64_t updates;
+static atomic_bool writers_done;
+static uint64_t expect_bytes[WRITERS_MAX];
+static uint64_t expect_sum[WRITERS_MAX];
+static uint64_t expect_buckets[WRITERS_MAX][METRICS_HIST_BUCKETS + 1];
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer(void *arg) {
+    int id = (int) (intptr_t) arg;
+    uint32_t x = 2463534242u + id;
+    for (uint64_t i = 0; i < updates; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        metrics_counter_add(&events, 1);
+        metrics_counter_add(&bytes, x & 0xFFF);
+        expect_bytes[id] += x & 0xFFF;
+        metrics_counter_add(&big[id & 1], BIG_ADD);
+
+        /* mostly short, now and then up to 2 s */
+        uint32_t us = (x & 0x3FF) == 0 ? x % 2000000 : x % 1000;
+        metrics_hist_observe(&latency, us);
+        expect_sum[id] += us;
+        int b = 0;
+        while (b < METRICS_HIST_BUCKETS && us > metrics_hist_bounds[b]) {
+            b++;
+        }
+        expect_buckets[id][b]++;
+    }
+    return NULL;
+}
+
+static uint64_t folds, backwards;
+
+static void *reader(void *arg) {
+    (void) arg;
+    uint64_t last_events = 0, last_big = 0, last_count = 0;
+    while (!atomic_load(&writers_done)) {
+        metrics_fold();
+        uint64_t e = metrics_counter_value(&events);
+        uint64_t g = metrics_counter_value(&big[0]);
+        metrics_hist_snapshot_t snap;
+        metrics_hist_snapshot(&latency, &snap);
+        if (e < last_events || g < last_big || snap.buckets[METRICS_HIST_BUCKETS] < last_count) {
+            backwards++;
+        }
+        last_events = e;
+        last_big = g;
+        last_count = snap.buckets[METRICS_HIST_BUCKETS];
+        folds++;
+    }
+    return NULL;
+}
+
+/* Cost of an update when every thread adds to the same counter: through
+ * the metrics slots, and on one shared 64 bit atomic for comparison */
+static metrics_counter_t timed;
+static _Atomic uint64_t shared_total;
+
+static void *time_slots(void *arg) {
+    (void) arg;
+    for (uint64_t i = 0; i < updates; i++) {
+        metrics_counter_add(&timed, 1);
+    }
+    return NULL;
+}
+
+static void *time_shared(void *arg) {
+    (void) arg;
+    for (uint64_t i = 0; i < updates; i++) {
+        atomic_fetch_add_explicit(&shared_total, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static double run_ns(int threads, void *(*fn)(void *)) {
+    pthread_t t[WRITERS_MAX];
+    double t0 = now_s();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&t[i], NULL, fn, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(t[i], NULL);
+    }
+    return (now_s() - t0) * 1e9 / ((double) updates * threads);
+}
+
+static void print_out(void *ctx, const char *str) {
+    (void) ctx;
+    fputs(str, stdout);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    updates = argc > 2 ? strtoull(argv[2], NULL, 0) : 2000000;
+    bool print = argc > 3 && strcmp(argv[3], "-p") == 0;
+    if (threads < 1 || threads > WRITERS_MAX || updates == 0) {
+        fprintf(stderr, "usage: %s [writer threads 1..%d] [updates per thread] [-p]\n", argv[0], WRITERS_MAX);
+        return 1;
+    }
+
+    metrics_counter_init(&events, "test_events_total", "Updates made", NULL, NULL);
+    metrics_counter_init(&bytes, "test_bytes_total", "Random amounts added", NULL, NULL);
+    metrics_counter_init(&big[0], "test_big_total", "Counters that pass 2^32", "half", "even");
+    metrics_counter_init(&big[1], "test_big_total", "Counters that pass 2^32", "half", "odd");
+    metrics_hist_init(&latency, "test_latency_us", "Random latencies", "port", "1");
+
+    pthread_t w[WRITERS_MAX], r;
+    pthread_create(&r, NULL, reader, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&w[i], NULL, writer, (void *) (intptr_t) i);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(w[i], NULL);
+    }
+    atomic_store(&writers_done, true);
+    pthread_join(r, NULL);
+
+    uint64_t want_bytes = 0, want_sum = 0, want_big[2] = {0};
+    uint64_t want_buckets[METRICS_HIST_BUCKETS + 1] = {0};
+    for (int i = 0; i < threads; i++) {
+        want_bytes += expect_bytes[i];
+        want_sum += expect_sum[i];
+        want_big[i & 1] += updates * BIG_ADD;
+        for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+            want_buckets[b] += expect_buckets[i][b];
+        }
+    }
+    metrics_hist_snapshot_t snap;
+    metrics_hist_snapshot(&latency, &snap);
+    int errors = 0;
+    errors += metrics_counter_value(&events) != updates * threads;
+    errors += metrics_counter_value(&bytes) != want_bytes;
+    errors += metrics_counter_value(&big[0]) != want_big[0];
+    errors += metrics_counter_value(&big[1]) != want_big[1];
+    errors += snap.sum != want_sum;
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= METRICS_HIST_BUCKETS; b++) {
+        cumulative += want_buckets[b];
+        errors += snap.buckets[b] != cumulative;
+    }
+    printf("%d writers x %llu updates, %llu folds meanwhile, %llu went backwards, %d totals wrong\n",
+           threads, (unsigned long long) updates, (unsigned long long) folds, (unsigned long long) backwards,
+           errors);
+
+    if (print) {
+        metrics_write_prometheus(print_out, NULL);
+        metrics_write_json(print_out, NULL);
+        putchar('\n');
+    }
+
+    metrics_counter_init(&timed, "test_timed_total", "Timed updates", NULL, NULL);
+    for (int n = 1; n <= threads; n *= 2) {
+        printf("%2d threads: %6.2f ns per update on the slots, %6.2f ns on one shared atomic\n", n,
+               run_ns(n, time_slots), run_ns(n, time_shared));
+    }
+    return errors != 0 || backwards != 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Count what a file listing costs the http server, before and after the
+ * buffered response writer.
+ *
+ * Build: cc -O2 -I../main -Iinclude -o resp_bench resp_bench.c ../main/resp_writer.c
+ * Usage: resp_bench [upload_script.html]
+ *
+ * Builds the directory listing page for 10 to 192 capture logs twice:
+ * the way the file server used to, one httpd_resp_sendstr_chunk() per
+ * piece with sprintf() for the sizes, and the way it does now through a
+ * resp_writer with an XFER_BUF_SIZE buffer. The response functions are
+ * stubs that count the calls and the bytes, chunk framing included.
+ * Each chunk is its own TCP push in esp_http_server, so the call count is
+ * what the client waits on. The page embeds the upload script, its size
+ * is taken from the file given (main/static/upload_script.html by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_http_server.h"
+#include "resp_writer.h"
+
+#define XFER_BUF_SIZE   (8192)
+#define ULOG_FILE_EXT   ".ulg"
+
+typedef struct {
+    char name[32];
+    long size;
+} file_entry_t;
+
+static struct {
+    unsigned calls;
+    size_t payload;
+    size_t wire;
+} sent;
+
+static const char *upload_script;
+static size_t upload_script_size;
+
+/* "<hex len>\r\n" <data> "\r\n" */
+static void count_chunk(size_t len) {
+    char hex[16];
+    sent.calls++;
+    sent.payload += len;
+    sent.wire += snprintf(hex, sizeof(hex), "%zx", len) + 4 + len;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    (void) r;
+    (void) buf;
+    sent.calls++;
+    sent.payload += buf_len;
+    sent.wire += buf_len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    (void) r;
+    (void) buf;
+    count_chunk(buf != NULL ? (size_t) buf_len : 0);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str) {
+    (void) r;
+    count_chunk(str != NULL ? strlen(str) : 0);
+    return ESP_OK;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The listing before the response writer, without the directory scan */
+static void list_chunks(httpd_req_t *req, const file_entry_t *files, int count) {
+    char entrysize[16];
+    httpd_resp_sendstr_chunk(req, "<!DOCTYPE html><html>"
+                                  "<head><meta charset=\"UTF-8\">"
+                                  "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1, shrink-to-fit=no\">"
+                                  "<title>SmartBoxFileManage</title></head><body>");
+    httpd_resp_send_chunk(req, upload_script, upload_script_size);
+    httpd_resp_sendstr_chunk(req,
+                             "<table class=\"fixed\" border=\"1\" style=\"border-spacing: 0;\">"
+                             "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
+                             "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
+                             "<tbody>");
+    for (int i = 0; i < count; i++) {
+        sprintf(entrysize, "%ld", files[i].size);
+        httpd_resp_sendstr_chunk(req, "<tr><td><a href=\"");
+        httpd_resp_sendstr_chunk(req, req->uri);
+        httpd_resp_sendstr_chunk(req, files[i].name);
+        httpd_resp_sendstr_chunk(req, "\">");
+        httpd_resp_sendstr_chunk(req, files[i].name);
+        httpd_resp_sendstr_chunk(req, "</a></td><td>");
+        httpd_resp_sendstr_chunk(req, "file");
+        httpd_resp_sendstr_chunk(req, "</td><td>");
+        httpd_resp_sendstr_chunk(req, entrysize);
+        httpd_resp_sendstr_chunk(req, "</td><td>");
+        httpd_resp_sendstr_chunk(req, "<form method=\"post\" action=\"/delete");
+        httpd_resp_sendstr_chunk(req, req->uri);
+        httpd_resp_sendstr_chunk(req, files[i].name);
+        httpd_resp_sendstr_chunk(req, "\"><button type=\"submit\">Delete</button></form>");
+        httpd_resp_sendstr_chunk(req, "</td></tr>\n");
+    }
+    httpd_resp_sendstr_chunk(req, "</tbody></table>");
+    httpd_resp_sendstr_chunk(req, "</body></html>");
+    httpd_resp_sendstr_chunk(req, NULL);
+}
+
+/* The listing of http_resp_dir_html in my_http_file_server.c */
+static void list_writer(httpd_req_t *req, const file_entry_t *files, int count, char *buf) {
+    resp_writer_t w;
+    resp_writer_init(&w, req, buf, XFER_BUF_SIZE);
+    resp_writer_str(&w, "<!DOCTYPE html><html>"
+                   "<head><meta charset=\"UTF-8\">"
+                   "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1, shrink-to-fit=no\">"
+                   "<title>SmartBoxFileManage</title></head><body>");
+    resp_writer_write(&w, upload_script, upload_script_size);
+    resp_writer_str(&w, "<table class=\"fixed\" border=\"1\" style=\"border-spacing: 0;\">"
+                   "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
+                   "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
+                   "<tbody>");
+    for (int i = 0; i < count; i++) {
+        const char *name = files[i].name;
+        resp_writer_str(&w, "<tr><td><a href=\"");
+        resp_writer_html(&w, req->uri);
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "\">");
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "</a>");
+        if (strstr(name, ULOG_FILE_EXT) != NULL) {
+            resp_writer_str(&w, " <a href=\"");
+            resp_writer_html(&w, req->uri);
+            resp_writer_html(&w, name);
+            resp_writer_str(&w, "?format=text\">[text]</a>");
+        }
+        resp_writer_str(&w, "</td><td>file</td><td>");
+        resp_writer_int(&w, files[i].size);
+        resp_writer_str(&w, "</td><td>");
+        resp_writer_str(&w, "<form method=\"post\" action=\"/delete");
+        resp_writer_html(&w, req->uri);
+        resp_writer_html(&w, name);
+        resp_writer_str(&w, "\"><button type=\"submit\">Delete</button></form></td></tr>\n");
+    }
+    resp_writer_str(&w, "</tbody></table></body></html>");
+    resp_writer_finish(&w);
+}
+
+int main(int argc, char *argv[]) {
+    const char *script_path = argc > 1 ? argv[1] : "main/static/upload_script.html";
+    FILE *fd = fopen(script_path, "rb");
+    if (fd == NULL) {
+        perror(script_path);
+        fprintf(stderr, "usage: %s [upload_script.html]\n", argv[0]);
+        return 1;
+    }
+    static char script[65536];
+    upload_script_size = fread(script, 1, sizeof(script), fd);
+    upload_script = script;
+    fclose(fd);
+
+    static file_entry_t files[192];
+    srand(1);
+    for (int i = 0; i < 192; i++) {
+        snprintf(files[i].name, sizeof(files[i].name), "10%02d%02d%02d00_%d_u%d.ulg", 1 + i / 24 % 28, i % 24,
+                 rand() % 60, i, 1 + i % 2);
+        files[i].size = 4096 + rand() % (1 << 20);
+    }
+
+    static char buf[XFER_BUF_SIZE];
+    httpd_req_t req = {.uri = "/"};
+    const int counts[] = {10, 48, 192};
+    printf("%5s  %-14s %7s %9s %9s %10s\n", "files", "", "calls", "payload", "wire", "us/listing");
+    for (int c = 0; c < 3; c++) {
+        for (int pass = 0; pass < 2; pass++) {
+            int runs = 0;
+            double t0 = now_s(), s;
+            do {
+                memset(&sent, 0, sizeof(sent));
+                if (pass == 0) {
+                    list_chunks(&req, files, counts[c]);
+                } else {
+                    list_writer(&req, files, counts[c], buf);
+                }
+                runs++;
+            } while ((s = now_s() - t0) < 0.2);
+            printf("%5d  %-14s %7u %9zu %9zu %10.2f\n", counts[c], pass == 0 ? "chunk per str" : "resp_writer",
+                   sent.calls, sent.payload, sent.wire, s * 1e6 / runs);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Stress test the capture ring with one producer and concurrent readers.
+ *
+ * Build: cc -O2 -pthread -I../main -o ring_stress ring_stress.c ../main/uart_ring.c
+ * Usage: ring_stress [readers] [MB written] [ring size] [-i]
+ *
+ * The producer writes a stream in which every byte is a function of its
+ * stream position, in random lengths, with the head starting just below
+ * 2^32 so the position wraps early on. Readers read random amounts, half
+ * of them slowly enough to be lapped. Every byte a reader gets must be
+ * the one of its position (no reordering, no torn copy), and the bytes
+ * read plus the bytes reported lost must add up to the distance covered.
+ *
+ * With -i the producer writes from a timer signal instead, interrupting a
+ * single reader in the middle of its copies the way the uart task preempts
+ * lower priority readers on the device. This catches torn reads on a
+ * single core host too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "uart_ring.h"
+
+#define READERS_MAX     (16)
+#define HEAD_START      (0xFFFFF000u)
+#define WRITE_MAX       (300)
+
+static uart_ring_t ring;
+static uint64_t total_bytes;
+static volatile uint64_t written;   // also written from the signal handler
+static atomic_bool producer_done;
+static atomic_int attached;
+
+typedef struct {
+    int id;
+    uint64_t read;
+    uint64_t lost;
+    uint64_t overruns;
+    uint64_t bad;
+    uint64_t covered;
+} reader_result_t;
+
+static inline uint8_t stream_byte(uint32_t pos) {
+    return (uint8_t) (pos * 131u + (pos >> 8) + (pos >> 16) * 7u);
+}
+
+static uint32_t xorshift(uint32_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t produce_x = 88172645u;
+static uint32_t produce_pos = HEAD_START;
+
+/* One random length write of the stream, returns its length */
+static uint32_t produce(void) {
+    uint8_t buf[WRITE_MAX];
+    uint32_t len = 1 + xorshift(&produce_x) % WRITE_MAX;
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = stream_byte(produce_pos + i);
+    }
+    uart_ring_write(&ring, buf, len);
+    produce_pos += len;
+    written += len;
+    return len;
+}
+
+static void *producer(void *arg) {
+    (void) arg;
+    while (written < total_bytes) {
+        produce();
+        /* now and then let the fast readers catch up */
+        if ((produce_x & 15) == 0) {
+            sched_yield();
+        }
+    }
+    atomic_store(&producer_done, true);
+    return NULL;
+}
+
+static void producer_irq(int sig) {
+    (void) sig;
+    for (int i = 0; i < 16 && written < total_bytes; i++) {
+        produce();
+    }
+    if (written >= total_bytes) {
+        atomic_store(&producer_done, true);
+    }
+}
+
+static void *reader(void *arg) {
+    reader_result_t *r = arg;
+    uart_ring_reader_t rd;
+    static _Thread_local uint8_t buf[65536];
+    uint32_t x = 2463534242u + r->id;
+    bool slow = r->id & 1;
+
+    uart_ring_reader_attach(&ring, &rd);
+    uint32_t start = rd.pos;
+    atomic_fetch_add(&attached, 1);
+    while (true) {
+        bool done = atomic_load(&producer_done);
+        uint32_t max = 1 + xorshift(&x) % sizeof(buf);
+        uint32_t len = uart_ring_read(&ring, &rd, buf, max);
+        uint32_t first = rd.pos - len;
+        for (uint32_t i = 0; i < len; i++) {
+            if (buf[i] != stream_byte(first + i)) {
+                r->bad++;
+            }
+        }
+        r->read += len;
+        if (slow && (xorshift(&x) & 7) == 0) {
+            for (volatile int spin = 0; spin < 20000; spin++) {
+            }
+        } else if (len == 0) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    r->lost = rd.overrun_bytes;
+    r->overruns = rd.overrun_count;
+    r->covered = (uint32_t) (rd.pos - start);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    total_bytes = (argc > 2 ? strtoull(argv[2], NULL, 0) : 64) << 20;
+    uint32_t size = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 0) : 1024;
+    bool irq = argc > 4 && strcmp(argv[4], "-i") == 0;
+    uint8_t *buf = malloc(size);
+    if (readers < 1 || readers > READERS_MAX || total_bytes == 0 || buf == NULL
+        || !uart_ring_init(&ring, buf, size)) {
+        fprintf(stderr, "usage: %s [readers 1..%d] [MB written] [ring size, power of two] [-i]\n", argv[0],
+                READERS_MAX);
+        return 1;
+    }
+    /* start close to the 2^32 wrap of the positions */
+    atomic_store(&ring.head, HEAD_START);
+    atomic_store(&ring.reserve, HEAD_START);
+
+    reader_result_t results[READERS_MAX] = {0};
+    double t0 = now_s();
+    if (irq) {
+        /* first write after the reader attached, then every 20 us */
+        struct sigaction sa = {.sa_handler = producer_irq};
+        sigaction(SIGALRM, &sa, NULL);
+        struct itimerval period = {.it_interval = {0, 20}, .it_value = {0, 10000}};
+        setitimer(ITIMER_REAL, &period, NULL);
+        readers = 1;
+        reader(&results[0]);
+        struct itimerval off = {{0, 0}, {0, 0}};
+        setitimer(ITIMER_REAL, &off, NULL);
+    } else {
+        pthread_t r[READERS_MAX], p;
+        for (int i = 0; i < readers; i++) {
+            results[i].id = i;
+            pthread_create(&r[i], NULL, reader, &results[i]);
+        }
+        while (atomic_load(&attached) < readers) {
+            sched_yield();
+        }
+        t0 = now_s();
+        pthread_create(&p, NULL, producer, NULL);
+        pthread_join(p, NULL);
+        for (int i = 0; i < readers; i++) {
+            pthread_join(r[i], NULL);
+        }
+    }
+    double secs = now_s() - t0;
+
+    int errors = 0;
+    printf("%s%llu bytes through a %lu byte ring in %.2f s, %.0f MB/s\n", irq ? "interrupt mode, " : "",
+           (unsigned long long) written, (unsigned long) size, secs, (double) written / secs / (1 << 20));
+    for (int i = 0; i < readers; i++) {
+        reader_result_t *res = &results[i];
+        /* positions wrap at 2^32, compare modulo that */
+        bool accounted = (uint32_t) (res->read + res->lost) == (uint32_t) res->covered
+                         && (uint32_t) res->covered == (uint32_t) written;
+        errors += res->bad != 0 || !accounted;
+        printf("reader %d (%s): %llu read, %llu lost in %llu overruns, %llu bad bytes%s\n", i,
+               res->id & 1 ? "slow" : "fast", (unsigned long long) res->read, (unsigned long long) res->lost,
+               (unsigned long long) res->overruns, (unsigned long long) res->bad,
+               accounted ? "" : ", read + lost does not add up to the bytes written");
+    }
+    return errors != 0;
+}
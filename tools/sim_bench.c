@@ -0,0 +1,407 @@
+/*
+ * End to end benchmarks of the capture and http pipeline, against the
+ * linux simulation build (see README, Simulation) or a device.
+ *
+ * Build: cc -O2 -o sim_bench sim_bench.c
+ * Usage: sim_bench [-h host] [-p http port] <test> ...
+ *
+ *   ws <seconds> [port] [baud]  uart to websocket: record bytes per second
+ *                               received on /ws. With a baud rate the port is
+ *                               started through /uartconfig first and stopped
+ *                               at the end.
+ *   log <seconds>               capture log bytes written per second, from
+ *                               the logger counters of /uartstats
+ *   get <path> [count]          download rate of a file, fetched count times
+ *
+ * Rates are of payload only: record data bytes for ws, file bytes for get.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define REC_HDR_SIZE    (16)
+#define FLAG_TX         (0x01)
+#define FLAG_EVENT      (0x02)
+#define FLAG_FRAME      (0x08)
+
+#define WS_OP_TEXT      (0x1)
+#define WS_OP_BINARY    (0x2)
+#define WS_OP_CLOSE     (0x8)
+#define WS_OP_PING      (0x9)
+#define WS_OP_PONG      (0xA)
+
+static const char *host = "127.0.0.1";
+static const char *http_port = "8080";
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_server(void) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    int err = getaddrinfo(host, http_port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "cannot connect to %s:%s\n", host, http_port);
+        return -1;
+    }
+    struct timeval tv = {.tv_sec = 10};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Read the response head into buf, returns its length including the empty
+ * line. Bytes after it are left in buf, *extra says how many. */
+static int read_head(int fd, char *buf, size_t size, size_t *extra) {
+    size_t fill = 0;
+    while (fill < size - 1) {
+        ssize_t n = recv(fd, buf + fill, size - 1 - fill, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        fill += n;
+        buf[fill] = '\0';
+        char *end = strstr(buf, "\r\n\r\n");
+        if (end != NULL) {
+            int head = end + 4 - buf;
+            *extra = fill - head;
+            return head;
+        }
+    }
+    return -1;
+}
+
+/* GET path, the body goes to body (NULL to just count it). Returns the
+ * body length or -1. */
+static long http_get(const char *path, char *body, size_t body_size) {
+    int fd = connect_server();
+    if (fd < 0) {
+        return -1;
+    }
+    char buf[8192];
+    int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+    size_t extra;
+    int head;
+    if (send_all(fd, buf, len) != 0 || (head = read_head(fd, buf, sizeof(buf), &extra)) < 0) {
+        fprintf(stderr, "GET %s: no response\n", path);
+        close(fd);
+        return -1;
+    }
+    if (strncmp(buf, "HTTP/1.1 200", 12) != 0) {
+        fprintf(stderr, "GET %s: %.*s\n", path, (int) strcspn(buf, "\r\n"), buf);
+        close(fd);
+        return -1;
+    }
+
+    long total = 0;
+    char *data = buf + head;
+    ssize_t n = extra;
+    do {
+        if (body != NULL && total + n < (long) body_size) {
+            memcpy(body + total, data, n);
+            body[total + n] = '\0';
+        }
+        total += n;
+        data = buf;
+    } while ((n = recv(fd, buf, sizeof(buf), 0)) > 0);
+    close(fd);
+    return total;
+}
+
+static int ws_send_frame(int fd, int opcode, const uint8_t *payload, size_t len) {
+    /* client frames are masked, a zero mask keeps the payload as is */
+    uint8_t frame[2 + 4 + 125];
+    if (len > 125) {
+        return -1;
+    }
+    frame[0] = 0x80 | opcode;
+    frame[1] = 0x80 | len;
+    memset(frame + 2, 0, 4);
+    memcpy(frame + 6, payload, len);
+    return send_all(fd, frame, 6 + len);
+}
+
+static int ws_open(int port) {
+    int fd = connect_server();
+    if (fd < 0) {
+        return -1;
+    }
+    char buf[1024];
+    int len = snprintf(buf, sizeof(buf),
+                       "GET /ws?port=%d HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                       port, host);
+    size_t extra;
+    if (send_all(fd, buf, len) != 0 || read_head(fd, buf, sizeof(buf), &extra) < 0
+        || strncmp(buf, "HTTP/1.1 101", 12) != 0) {
+        fprintf(stderr, "/ws: handshake failed\n");
+        close(fd);
+        return -1;
+    }
+    /* the server sends nothing before it has data, there is no extra */
+    return fd;
+}
+
+typedef struct {
+    uint64_t data_bytes;
+    uint64_t records;
+    uint64_t events;
+    uint64_t frames;
+    uint64_t gap_bytes;
+    uint64_t messages;
+} ws_totals_t;
+
+static void ws_count_records(ws_totals_t *t, const uint8_t *msg, size_t len) {
+    for (size_t off = 0; off + REC_HDR_SIZE <= len;) {
+        uint8_t flags = msg[off + 1];
+        uint16_t rec_len = msg[off + 2] | msg[off + 3] << 8;
+        if (flags & FLAG_EVENT) {
+            t->events++;
+        } else if (flags & FLAG_FRAME) {
+            t->frames++;
+        } else if (!(flags & FLAG_TX)) {
+            t->records++;
+            t->data_bytes += rec_len;
+        }
+        off += REC_HDR_SIZE + rec_len;
+    }
+}
+
+static int bench_ws(double seconds, int port, int baud) {
+    char path[96];
+    if (baud > 0) {
+        snprintf(path, sizeof(path), "/uartconfig?port=%d&speed=%d", port, baud);
+        if (http_get(path, NULL, 0) < 0) {
+            return 1;
+        }
+    }
+    int fd = ws_open(port);
+    if (fd < 0) {
+        return 1;
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 200000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    ws_totals_t t = {0};
+    uint8_t *msg = NULL;
+    size_t msg_size = 0;
+    double start = now_s(), end = start + seconds, first = 0, last = 0;
+    int rc = 0;
+    while (now_s() < end) {
+        uint8_t hdr[10];
+        ssize_t n = recv(fd, hdr, 2, MSG_WAITALL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+        if (n != 2) {
+            fprintf(stderr, "/ws: connection closed\n");
+            rc = 1;
+            break;
+        }
+        int opcode = hdr[0] & 0x0F;
+        uint64_t len = hdr[1] & 0x7F;
+        if (len == 126) {
+            if (recv_all(fd, hdr + 2, 2) != 0) {
+                rc = 1;
+                break;
+            }
+            len = (uint64_t) hdr[2] << 8 | hdr[3];
+        } else if (len == 127) {
+            if (recv_all(fd, hdr + 2, 8) != 0) {
+                rc = 1;
+                break;
+            }
+            len = 0;
+            for (int i = 0; i < 8; i++) {
+                len = len << 8 | hdr[2 + i];
+            }
+        }
+        if (len + 1 > msg_size) {
+            msg_size = len + 1;
+            msg = realloc(msg, msg_size);
+        }
+        if (msg == NULL || recv_all(fd, msg, len) != 0) {
+            rc = 1;
+            break;
+        }
+
+        if (opcode == WS_OP_BINARY) {
+            last = now_s();
+            if (t.messages++ == 0) {
+                first = last;
+            }
+            ws_count_records(&t, msg, len);
+        } else if (opcode == WS_OP_TEXT) {
+            msg[len] = '\0';
+            const char *gap = strstr((char *) msg, "\"gap\":");
+            if (gap != NULL) {
+                t.gap_bytes += strtoull(gap + 6, NULL, 10);
+            }
+        } else if (opcode == WS_OP_PING) {
+            ws_send_frame(fd, WS_OP_PONG, msg, len);
+        } else if (opcode == WS_OP_CLOSE) {
+            fprintf(stderr, "/ws: closed by the server\n");
+            rc = 1;
+            break;
+        }
+    }
+    ws_send_frame(fd, WS_OP_CLOSE, NULL, 0);
+    close(fd);
+    free(msg);
+    if (baud > 0) {
+        snprintf(path, sizeof(path), "/uartconfig?port=%d&stop=1", port);
+        http_get(path, NULL, 0);
+    }
+
+    /* between the first and the last message, not counting the wait for data */
+    double span = last > first ? last - first : seconds;
+    printf("ws: %llu messages, %llu records, %llu events, %llu frames in %.2f s\n",
+           (unsigned long long) t.messages, (unsigned long long) t.records, (unsigned long long) t.events,
+           (unsigned long long) t.frames, span);
+    printf("ws: %.1f KB/s record data, %.0f records/s, %.0f B per message, %llu bytes reported dropped\n",
+           t.data_bytes / span / 1024, t.records / span, t.messages ? (double) t.data_bytes / t.messages : 0.0,
+           (unsigned long long) t.gap_bytes);
+    return rc;
+}
+
+/* Sum of one logger counter over all ports */
+static long long logger_counter(const char *stats, const char *key) {
+    long long total = 0;
+    size_t key_len = strlen(key);
+    for (const char *p = strstr(stats, "\"logger\":{"); p != NULL; p = strstr(p + 1, "\"logger\":{")) {
+        const char *end = strchr(p, '}');
+        const char *v = strstr(p, key);
+        if (v != NULL && end != NULL && v < end) {
+            total += strtoll(v + key_len, NULL, 10);
+        }
+    }
+    return total;
+}
+
+static int bench_log(double seconds) {
+    static char stats[2][16384];
+    double t[2];
+    for (int i = 0; i < 2; i++) {
+        if (i == 1) {
+            usleep((useconds_t) (seconds * 1e6));
+        }
+        t[i] = now_s();
+        if (http_get("/uartstats", stats[i], sizeof(stats[i])) < 0) {
+            return 1;
+        }
+    }
+    double span = t[1] - t[0];
+    long long written = logger_counter(stats[1], "\"bytes_written\":") - logger_counter(stats[0], "\"bytes_written\":");
+    long long raw = logger_counter(stats[1], "\"bytes_raw\":") - logger_counter(stats[0], "\"bytes_raw\":");
+    long long dropped = logger_counter(stats[1], "\"bytes_dropped\":") - logger_counter(stats[0], "\"bytes_dropped\":");
+    long long blocks = logger_counter(stats[1], "\"blocks_written\":") - logger_counter(stats[0], "\"blocks_written\":");
+    printf("log: %.1f KB/s captured, %.1f KB/s written to files, %lld blocks, %lld bytes dropped in %.2f s\n",
+           raw / span / 1024, written / span / 1024, blocks, dropped, span);
+    return 0;
+}
+
+static int bench_get(const char *path, int count) {
+    long long total = 0;
+    double start = now_s(), worst = 0;
+    for (int i = 0; i < count; i++) {
+        double t0 = now_s();
+        long n = http_get(path, NULL, 0);
+        if (n < 0) {
+            return 1;
+        }
+        double t = now_s() - t0;
+        worst = t > worst ? t : worst;
+        total += n;
+    }
+    double span = now_s() - start;
+    printf("get %s: %d x %lld bytes, %.1f KB/s, %.1f ms per download, slowest %.1f ms\n", path, count,
+           total / count, total / span / 1024, span * 1000 / count, worst * 1000);
+    return 0;
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-h host] [-p http port] ws <seconds> [port] [baud]\n"
+                    "       %s [-h host] [-p http port] log <seconds>\n"
+                    "       %s [-h host] [-p http port] get <path> [count]\n", name, name, name);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-h") == 0) {
+            host = argv[i + 1];
+        } else if (strcmp(argv[i], "-p") == 0) {
+            http_port = argv[i + 1];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (i + 1 >= argc) {
+        return usage(argv[0]);
+    }
+    const char *test = argv[i];
+    const char *arg = argv[i + 1];
+    if (strcmp(test, "ws") == 0) {
+        return bench_ws(atof(arg), i + 2 < argc ? atoi(argv[i + 2]) : 1, i + 3 < argc ? atoi(argv[i + 3]) : 0);
+    }
+    if (strcmp(test, "log") == 0) {
+        return bench_log(atof(arg));
+    }
+    if (strcmp(test, "get") == 0) {
+        return bench_get(arg, i + 2 < argc ? atoi(argv[i + 2]) : 1);
+    }
+    return usage(argv[0]);
+}
@@ -0,0 +1,103 @@
+/*
+ * Measure what the console debug tap costs the receive path.
+ *
+ * Build: cc -O2 -I../main -o tap_bench tap_bench.c ../main/debug_tap.c ../main/uart_ring.c
+ * Usage: tap_bench [record bytes] [MB]
+ *
+ * Feeds records of random bytes through debug_tap_feed() at every level,
+ * draining the tap every 50 ms of simulated line time like the device's
+ * tap task does, and reports the sustained rate of the feed path in MB/s.
+ * The old synchronous dump, one "0x%02x:" per byte through stdio, is run
+ * against /dev/null for comparison. On the device that dump also waits
+ * for the console: 5 characters per byte on a 115200 baud console cap
+ * the receive task at 2304 B/s, whatever the CPU does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug_tap.h"
+
+#define DRAIN_US (50 * 1000)
+#define CONSOLE_BAUD (115200)
+
+static size_t lines_out;
+
+static void count_line(void *ctx, const char *line) {
+    FILE *sink = ctx;
+    fputs(line, sink);
+    fputc('\n', sink);
+    lines_out++;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_bytes(FILE *sink, const uint8_t *bytes, int len) {
+    for (int i = 0; i < len; i++) {
+        fprintf(sink, "%s0x%02x", i != 0 ? ":" : "", bytes[i]);
+    }
+    fputc('\n', sink);
+}
+
+int main(int argc, char *argv[]) {
+    size_t rec_len = argc > 1 ? strtoul(argv[1], NULL, 0) : 120;
+    size_t total = (argc > 2 ? strtoul(argv[2], NULL, 0) : 256) << 20;
+    if (rec_len == 0 || rec_len > 1024 || total < rec_len) {
+        fprintf(stderr, "usage: %s [record bytes 1..1024] [MB]\n", argv[0]);
+        return 1;
+    }
+    FILE *sink = fopen("/dev/null", "w");
+    if (sink == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    uint8_t data[2048];
+    srand(1);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+    /* line time of a record at 921600 baud, 10 bits per byte */
+    int64_t rec_us = (int64_t) rec_len * 10 * 1000000 / 921600 + 1;
+    size_t recs = total / rec_len;
+
+    static debug_tap_t tap;
+    const debug_tap_level_t levels[] = {DEBUG_TAP_OFF, DEBUG_TAP_SUMMARY, DEBUG_TAP_HEX};
+    for (int l = 0; l < 3; l++) {
+        debug_tap_init(&tap, 1);
+        debug_tap_set_level(levels[l]);
+        lines_out = 0;
+        int64_t ts_us = 0, drained_us = 0;
+        double t0 = now_s();
+        for (size_t r = 0; r < recs; r++) {
+            debug_tap_feed(&tap, data + (r * 7) % (sizeof(data) - rec_len), rec_len, ts_us);
+            ts_us += rec_us;
+            if (ts_us - drained_us >= DRAIN_US) {
+                debug_tap_drain(&tap, ts_us, count_line, sink);
+                drained_us = ts_us;
+            }
+        }
+        double s = now_s() - t0;
+        printf("tap %-8s %9.1f MB/s  %zu lines for %.1f s of line time\n", debug_tap_level_name(levels[l]),
+               recs * rec_len / s / 1e6, lines_out, ts_us / 1e6);
+    }
+
+    /* the dump is slow, a sixteenth of the data is plenty */
+    size_t dump_recs = recs / 16 > 0 ? recs / 16 : 1;
+    double t0 = now_s();
+    for (size_t r = 0; r < dump_recs; r++) {
+        print_bytes(sink, data + (r * 7) % (sizeof(data) - rec_len), (int) rec_len);
+    }
+    double s = now_s() - t0;
+    printf("print_bytes %9.1f MB/s  to /dev/null, %d B/s through a %d baud console\n",
+           dump_recs * rec_len / s / 1e6, CONSOLE_BAUD / 10 / 5, CONSOLE_BAUD);
+
+    fclose(sink);
+    return 0;
+}
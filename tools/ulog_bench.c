@@ -0,0 +1,128 @@
+/*
+ * Compare the binary capture log format with the old text log.
+ *
+ * Build: cc -O2 -I../main -o ulog_bench ulog_bench.c ../main/ulog_format.c ../main/ulog_lz.c
+ * Usage: ulog_bench [record bytes] [MB]
+ *
+ * Runs records of random bytes through the old formatter of uart_task,
+ * localtime() plus one sprintf("%s%02x") per byte into a text buffer and a
+ * strlen() of it, and through ulog_rec_encode(). For each it reports the
+ * rate in MB/s of captured bytes, the CPU time per captured byte, the share
+ * of one core it takes to keep up with a 921600 baud line and how many
+ * bytes it writes to flash per captured byte. Decoding the binary log and
+ * rendering it as text, which moved off the device into the viewer and
+ * ulog_decode, is measured too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "ulog_format.h"
+
+#define LINE_BAUD (921600)
+
+typedef struct {
+    size_t recs;
+    size_t text_bytes;
+    char *text;
+} decode_ctx_t;
+
+static double cpu_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* uart_task before the binary format, with its 1024 byte buffer */
+static size_t old_format(char *out, const uint8_t *buf, int len) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    struct tm *timeinfo = localtime(&tv.tv_sec);
+    sprintf(out, "\n%02d:%02d:%02d.%03ld: ", timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec,
+            (long) tv.tv_usec / 1000);
+    int start_idx = strlen(out) - 1;
+    for (int i = 0; i < len; i++) {
+        sprintf(out + start_idx, "%s%02x", i != 0 ? " " : "", buf[i]);
+        start_idx += (i != 0 ? 3 : 2);
+    }
+    return strlen(out);
+}
+
+static void render_rec(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    decode_ctx_t *d = ctx;
+    d->recs++;
+    d->text_bytes += ulog_format_text(file, hdr, data, d->text);
+}
+
+static void report(const char *what, size_t in_bytes, size_t out_bytes, double s) {
+    double ns_byte = s * 1e9 / in_bytes;
+    printf("%-20s %8.1f MB/s  %6.1f ns/B  %5.2f%% of a core at %d baud", what, in_bytes / s / 1e6, ns_byte,
+           ns_byte * (LINE_BAUD / 10) / 1e7, LINE_BAUD);
+    if (out_bytes != 0) {
+        printf("  %.2f B written per B", (double) out_bytes / in_bytes);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t rec_len = argc > 1 ? strtoul(argv[1], NULL, 0) : 120;
+    size_t total = (argc > 2 ? strtoul(argv[2], NULL, 0) : 64) << 20;
+    if (rec_len == 0 || rec_len > 320 || total < rec_len) {
+        fprintf(stderr, "usage: %s [record bytes 1..320] [MB]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t data[2048];
+    srand(1);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+    size_t recs = total / rec_len;
+    int64_t rec_us = (int64_t) rec_len * 10 * 1000000 / LINE_BAUD + 1;
+    uint32_t ns_per_byte = 10 * 1000000000ull / LINE_BAUD;
+
+    /* the old formatter is slow, a sixteenth of the data is plenty */
+    static char text[ULOG_TEXT_MAX(ULOG_REC_MAX)];
+    size_t old_recs = recs / 16 > 0 ? recs / 16 : 1;
+    size_t old_out = 0;
+    double t0 = cpu_s();
+    for (size_t r = 0; r < old_recs; r++) {
+        old_out += old_format(text, data + (r * 7) % (sizeof(data) - rec_len), (int) rec_len);
+    }
+    report("sprintf text", old_recs * rec_len, old_out, cpu_s() - t0);
+
+    size_t log_size = sizeof(ulog_file_hdr_t) + recs * (sizeof(ulog_rec_hdr_t) + rec_len);
+    uint8_t *log = malloc(log_size);
+    if (log == NULL) {
+        fprintf(stderr, "out of memory for a %zu byte log\n", log_size);
+        return 1;
+    }
+    ulog_file_hdr_init((ulog_file_hdr_t *) log, 0, 0, LINE_BAUD);
+    size_t pos = sizeof(ulog_file_hdr_t);
+    int64_t ts_us = 0;
+    t0 = cpu_s();
+    for (size_t r = 0; r < recs; r++) {
+        const uint8_t *rec = data + (r * 7) % (sizeof(data) - rec_len);
+        pos += ulog_rec_encode(log + pos, 0, ns_per_byte, ts_us, rec, (uint16_t) rec_len);
+        ts_us += rec_us;
+    }
+    report("ulog_rec_encode", recs * rec_len, pos, cpu_s() - t0);
+
+    static ulog_decoder_t dec;
+    decode_ctx_t ctx = {.text = text};
+    ulog_decoder_init(&dec);
+    t0 = cpu_s();
+    ulog_decode(&dec, log, pos, render_rec, &ctx);
+    double s = cpu_s() - t0;
+    if (ctx.recs != recs) {
+        fprintf(stderr, "decoded %zu of %zu records\n", ctx.recs, recs);
+        return 1;
+    }
+    report("decode + text (host)", recs * rec_len, 0, s);
+
+    free(log);
+    return 0;
+}
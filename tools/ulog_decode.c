@@ -0,0 +1,72 @@
+/*
+ * Render binary capture logs (.ulg) downloaded from the device as the
+ * hex/timestamp text view.
+ *
+ * Build: cc -O2 -I../main -o ulog_decode ulog_decode.c ../main/ulog_format.c ../main/ulog_lz.c
+ * Usage: ulog_decode file.ulg [more.ulg ...] > capture.txt
+ *
+ * Times are shown in the local timezone, set TZ to match the device
+ * (the web page configures it as CST-8).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ulog_format.h"
+
+static void print_record(void *ctx, const ulog_file_hdr_t *file, const ulog_rec_hdr_t *hdr, const uint8_t *data) {
+    char *out = ctx;
+    size_t len = ulog_format_text(file, hdr, data, out);
+    fwrite(out, 1, len, stdout);
+}
+
+static int decode_file(const char *path, ulog_decoder_t *dec, char *out) {
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    uint8_t buf[8192];
+    size_t n;
+    int ret = 0;
+    ulog_decoder_init(dec);
+    while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) {
+        if (!ulog_decode(dec, buf, n, print_record, out)) {
+            fprintf(stderr, "%s: not a capture log\n", path);
+            ret = -1;
+            break;
+        }
+    }
+    fclose(fd);
+
+    if (dec->resyncs > 0) {
+        fprintf(stderr, "%s: skipped %u corrupt bytes\n", path, dec->resyncs);
+    }
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file.ulg [more.ulg ...]\n", argv[0]);
+        return 2;
+    }
+
+    ulog_decoder_t *dec = malloc(sizeof(ulog_decoder_t));
+    char *out = malloc(ULOG_TEXT_MAX(ULOG_REC_MAX));
+    if (dec == NULL || out == NULL) {
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        if (decode_file(argv[i], dec, out) != 0) {
+            ret = 1;
+        }
+    }
+    printf("\n");
+
+    free(dec);
+    free(out);
+    return ret;
+}